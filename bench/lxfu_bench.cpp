@@ -0,0 +1,370 @@
+#include "synthetic_db.hpp"
+
+#include "config.hpp"
+#include "embedding_index.hpp"
+#include "face_detector.hpp"
+#include "face_engine.hpp"
+#include "lmdb_store.hpp"
+#include "similarity.hpp"
+
+#include <benchmark/benchmark.h>
+#include <opencv2/opencv.hpp>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Microbenchmarks for the detector, the engine, the store and the matcher.
+//
+// Store and matcher benchmarks run on synthetic databases (synthetic_db.hpp)
+// created under a temporary directory with a fixed seed, so numbers are
+// comparable between runs and machines. Engine benchmarks load the model
+// from lxfu.conf and are skipped when it is missing. Set LXFU_BENCH_IMAGE to
+// a photo to time detection on a real face instead of a synthetic frame.
+//
+//   lxfu_bench --benchmark_filter=Scan
+//   lxfu_bench --generate-db DIR [--profiles N] [--samples M] [--dim D] [--seed S] [--format f32|f16|int8]
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::size_t kSamplesPerProfile = 10;
+constexpr std::size_t kBenchDim = 384;
+constexpr std::size_t kQueryFrames = 8;
+
+const Config& bench_config() {
+    static Config config = load_config(false);
+    return config;
+}
+
+// Synthetic databases keyed by (samples, encoding), built on first use and
+// removed at exit.
+class BenchDatabases {
+public:
+    ~BenchDatabases() {
+        stores_.clear();
+        std::error_code ec;
+        fs::remove_all(root_, ec);
+    }
+
+    LMDBStore& get(std::size_t samples, SampleEncoding encoding) {
+        auto key = std::make_pair(samples, encoding);
+        auto it = stores_.find(key);
+        if (it == stores_.end()) {
+            fs::path path = root_ / ("db-" + std::to_string(samples) + "-" + sample_encoding_name(encoding));
+            auto store = std::make_unique<LMDBStore>(path.string());
+            store->set_sample_encoding(encoding);
+            write_synthetic_db(*store, spec_for(samples));
+            it = stores_.emplace(key, std::move(store)).first;
+        }
+        return *it->second;
+    }
+
+    static SyntheticDbSpec spec_for(std::size_t samples) {
+        SyntheticDbSpec spec;
+        spec.samples_per_profile = std::min(samples, kSamplesPerProfile);
+        spec.profiles = std::max<std::size_t>(1, samples / spec.samples_per_profile);
+        spec.dim = kBenchDim;
+        return spec;
+    }
+
+private:
+    fs::path root_ = fs::temp_directory_path() / ("lxfu_bench-" + std::to_string(::getpid()));
+    std::map<std::pair<std::size_t, SampleEncoding>, std::unique_ptr<LMDBStore>> stores_;
+};
+
+BenchDatabases& databases() {
+    static BenchDatabases dbs;
+    return dbs;
+}
+
+// Camera-like frames: a real photo resized to each resolution when
+// LXFU_BENCH_IMAGE is set, otherwise seeded noise (no face, so detection
+// scans every window - the slow path).
+cv::Mat bench_frame(int width, int height) {
+    if (const char* path = std::getenv("LXFU_BENCH_IMAGE")) {
+        cv::Mat photo = cv::imread(path);
+        if (!photo.empty()) {
+            cv::Mat frame;
+            cv::resize(photo, frame, cv::Size(width, height));
+            return frame;
+        }
+    }
+    cv::Mat frame(height, width, CV_8UC3);
+    SyntheticRng rng(42);
+    for (int y = 0; y < frame.rows; ++y) {
+        unsigned char* row = frame.ptr<unsigned char>(y);
+        for (int x = 0; x < frame.cols * 3; ++x) {
+            row[x] = static_cast<unsigned char>(rng.uniform() * 256.0);
+        }
+    }
+    return frame;
+}
+
+FaceDetector& bench_detector() {
+    static FaceDetector detector(FaceDetectorSettings::from_config(bench_config()), /*verbose=*/false);
+    return detector;
+}
+
+// nullptr (with the reason in `error`) when the model cannot be loaded.
+FaceEngine* bench_engine(std::string& error) {
+    static std::unique_ptr<FaceEngine> engine;
+    static std::string load_error;
+    static bool tried = false;
+    if (!tried) {
+        tried = true;
+        try {
+            ModelSettings settings = ModelSettings::from_config(bench_config());
+            engine = std::make_unique<FaceEngine>(settings, /*verbose=*/false);
+            engine->warm_up(settings);
+        } catch (const std::exception& ex) {
+            load_error = ex.what();
+        }
+    }
+    error = load_error;
+    return engine.get();
+}
+
+// Query frames close to profile 0, so a scan has one real match.
+std::vector<std::vector<float>> bench_queries() {
+    SyntheticDbSpec spec = BenchDatabases::spec_for(kSamplesPerProfile);
+    SyntheticRng rng(spec.seed);
+    std::vector<float> identity = random_unit_vector(rng, spec.dim);
+    SyntheticRng jitter(spec.seed + 1);
+    std::vector<std::vector<float>> queries;
+    for (std::size_t i = 0; i < kQueryFrames; ++i) {
+        queries.push_back(jittered_sample(jitter, identity, spec.jitter));
+    }
+    return queries;
+}
+
+void add_resolutions(benchmark::internal::Benchmark* b) {
+    b->Args({320, 240})->Args({640, 480})->Args({1280, 720})->Args({1920, 1080});
+}
+
+void add_store_sizes(benchmark::internal::Benchmark* b) {
+    b->ArgsProduct({{10, 100, 1000, 10000, 100000},
+                    {static_cast<int>(SampleEncoding::F32), static_cast<int>(SampleEncoding::F16),
+                     static_cast<int>(SampleEncoding::I8)}});
+}
+
+SampleEncoding encoding_arg(const benchmark::State& state) {
+    return static_cast<SampleEncoding>(state.range(1));
+}
+
+} // namespace
+
+// --- Detector ---------------------------------------------------------------
+
+static void BM_CropToFace(benchmark::State& state) {
+    cv::Mat frame = bench_frame(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    FaceDetector& detector = bench_detector();
+    if (!detector.is_initialized()) {
+        state.SkipWithError("face detector not available");
+        return;
+    }
+    std::size_t found = 0;
+    for (auto _ : state) {
+        auto face = detector.crop_to_face(frame);
+        found += face.has_value();
+        benchmark::DoNotOptimize(face);
+    }
+    state.counters["face_rate"] = static_cast<double>(found) / static_cast<double>(state.iterations());
+}
+BENCHMARK(BM_CropToFace)->Apply(add_resolutions)->Unit(benchmark::kMillisecond);
+
+// The pre-inference quality gate on a centered box covering a third of the frame.
+static void BM_FaceQuality(benchmark::State& state) {
+    cv::Mat frame = bench_frame(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    FaceDetector& detector = bench_detector();
+    const cv::Rect face(frame.cols / 3, frame.rows / 3, frame.cols / 3, frame.rows / 3);
+    for (auto _ : state) {
+        FaceQuality quality = detector.assess_quality(frame, face);
+        benchmark::DoNotOptimize(quality);
+    }
+}
+BENCHMARK(BM_FaceQuality)->Apply(add_resolutions)->Unit(benchmark::kMicrosecond);
+
+// --- Engine -----------------------------------------------------------------
+
+static void BM_Preprocess(benchmark::State& state) {
+    std::string error;
+    FaceEngine* engine = bench_engine(error);
+    if (!engine) {
+        state.SkipWithError(error.c_str());
+        return;
+    }
+    cv::Mat face = bench_frame(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    std::vector<float> out(FaceEngine::input_floats());
+    for (auto _ : state) {
+        engine->preprocess(face, out.data());
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_Preprocess)->Args({160, 160})->Args({320, 320})->Args({640, 480})->Unit(benchmark::kMicrosecond);
+
+// Images per second at each batch size, on whichever device the engine picked.
+static void BM_ExtractEmbeddings(benchmark::State& state) {
+    std::string error;
+    FaceEngine* engine = bench_engine(error);
+    if (!engine) {
+        state.SkipWithError(error.c_str());
+        return;
+    }
+    const auto batch = static_cast<std::size_t>(state.range(0));
+    std::vector<cv::Mat> faces(batch, bench_frame(224, 224));
+    for (auto _ : state) {
+        auto embeddings = engine->extract_embeddings(faces, batch);
+        benchmark::DoNotOptimize(embeddings);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+    state.SetLabel(std::string(engine->uses_cuda() ? "cuda " : "cpu ") + model_precision_name(engine->precision()));
+}
+BENCHMARK(BM_ExtractEmbeddings)->RangeMultiplier(2)->Range(1, 64)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// --- Store ------------------------------------------------------------------
+
+// One enrollment write (a new profile, one sample) into a database of N
+// samples; the probe profile is removed again outside the timed region.
+static void BM_StoreEmbedding(benchmark::State& state) {
+    LMDBStore& store = databases().get(static_cast<std::size_t>(state.range(0)), encoding_arg(state));
+    const std::vector<float> sample = bench_queries().front();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.store_embedding("bench-probe", sample));
+        state.PauseTiming();
+        store.delete_embedding("bench-probe");
+        state.ResumeTiming();
+    }
+    state.SetLabel(sample_encoding_name(encoding_arg(state)));
+}
+BENCHMARK(BM_StoreEmbedding)->Apply(add_store_sizes)->Unit(benchmark::kMicrosecond);
+
+static void BM_GetAllEmbeddings(benchmark::State& state) {
+    const auto samples = static_cast<std::size_t>(state.range(0));
+    LMDBStore& store = databases().get(samples, encoding_arg(state));
+    for (auto _ : state) {
+        auto all = store.get_all_embeddings();
+        benchmark::DoNotOptimize(all);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * samples));
+    state.SetLabel(sample_encoding_name(encoding_arg(state)));
+}
+BENCHMARK(BM_GetAllEmbeddings)->Apply(add_store_sizes)->Unit(benchmark::kMicrosecond);
+
+// --- Matcher ----------------------------------------------------------------
+
+// Identify-mode scan: open a snapshot and score kQueryFrames queries against
+// every stored sample, as authentication does without means or ANN.
+static void BM_SimilarityScan(benchmark::State& state) {
+    const auto samples = static_cast<std::size_t>(state.range(0));
+    const LMDBStore& store = databases().get(samples, encoding_arg(state));
+    QueryBlock queries(bench_queries());
+    for (auto _ : state) {
+        LMDBStore::Snapshot snapshot = store.snapshot();
+        auto matches = score_profiles(snapshot, queries);
+        benchmark::DoNotOptimize(matches);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * samples));
+    state.SetLabel(sample_encoding_name(encoding_arg(state)));
+}
+BENCHMARK(BM_SimilarityScan)->Apply(add_store_sizes)->Unit(benchmark::kMicrosecond);
+
+// First-stage scoring against the cached per-profile means.
+static void BM_ProfileMeanScan(benchmark::State& state) {
+    const auto samples = static_cast<std::size_t>(state.range(0));
+    const LMDBStore& store = databases().get(samples, encoding_arg(state));
+    QueryBlock queries(bench_queries());
+    for (auto _ : state) {
+        LMDBStore::Snapshot snapshot = store.snapshot();
+        auto matches = score_profile_means(snapshot, queries);
+        benchmark::DoNotOptimize(matches);
+    }
+    state.SetLabel(sample_encoding_name(encoding_arg(state)));
+}
+BENCHMARK(BM_ProfileMeanScan)->Apply(add_store_sizes)->Unit(benchmark::kMicrosecond);
+
+static void BM_Dot(benchmark::State& state) {
+    const auto dim = static_cast<std::size_t>(state.range(0));
+    SyntheticRng rng(7);
+    std::vector<float> a = random_unit_vector(rng, dim);
+    std::vector<float> b = random_unit_vector(rng, dim);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(similarity::dot(a.data(), b.data(), dim));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_Dot)->Arg(384)->Arg(768)->Arg(1024);
+
+// --- Synthetic database generator -------------------------------------------
+
+namespace {
+
+int generate_db(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " --generate-db DIR [--profiles N] [--samples M] [--dim D]"
+                  << " [--seed S] [--format f32|f16|int8]\n";
+        return 1;
+    }
+    SyntheticDbSpec spec;
+    SampleEncoding encoding = SampleEncoding::F32;
+    const std::string dir = argv[2];
+    try {
+        for (int i = 3; i + 1 < argc; i += 2) {
+            const std::string flag = argv[i];
+            const std::string value = argv[i + 1];
+            if (flag == "--profiles") {
+                spec.profiles = std::stoul(value);
+            } else if (flag == "--samples") {
+                spec.samples_per_profile = std::stoul(value);
+            } else if (flag == "--dim") {
+                spec.dim = std::stoul(value);
+            } else if (flag == "--seed") {
+                spec.seed = std::stoull(value);
+            } else if (flag == "--format") {
+                auto parsed = parse_sample_encoding(value);
+                if (!parsed) {
+                    throw std::runtime_error("unknown format '" + value + "'");
+                }
+                encoding = *parsed;
+            } else {
+                throw std::runtime_error("unknown option '" + flag + "'");
+            }
+        }
+        LMDBStore store(dir);
+        if (store.size() > 0) {
+            throw std::runtime_error(dir + " already holds profiles");
+        }
+        store.set_sample_encoding(encoding);
+        write_synthetic_db(store, spec);
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+    std::cout << "✓ Wrote " << spec.profiles << " profile(s) x " << spec.samples_per_profile << " sample(s), dim "
+              << spec.dim << ", seed " << spec.seed << " (" << sample_encoding_name(encoding) << ") to " << dir
+              << std::endl;
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--generate-db") {
+        return generate_db(argc, argv);
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
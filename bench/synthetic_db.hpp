@@ -0,0 +1,125 @@
+#pragma once
+
+#include "lmdb_store.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Deterministic synthetic profiles for the benchmarks.
+//
+// Each profile has a random unit-vector "identity" and its samples are that
+// identity plus Gaussian jitter, renormalized, so within-profile similarity
+// looks like real enrollments (~0.8-0.95) and across-profile similarity is
+// near zero. Only std::mt19937_64 is used (its output sequence is fixed by the
+// standard, unlike the std distributions), so a given spec produces the same
+// profiles with every standard library, up to libm rounding.
+
+struct SyntheticDbSpec {
+    std::size_t profiles = 100;
+    std::size_t samples_per_profile = 10;
+    std::size_t dim = 384;
+    // Standard deviation of the per-sample jitter, per dimension before renormalizing.
+    double jitter = 0.02;
+    std::uint64_t seed = 42;
+};
+
+class SyntheticRng {
+public:
+    explicit SyntheticRng(std::uint64_t seed) : engine_(seed) {}
+
+    // Uniform in (0, 1).
+    double uniform() { return (static_cast<double>(engine_() >> 11) + 0.5) * 0x1.0p-53; }
+
+    // Standard normal via Box-Muller.
+    double normal() {
+        if (has_spare_) {
+            has_spare_ = false;
+            return spare_;
+        }
+        const double radius = std::sqrt(-2.0 * std::log(uniform()));
+        const double angle = 6.283185307179586 * uniform();
+        spare_ = radius * std::sin(angle);
+        has_spare_ = true;
+        return radius * std::cos(angle);
+    }
+
+private:
+    std::mt19937_64 engine_;
+    double spare_ = 0.0;
+    bool has_spare_ = false;
+};
+
+inline void normalize_in_place(std::vector<float>& v) {
+    double norm = 0.0;
+    for (float x : v) {
+        norm += static_cast<double>(x) * x;
+    }
+    const float inv = norm > 0.0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+    for (float& x : v) {
+        x *= inv;
+    }
+}
+
+inline std::vector<float> random_unit_vector(SyntheticRng& rng, std::size_t dim) {
+    std::vector<float> v(dim);
+    for (float& x : v) {
+        x = static_cast<float>(rng.normal());
+    }
+    normalize_in_place(v);
+    return v;
+}
+
+inline std::string synthetic_profile_name(std::size_t index) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "user%06zu", index);
+    return name;
+}
+
+// One sample near `identity`.
+inline std::vector<float> jittered_sample(SyntheticRng& rng, const std::vector<float>& identity, double jitter) {
+    std::vector<float> sample(identity);
+    for (float& x : sample) {
+        x += static_cast<float>(jitter * rng.normal());
+    }
+    normalize_in_place(sample);
+    return sample;
+}
+
+inline std::vector<std::pair<std::string, LMDBStore::EmbeddingList>> synthetic_profiles(const SyntheticDbSpec& spec) {
+    SyntheticRng rng(spec.seed);
+    std::vector<std::pair<std::string, LMDBStore::EmbeddingList>> profiles;
+    profiles.reserve(spec.profiles);
+    for (std::size_t p = 0; p < spec.profiles; ++p) {
+        const std::vector<float> identity = random_unit_vector(rng, spec.dim);
+        LMDBStore::EmbeddingList samples;
+        samples.reserve(spec.samples_per_profile);
+        for (std::size_t s = 0; s < spec.samples_per_profile; ++s) {
+            samples.push_back(jittered_sample(rng, identity, spec.jitter));
+        }
+        profiles.emplace_back(synthetic_profile_name(p), std::move(samples));
+    }
+    return profiles;
+}
+
+// Fill `store` with the spec's profiles, a few hundred per write transaction.
+// Dedup and the per-profile cap are off so the sample count is exact.
+inline void write_synthetic_db(LMDBStore& store, const SyntheticDbSpec& spec) {
+    constexpr std::size_t kProfilesPerTxn = 256;
+    auto profiles = synthetic_profiles(spec);
+    std::vector<std::pair<std::string, LMDBStore::EmbeddingList>> batch;
+    for (auto& profile : profiles) {
+        batch.push_back(std::move(profile));
+        if (batch.size() == kProfilesPerTxn) {
+            store.append_profiles(batch, SampleLimits::none());
+            batch.clear();
+        }
+    }
+    if (!batch.empty()) {
+        store.append_profiles(batch, SampleLimits::none());
+    }
+}
@@ -62,3 +62,4 @@ echo "  Binary: ${INSTALL_PREFIX}/bin/lxfu"
 echo "  Config: $([ "${INSTALL_PREFIX}" = "/usr" ] && echo "/etc/lxfu/lxfu.conf" || echo "${INSTALL_PREFIX}/etc/lxfu/lxfu.conf")"
 echo "  Model: ${INSTALL_PREFIX}/share/lxfu/dino.pt"
 echo "  PAM module: ${INSTALL_PREFIX}/lib/security/pam_lxfu.so"
+echo "  Daemon: ${INSTALL_PREFIX}/bin/lxfud (enable with: systemctl enable --now lxfud)"
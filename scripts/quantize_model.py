@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+"""Produce the INT8 model used by model_precision=int8.
+
+Applies PyTorch's dynamic quantization to the nn.Linear layers of the
+TorchScript DINOv3 model (weights stored as int8, activations quantized on the
+fly), which is where ViT inference spends most of its time on the CPU.
+
+Usage: quantize_model.py INPUT.pt OUTPUT.pt
+"""
+
+import argparse
+import sys
+
+import torch
+from torch.ao.quantization import default_dynamic_qconfig, quantize_dynamic_jit
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="FP32 TorchScript model (e.g. /usr/share/lxfu/dino.pt)")
+    parser.add_argument("output", help="where to write the quantized TorchScript model")
+    args = parser.parse_args()
+
+    model = torch.jit.load(args.input, map_location="cpu").eval()
+    quantized = quantize_dynamic_jit(model, {"": default_dynamic_qconfig})
+
+    # Sanity check on a random input: the quantized embedding must stay close.
+    with torch.no_grad():
+        sample = torch.randn(1, 3, 224, 224)
+        reference = model(sample).flatten(1)
+        result = quantized(sample).flatten(1)
+        cosine = torch.nn.functional.cosine_similarity(reference, result).item()
+    print(f"cosine(fp32, int8) on a random input: {cosine:.4f}")
+
+    quantized.save(args.output)
+    print(f"wrote {args.output}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,600 @@
+#pragma once
+
+#include "config.hpp"
+#include "similarity.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Approximate nearest-neighbour search over enrolled samples for identify
+// mode (query --all, allow_all). The index only proposes candidate profiles;
+// callers re-rank them exactly against the stored samples.
+
+struct AnnSettings {
+    bool enabled = false;
+    // Below this many profiles an exact scan is cheap enough; the index is skipped.
+    std::size_t min_profiles = 50;
+    // Nearest samples fetched per query; their profiles are re-ranked exactly.
+    std::size_t candidates = 64;
+    std::size_t ef_search = 128;
+    // Graph degree and build-time beam width (used when the index is built).
+    std::size_t m = 16;
+    std::size_t ef_construction = 200;
+
+    static AnnSettings from_config(const Config& config) {
+        AnnSettings s;
+        s.enabled = config.get_bool("ann_enabled", s.enabled);
+        s.min_profiles = static_cast<std::size_t>(std::max(0, config.get_int("ann_min_profiles", static_cast<int>(s.min_profiles))));
+        s.candidates = static_cast<std::size_t>(std::max(1, config.get_int("ann_candidates", static_cast<int>(s.candidates))));
+        s.ef_search = static_cast<std::size_t>(std::max(1, config.get_int("ann_ef_search", static_cast<int>(s.ef_search))));
+        s.m = static_cast<std::size_t>(std::clamp(config.get_int("ann_m", static_cast<int>(s.m)), 4, 64));
+        s.ef_construction = static_cast<std::size_t>(std::max(8, config.get_int("ann_ef_construction", static_cast<int>(s.ef_construction))));
+        return s;
+    }
+};
+
+// Bytes left between the read position and the end of `in`, so sizes read
+// from an index file can be checked before anything is allocated for them.
+inline std::uint64_t ann_remaining_bytes(std::istream& in) {
+    const std::streampos here = in.tellg();
+    in.seekg(0, std::ios::end);
+    const std::streampos end = in.tellg();
+    in.seekg(here);
+    if (!in || here < 0 || end < here) {
+        throw std::runtime_error("Truncated ANN index");
+    }
+    return static_cast<std::uint64_t>(end - here);
+}
+
+// HNSW graph (Malkov & Yashunin) over unit-length vectors, ranked by inner
+// product. Removed vectors stay in the graph as tombstones so it remains
+// navigable; they are filtered from results until the index is rebuilt.
+class HnswIndex {
+public:
+    // (similarity, node)
+    using Neighbor = std::pair<float, std::uint32_t>;
+
+    HnswIndex() = default;
+    HnswIndex(std::size_t dim, std::size_t m, std::size_t ef_construction)
+        : dim_(dim), m_(std::max<std::size_t>(2, m)), ef_construction_(std::max(ef_construction, m)),
+          level_mult_(1.0 / std::log(static_cast<double>(m_))) {}
+
+    std::size_t dim() const { return dim_; }
+    std::size_t m() const { return m_; }
+    std::size_t ef_construction() const { return ef_construction_; }
+    std::size_t size() const { return nodes_.size(); }
+    std::size_t deleted() const { return deleted_; }
+    std::uint32_t label(std::uint32_t node) const { return nodes_[node].label; }
+    bool is_deleted(std::uint32_t node) const { return nodes_[node].deleted != 0; }
+
+    std::uint32_t add(const float* vector, std::uint32_t label) {
+        const auto id = static_cast<std::uint32_t>(nodes_.size());
+        const int level = std::min(random_level(), kMaxLevel);
+        data_.insert(data_.end(), vector, vector + dim_);
+        nodes_.push_back(Node{label, 0, std::vector<std::vector<std::uint32_t>>(static_cast<std::size_t>(level) + 1)});
+
+        if (nodes_.size() == 1) {
+            entry_ = id;
+            max_level_ = level;
+            return id;
+        }
+
+        std::uint32_t current = entry_;
+        float current_sim = similarity_to(vector, current);
+        for (int l = max_level_; l > level; --l) {
+            greedy_step(vector, current, current_sim, l);
+        }
+
+        std::vector<Neighbor> entries{{current_sim, current}};
+        for (int l = std::min(level, max_level_); l >= 0; --l) {
+            std::vector<Neighbor> found = search_layer(vector, entries, ef_construction_, l);
+            std::vector<std::uint32_t> selected = select_neighbors(found, m_);
+            nodes_[id].links[static_cast<std::size_t>(l)] = selected;
+            for (std::uint32_t neighbor : selected) {
+                connect(neighbor, id, l);
+            }
+            entries = std::move(found);
+        }
+
+        if (level > max_level_) {
+            entry_ = id;
+            max_level_ = level;
+        }
+        return id;
+    }
+
+    // Tombstone every vector with this label. Returns how many were removed.
+    std::size_t remove_label(std::uint32_t label) {
+        std::size_t removed = 0;
+        for (auto& node : nodes_) {
+            if (node.label == label && !node.deleted) {
+                node.deleted = 1;
+                ++removed;
+            }
+        }
+        deleted_ += removed;
+        return removed;
+    }
+
+    // Up to k live nodes most similar to `query`, best first.
+    std::vector<Neighbor> search(const float* query, std::size_t k, std::size_t ef) const {
+        std::vector<Neighbor> results;
+        if (nodes_.empty() || k == 0) {
+            return results;
+        }
+        std::uint32_t current = entry_;
+        float current_sim = similarity_to(query, current);
+        for (int l = max_level_; l > 0; --l) {
+            greedy_step(query, current, current_sim, l);
+        }
+        // Tombstones take up beam slots, so widen the beam by the share of dead nodes.
+        std::size_t beam = std::max(ef, k);
+        if (deleted_ > 0) {
+            beam += beam * deleted_ / std::max<std::size_t>(1, nodes_.size() - deleted_);
+        }
+        for (const auto& candidate : search_layer(query, {{current_sim, current}}, beam, 0)) {
+            if (!nodes_[candidate.second].deleted) {
+                results.push_back(candidate);
+                if (results.size() == k) {
+                    break;
+                }
+            }
+        }
+        return results;
+    }
+
+    void write(std::ostream& out) const {
+        write_pod(out, static_cast<std::uint64_t>(dim_));
+        write_pod(out, static_cast<std::uint64_t>(m_));
+        write_pod(out, static_cast<std::uint64_t>(ef_construction_));
+        write_pod(out, static_cast<std::uint64_t>(nodes_.size()));
+        write_pod(out, entry_);
+        write_pod(out, static_cast<std::int32_t>(max_level_));
+        for (const auto& node : nodes_) {
+            write_pod(out, node.label);
+            write_pod(out, node.deleted);
+            write_pod(out, static_cast<std::uint32_t>(node.links.size()));
+            for (const auto& links : node.links) {
+                write_pod(out, static_cast<std::uint32_t>(links.size()));
+                out.write(reinterpret_cast<const char*>(links.data()),
+                          static_cast<std::streamsize>(links.size() * sizeof(std::uint32_t)));
+            }
+        }
+        out.write(reinterpret_cast<const char*>(data_.data()),
+                  static_cast<std::streamsize>(data_.size() * sizeof(float)));
+    }
+
+    // The file lives in the database directory and is read inside PAM hosts,
+    // so every size is bounded by the bytes actually left in the file before
+    // it is allocated, and the level structure is checked so that searches
+    // and later inserts never index past a node's own links.
+    static HnswIndex read(std::istream& in) {
+        HnswIndex index;
+        index.dim_ = static_cast<std::size_t>(read_pod<std::uint64_t>(in));
+        index.m_ = static_cast<std::size_t>(read_pod<std::uint64_t>(in));
+        index.ef_construction_ = static_cast<std::size_t>(read_pod<std::uint64_t>(in));
+        const auto count = read_pod<std::uint64_t>(in);
+        index.entry_ = read_pod<std::uint32_t>(in);
+        index.max_level_ = read_pod<std::int32_t>(in);
+        if (index.m_ < 2 || index.m_ > kMaxM || index.dim_ > kMaxDim || index.max_level_ < 0 ||
+            index.max_level_ > kMaxLevel || count > std::numeric_limits<std::uint32_t>::max() ||
+            (count > 0 && (index.dim_ == 0 || index.entry_ >= count))) {
+            throw std::runtime_error("Corrupt ANN index header");
+        }
+        index.level_mult_ = 1.0 / std::log(static_cast<double>(index.m_));
+
+        // Smallest possible node: label, flag, one level holding no links, and its vector.
+        const std::uint64_t min_node_bytes = 4 + 1 + 4 + 4 + index.dim_ * sizeof(float);
+        if (count > ann_remaining_bytes(in) / min_node_bytes) {
+            throw std::runtime_error("Truncated ANN index");
+        }
+        index.nodes_.resize(static_cast<std::size_t>(count));
+        for (auto& node : index.nodes_) {
+            node.label = read_pod<std::uint32_t>(in);
+            node.deleted = read_pod<std::uint8_t>(in);
+            index.deleted_ += node.deleted ? 1 : 0;
+            const auto levels = read_pod<std::uint32_t>(in);
+            if (levels == 0 || levels > static_cast<std::uint32_t>(index.max_level_) + 1) {
+                throw std::runtime_error("Corrupt ANN index levels");
+            }
+            node.links.resize(levels);
+            for (std::size_t level = 0; level < node.links.size(); ++level) {
+                auto& links = node.links[level];
+                const auto size = read_pod<std::uint32_t>(in);
+                if (size > index.max_links(static_cast<int>(level))) {
+                    throw std::runtime_error("Corrupt ANN index links");
+                }
+                links.resize(size);
+                in.read(reinterpret_cast<char*>(links.data()),
+                        static_cast<std::streamsize>(links.size() * sizeof(std::uint32_t)));
+                if (!in) {
+                    throw std::runtime_error("Truncated ANN index");
+                }
+            }
+        }
+        // A node linked at level L must itself reach level L, and the entry
+        // point must reach the top level.
+        for (const auto& node : index.nodes_) {
+            for (std::size_t level = 0; level < node.links.size(); ++level) {
+                for (std::uint32_t link : node.links[level]) {
+                    if (link >= count || index.nodes_[link].links.size() <= level) {
+                        throw std::runtime_error("Corrupt ANN index links");
+                    }
+                }
+            }
+        }
+        if (count > 0 && index.nodes_[index.entry_].links.size() != static_cast<std::size_t>(index.max_level_) + 1) {
+            throw std::runtime_error("Corrupt ANN index entry point");
+        }
+
+        if (count * index.dim_ > ann_remaining_bytes(in) / sizeof(float)) {
+            throw std::runtime_error("Truncated ANN index");
+        }
+        index.data_.resize(static_cast<std::size_t>(count) * index.dim_);
+        in.read(reinterpret_cast<char*>(index.data_.data()),
+                static_cast<std::streamsize>(index.data_.size() * sizeof(float)));
+        if (!in) {
+            throw std::runtime_error("Truncated ANN index");
+        }
+        return index;
+    }
+
+private:
+    struct Node {
+        std::uint32_t label = 0;
+        std::uint8_t deleted = 0;
+        std::vector<std::vector<std::uint32_t>> links; // one list per level
+    };
+
+    template <typename T>
+    static void write_pod(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static T read_pod(std::istream& in) {
+        T value{};
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        if (!in) {
+            throw std::runtime_error("Truncated ANN index");
+        }
+        return value;
+    }
+
+    const float* vector(std::uint32_t node) const { return data_.data() + static_cast<std::size_t>(node) * dim_; }
+
+    float similarity_to(const float* query, std::uint32_t node) const {
+        return similarity::dot(query, vector(node), dim_);
+    }
+
+    // Bounds for index files, far beyond anything add() produces: ann_m is
+    // clamped to 4..64, so a level above 32 has a probability below 2^-66.
+    static constexpr std::size_t kMaxM = 256;
+    static constexpr std::size_t kMaxDim = 65536;
+    static constexpr int kMaxLevel = 32;
+
+    std::size_t max_links(int level) const { return level == 0 ? 2 * m_ : m_; }
+
+    int random_level() {
+        std::uniform_real_distribution<double> uniform(std::numeric_limits<double>::min(), 1.0);
+        return static_cast<int>(-std::log(uniform(rng_)) * level_mult_);
+    }
+
+    void greedy_step(const float* query, std::uint32_t& current, float& current_sim, int level) const {
+        bool improved = true;
+        while (improved) {
+            improved = false;
+            for (std::uint32_t neighbor : nodes_[current].links[static_cast<std::size_t>(level)]) {
+                float sim = similarity_to(query, neighbor);
+                if (sim > current_sim) {
+                    current_sim = sim;
+                    current = neighbor;
+                    improved = true;
+                }
+            }
+        }
+    }
+
+    // Beam search on one level; returns up to `ef` nodes, best first.
+    std::vector<Neighbor> search_layer(const float* query, const std::vector<Neighbor>& entries,
+                                       std::size_t ef, int level) const {
+        std::vector<bool> visited(nodes_.size(), false);
+        std::priority_queue<Neighbor> frontier;                                              // best on top
+        std::priority_queue<Neighbor, std::vector<Neighbor>, std::greater<Neighbor>> found;  // worst on top
+        for (const auto& entry : entries) {
+            if (!visited[entry.second]) {
+                visited[entry.second] = true;
+                frontier.push(entry);
+                found.push(entry);
+            }
+        }
+        while (found.size() > ef) {
+            found.pop();
+        }
+
+        while (!frontier.empty()) {
+            Neighbor closest = frontier.top();
+            if (found.size() >= ef && closest.first < found.top().first) {
+                break;
+            }
+            frontier.pop();
+            const auto& node = nodes_[closest.second];
+            if (static_cast<std::size_t>(level) >= node.links.size()) {
+                continue;
+            }
+            for (std::uint32_t neighbor : node.links[static_cast<std::size_t>(level)]) {
+                if (visited[neighbor]) {
+                    continue;
+                }
+                visited[neighbor] = true;
+                float sim = similarity_to(query, neighbor);
+                if (found.size() < ef || sim > found.top().first) {
+                    frontier.push({sim, neighbor});
+                    found.push({sim, neighbor});
+                    if (found.size() > ef) {
+                        found.pop();
+                    }
+                }
+            }
+        }
+
+        std::vector<Neighbor> result(found.size());
+        for (std::size_t i = result.size(); i-- > 0;) {
+            result[i] = found.top();
+            found.pop();
+        }
+        return result;
+    }
+
+    // Neighbour selection heuristic: keep a candidate only if it is closer to
+    // the base point than to every neighbour already kept. Samples of one
+    // person form tight clusters; plain top-M would link only inside them.
+    std::vector<std::uint32_t> select_neighbors(const std::vector<Neighbor>& candidates, std::size_t limit) const {
+        std::vector<std::uint32_t> selected;
+        for (const auto& candidate : candidates) {
+            if (selected.size() >= limit) {
+                break;
+            }
+            bool keep = true;
+            for (std::uint32_t kept : selected) {
+                if (similarity_to(vector(candidate.second), kept) > candidate.first) {
+                    keep = false;
+                    break;
+                }
+            }
+            if (keep) {
+                selected.push_back(candidate.second);
+            }
+        }
+        return selected;
+    }
+
+    void connect(std::uint32_t from, std::uint32_t to, int level) {
+        auto& links = nodes_[from].links[static_cast<std::size_t>(level)];
+        links.push_back(to);
+        if (links.size() <= max_links(level)) {
+            return;
+        }
+        std::vector<Neighbor> candidates;
+        candidates.reserve(links.size());
+        for (std::uint32_t link : links) {
+            candidates.push_back({similarity_to(vector(from), link), link});
+        }
+        std::sort(candidates.begin(), candidates.end(), std::greater<Neighbor>());
+        links = select_neighbors(candidates, max_links(level));
+    }
+
+    std::size_t dim_ = 0;
+    std::size_t m_ = 16;
+    std::size_t ef_construction_ = 200;
+    double level_mult_ = 1.0 / std::log(16.0);
+    std::uint32_t entry_ = 0;
+    int max_level_ = 0;
+    std::size_t deleted_ = 0;
+    std::vector<Node> nodes_;
+    std::vector<float> data_;
+    std::mt19937_64 rng_{0x6c786675};
+};
+
+// HNSW index over every enrolled sample, labelled by profile, persisted next
+// to the LMDB environment. `txn_id` records the LMDB transaction the index
+// reflects; readers only trust it when that matches their snapshot.
+class ProfileAnnIndex {
+public:
+    static constexpr const char* kFileName = "ann.hnsw";
+
+    ProfileAnnIndex() = default;
+    explicit ProfileAnnIndex(const AnnSettings& settings) : m_(settings.m), ef_construction_(settings.ef_construction) {}
+
+    // Append samples (rows `stride` floats apart). Samples whose dimension
+    // differs from the index are skipped, as the matchers skip them.
+    bool add_samples(const std::string& name, const float* rows, std::size_t count, std::size_t dim,
+                     std::size_t stride) {
+        if (count == 0) {
+            return false;
+        }
+        if (graph_.dim() == 0) {
+            graph_ = HnswIndex(dim, m_, ef_construction_);
+        }
+        if (dim != graph_.dim()) {
+            return false;
+        }
+        std::uint32_t label = label_for(name);
+        for (std::size_t i = 0; i < count; ++i) {
+            graph_.add(rows + i * stride, label);
+        }
+        live_[label] = 1;
+        return true;
+    }
+
+    bool remove_profile(const std::string& name) {
+        auto it = labels_.find(name);
+        if (it == labels_.end() || !live_[it->second]) {
+            return false;
+        }
+        graph_.remove_label(it->second);
+        live_[it->second] = 0;
+        return true;
+    }
+
+    // Distinct profiles owning the `k` samples nearest to `query`, best first.
+    std::vector<std::string> search(const float* query, std::size_t dim, std::size_t k, std::size_t ef) const {
+        std::vector<std::string> names;
+        if (dim != graph_.dim()) {
+            return names;
+        }
+        std::vector<bool> seen(names_.size(), false);
+        for (const auto& [sim, node] : graph_.search(query, k, ef)) {
+            std::uint32_t label = graph_.label(node);
+            if (!seen[label]) {
+                seen[label] = true;
+                names.push_back(names_[label]);
+            }
+        }
+        return names;
+    }
+
+    std::size_t profile_count() const {
+        return static_cast<std::size_t>(std::count(live_.begin(), live_.end(), 1));
+    }
+    std::size_t sample_count() const { return graph_.size() - graph_.deleted(); }
+    double deleted_fraction() const {
+        return graph_.size() == 0 ? 0.0 : static_cast<double>(graph_.deleted()) / static_cast<double>(graph_.size());
+    }
+    std::size_t dim() const { return graph_.dim(); }
+
+    AnnSettings build_settings() const {
+        AnnSettings s;
+        s.m = m_;
+        s.ef_construction = ef_construction_;
+        return s;
+    }
+
+    std::uint64_t txn_id() const { return txn_id_; }
+    void set_txn_id(std::uint64_t txn_id) { txn_id_ = txn_id; }
+
+    // Written to a per-process temporary file and renamed, so readers never see
+    // half an index and concurrent writers never interleave.
+    void save(const std::string& path) const {
+        const std::string tmp = path + ".tmp." + std::to_string(::getpid());
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                throw std::runtime_error("Failed to write ANN index: " + tmp);
+            }
+            out.write(kMagic, sizeof(kMagic));
+            write_u64(out, kVersion);
+            write_u64(out, txn_id_);
+            write_u64(out, m_);
+            write_u64(out, ef_construction_);
+            write_u64(out, names_.size());
+            for (std::size_t i = 0; i < names_.size(); ++i) {
+                write_u64(out, names_[i].size());
+                out.write(names_[i].data(), static_cast<std::streamsize>(names_[i].size()));
+                out.put(static_cast<char>(live_[i]));
+            }
+            graph_.write(out);
+            if (!out) {
+                throw std::runtime_error("Failed to write ANN index: " + tmp);
+            }
+        }
+        std::filesystem::rename(tmp, path);
+    }
+
+    // nullopt when the file is missing, from another version, or corrupt.
+    static std::optional<ProfileAnnIndex> load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return std::nullopt;
+        }
+        try {
+            char magic[sizeof(kMagic)];
+            in.read(magic, sizeof(magic));
+            if (!in || !std::equal(magic, magic + sizeof(magic), kMagic) || read_u64(in) != kVersion) {
+                return std::nullopt;
+            }
+            ProfileAnnIndex index;
+            index.txn_id_ = read_u64(in);
+            index.m_ = static_cast<std::size_t>(read_u64(in));
+            index.ef_construction_ = static_cast<std::size_t>(read_u64(in));
+            const auto names = read_u64(in);
+            // Each name takes at least its length and its live flag.
+            if (names > ann_remaining_bytes(in) / (sizeof(std::uint64_t) + 1)) {
+                return std::nullopt;
+            }
+            for (std::uint64_t i = 0; i < names; ++i) {
+                const auto length = read_u64(in);
+                if (length > ann_remaining_bytes(in)) {
+                    return std::nullopt;
+                }
+                std::string name(static_cast<std::size_t>(length), '\0');
+                in.read(name.data(), static_cast<std::streamsize>(name.size()));
+                index.labels_.emplace(name, static_cast<std::uint32_t>(index.names_.size()));
+                index.names_.push_back(std::move(name));
+                index.live_.push_back(static_cast<std::uint8_t>(in.get()));
+            }
+            if (!in) {
+                return std::nullopt;
+            }
+            index.graph_ = HnswIndex::read(in);
+            for (std::size_t node = 0; node < index.graph_.size(); ++node) {
+                if (index.graph_.label(static_cast<std::uint32_t>(node)) >= index.names_.size()) {
+                    return std::nullopt;
+                }
+            }
+            return index;
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }
+
+private:
+    static constexpr char kMagic[8] = {'L', 'X', 'F', 'U', 'H', 'N', 'S', 'W'};
+    static constexpr std::uint64_t kVersion = 1;
+
+    static void write_u64(std::ostream& out, std::uint64_t value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static std::uint64_t read_u64(std::istream& in) {
+        std::uint64_t value = 0;
+        in.read(reinterpret_cast<char*>(&value), sizeof(value));
+        if (!in) {
+            throw std::runtime_error("Truncated ANN index");
+        }
+        return value;
+    }
+
+    std::uint32_t label_for(const std::string& name) {
+        auto [it, inserted] = labels_.emplace(name, static_cast<std::uint32_t>(names_.size()));
+        if (inserted) {
+            names_.push_back(name);
+            live_.push_back(0);
+        }
+        return it->second;
+    }
+
+    std::size_t m_ = 16;
+    std::size_t ef_construction_ = 200;
+    std::uint64_t txn_id_ = 0;
+    HnswIndex graph_;
+    std::vector<std::string> names_;
+    std::vector<std::uint8_t> live_;
+    std::unordered_map<std::string, std::uint32_t> labels_;
+};
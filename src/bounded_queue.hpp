@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// Bounded lock-free multi-producer/multi-consumer queue (Vyukov's ring of
+// sequence-stamped cells). try_push/try_pop never block; push/pop spin, then
+// yield, then sleep briefly, so idle stages do not burn a core.
+//
+// close() marks the end of the stream: pushes start failing and pops drain
+// whatever is left before reporting the queue as finished.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_ = std::make_unique<Cell[]>(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+    bool try_push(T value) {
+        return try_push_from(value);
+    }
+
+    bool try_pop(T& out) {
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(cell.value);
+                    cell.value = T{};
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Blocks while the queue is full. Fails once the queue is closed.
+    bool push(T value) {
+        Backoff backoff;
+        while (!closed()) {
+            if (try_push_from(value)) {
+                return true;
+            }
+            backoff.pause();
+        }
+        return false;
+    }
+
+    // Blocks until an item arrives, the deadline passes, or the queue is closed
+    // and drained.
+    template <typename Clock, typename Duration>
+    bool pop_until(T& out, const std::chrono::time_point<Clock, Duration>& deadline) {
+        Backoff backoff;
+        for (;;) {
+            if (try_pop(out)) {
+                return true;
+            }
+            if (closed()) {
+                // A producer may have pushed right before closing.
+                return try_pop(out);
+            }
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+            backoff.pause();
+        }
+    }
+
+    bool pop(T& out) {
+        return pop_until(out, std::chrono::steady_clock::time_point::max());
+    }
+
+    void close() { closed_.store(true, std::memory_order_release); }
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence{0};
+        T value{};
+    };
+
+    // Moves from `value` only when the push succeeds.
+    bool try_push_from(T& value) {
+        if (closed()) {
+            return false;
+        }
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    class Backoff {
+    public:
+        void pause() {
+            if (spins_ < 64) {
+                ++spins_;
+            } else if (spins_ < 128) {
+                ++spins_;
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+
+    private:
+        int spins_ = 0;
+    };
+
+    // Producers and consumers update separate cursors; keep them on separate lines.
+    static constexpr std::size_t kCacheLine = 64;
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_ = 0;
+    alignas(kCacheLine) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(kCacheLine) std::atomic<std::size_t> dequeue_pos_{0};
+    alignas(kCacheLine) std::atomic<bool> closed_{false};
+};
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "camera_frame.hpp"
+#include "config.hpp"
+#include "v4l2_capture.hpp"
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Camera setup shared by lxfu, pam_lxfu and lxfud: opening a device with a
+// per-device backend cache (or natively, see v4l2_capture.hpp), warming it up
+// until auto-exposure has settled, and doing both on a background thread
+// (PendingCamera) while the caller loads the model and the database.
+
+enum class CameraBackend { V4L2, Default, Index, Native };
+
+struct CameraSettings {
+    // capture_backend=v4l2: mmap'd V4L2 capture without OpenCV's per-frame
+    // BGR conversion; falls back to OpenCV when the device refuses it.
+    bool native_v4l2 = false;
+
+    static CameraSettings from_config(const Config& config) {
+        CameraSettings s;
+        s.native_v4l2 = config.get("capture_backend", "opencv") == "v4l2";
+        return s;
+    }
+};
+
+inline const char* camera_backend_name(CameraBackend backend) {
+    switch (backend) {
+        case CameraBackend::V4L2: return "CAP_V4L2";
+        case CameraBackend::Default: return "default backend";
+        case CameraBackend::Index: return "numeric index";
+        case CameraBackend::Native: return "native V4L2";
+    }
+    return "unknown";
+}
+
+inline bool parse_video_device_index(const std::string& path, int& index) {
+    if (path.rfind("/dev/video", 0) != 0) {
+        return false;
+    }
+    try {
+        index = std::stoi(path.substr(10));
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// "/dev/video0,/dev/video2" -> both paths, trimmed, without duplicates.
+inline std::vector<std::string> parse_device_list(const std::string& list) {
+    std::vector<std::string> devices;
+    std::size_t start = 0;
+    while (start <= list.size()) {
+        std::size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::size_t first = list.find_first_not_of(" \t", start);
+        std::size_t last = list.find_last_not_of(" \t", end == 0 ? 0 : end - 1);
+        if (first != std::string::npos && first < end && last >= first) {
+            std::string device = list.substr(first, last - first + 1);
+            if (std::find(devices.begin(), devices.end(), device) == devices.end()) {
+                devices.push_back(std::move(device));
+            }
+        }
+        start = end + 1;
+    }
+    return devices;
+}
+
+// Inverse of parse_device_list.
+inline std::string join_device_list(const std::vector<std::string>& devices) {
+    std::string list;
+    for (const auto& device : devices) {
+        list += (list.empty() ? "" : ",") + device;
+    }
+    return list;
+}
+
+namespace camera_detail {
+
+// Backend that last opened each device, for the life of the process.
+struct BackendCache {
+    std::mutex mutex;
+    std::map<std::string, CameraBackend> backends;
+};
+
+inline BackendCache& backend_cache() {
+    static BackendCache cache;
+    return cache;
+}
+
+inline bool try_backend(cv::VideoCapture& cap, const std::string& source, CameraBackend backend) {
+    switch (backend) {
+        case CameraBackend::V4L2:
+            return cap.open(source, cv::CAP_V4L2);
+        case CameraBackend::Default:
+            return cap.open(source);
+        case CameraBackend::Index: {
+            int index = -1;
+            return parse_video_device_index(source, index) && cap.open(index);
+        }
+        case CameraBackend::Native:
+            return false;
+    }
+    return false;
+}
+
+} // namespace camera_detail
+
+// Open `source`, starting with the backend that worked for it last time.
+// Otherwise (or if that fails) try the explicit V4L2 path first, so that
+// non-sequential devices such as IR cameras work, then the default backend,
+// then the numeric index. Returns the backend used, or nullopt on failure.
+inline std::optional<CameraBackend> open_camera(cv::VideoCapture& cap, const std::string& source) {
+    cap.release();
+    auto& cache = camera_detail::backend_cache();
+    std::optional<CameraBackend> cached;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto it = cache.backends.find(source);
+        if (it != cache.backends.end()) {
+            cached = it->second;
+        }
+    }
+    if (cached && camera_detail::try_backend(cap, source, *cached)) {
+        return cached;
+    }
+
+    for (CameraBackend backend : {CameraBackend::V4L2, CameraBackend::Default, CameraBackend::Index}) {
+        if (backend == cached) {
+            continue;
+        }
+        if (camera_detail::try_backend(cap, source, backend)) {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            cache.backends[source] = backend;
+            return backend;
+        }
+    }
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.backends.erase(source);
+    return std::nullopt;
+}
+
+inline void apply_camera_defaults(cv::VideoCapture& cap) {
+    cap.set(cv::CAP_PROP_FRAME_WIDTH, 640);
+    cap.set(cv::CAP_PROP_FRAME_HEIGHT, 480);
+    cap.set(cv::CAP_PROP_FPS, 30);
+}
+
+struct CameraWarmup {
+    // Read and discard frames for exactly this long (warmup_delay); 0 = wait
+    // for the exposure to settle instead.
+    double fixed_seconds = 0.0;
+    // Stop waiting for a settled exposure after this long and start anyway.
+    double max_seconds = 1.5;
+    // Settled once `stable_frames` consecutive frames are at least
+    // `min_brightness` and within `tolerance` of the previous frame's mean
+    // brightness (0-255).
+    int stable_frames = 3;
+    double tolerance = 2.0;
+    double min_brightness = 12.0;
+};
+
+struct WarmupResult {
+    int frames = 0;
+    bool settled = false;
+    double brightness = 0.0;
+};
+
+// Mean brightness over a sparse grid (every 4th pixel of every 4th row),
+// which is enough to follow auto-exposure at a few microseconds per frame.
+inline double frame_brightness(const cv::Mat& frame) {
+    if (frame.empty() || frame.depth() != CV_8U) {
+        return 0.0;
+    }
+    const int channels = frame.channels();
+    std::uint64_t sum = 0;
+    std::uint64_t count = 0;
+    for (int y = 0; y < frame.rows; y += 4) {
+        const unsigned char* row = frame.ptr<unsigned char>(y);
+        for (int x = 0; x < frame.cols; x += 4) {
+            const unsigned char* px = row + static_cast<std::size_t>(x) * channels;
+            for (int c = 0; c < channels && c < 3; ++c) {
+                sum += px[c];
+                ++count;
+            }
+        }
+    }
+    return count > 0 ? static_cast<double>(sum) / static_cast<double>(count) : 0.0;
+}
+
+struct OpenedCamera {
+    // Exactly one of the two is set.
+    std::unique_ptr<cv::VideoCapture> capture;
+    std::unique_ptr<V4l2Capture> native;
+    CameraBackend backend = CameraBackend::V4L2;
+    // Why capture_backend=v4l2 fell back to OpenCV, if it did.
+    std::string native_error;
+    WarmupResult warmup;
+    std::chrono::steady_clock::duration open_time{};
+    std::chrono::steady_clock::duration warmup_time{};
+
+    bool read(CameraFrame& frame) {
+        if (native) {
+            return native->read(frame);
+        }
+        frame.native.reset();
+        return capture->read(frame.image) && !frame.image.empty();
+    }
+
+    // Whole-frame BGR read, for single captures and previews.
+    bool read(cv::Mat& image) {
+        CameraFrame frame;
+        if (!read(frame)) {
+            return false;
+        }
+        image = frame.bgr();
+        return !image.empty();
+    }
+
+    void release() {
+        native.reset();
+        if (capture) {
+            capture->release();
+        }
+    }
+};
+
+// Open `source` with the configured backend; throws std::runtime_error when
+// no backend can open it.
+inline OpenedCamera start_camera(const std::string& source, const CameraSettings& settings) {
+    OpenedCamera camera;
+    if (settings.native_v4l2) {
+        try {
+            camera.native = std::make_unique<V4l2Capture>(source, V4l2Capture::Options{});
+            camera.backend = CameraBackend::Native;
+            return camera;
+        } catch (const std::exception& ex) {
+            camera.native_error = ex.what();
+        }
+    }
+    camera.capture = std::make_unique<cv::VideoCapture>();
+    auto backend = open_camera(*camera.capture, source);
+    if (!backend) {
+        throw std::runtime_error("failed to open capture device '" + source + "'");
+    }
+    camera.backend = *backend;
+    apply_camera_defaults(*camera.capture);
+    return camera;
+}
+
+// Discard frames until the exposure has settled (or for the fixed time).
+// Frames are read back to back: read() already blocks for the next frame.
+inline WarmupResult warm_up_camera(OpenedCamera& camera, const CameraWarmup& settings,
+                                   const std::atomic<bool>* cancel = nullptr) {
+    WarmupResult result;
+    const bool fixed = settings.fixed_seconds > 0.0;
+    const auto limit = std::chrono::duration<double>(fixed ? settings.fixed_seconds : std::max(0.0, settings.max_seconds));
+    const auto start = std::chrono::steady_clock::now();
+
+    CameraFrame frame;
+    double previous = -1.0;
+    int stable = 0;
+    while (std::chrono::steady_clock::now() - start < limit && !(cancel && cancel->load())) {
+        if (!camera.read(frame)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        ++result.frames;
+        if (fixed) {
+            continue;
+        }
+        result.brightness = frame_brightness(frame.detection_image());
+        const bool steady = previous >= 0.0 && std::abs(result.brightness - previous) <= settings.tolerance;
+        stable = (steady && result.brightness >= settings.min_brightness) ? stable + 1 : 0;
+        previous = result.brightness;
+        if (stable >= settings.stable_frames) {
+            result.settled = true;
+            break;
+        }
+    }
+    return result;
+}
+
+// Opens and warms up a camera on a background thread from construction, so
+// model loading and the database snapshot overlap with the camera's start-up.
+// Destroying it without calling get() cuts the warm-up short.
+class PendingCamera {
+public:
+    PendingCamera(std::string source, CameraSettings settings, CameraWarmup warmup) : source_(std::move(source)) {
+        future_ = std::async(std::launch::async, [this, settings, warmup] {
+            auto start = std::chrono::steady_clock::now();
+            OpenedCamera camera = start_camera(source_, settings);
+            auto opened = std::chrono::steady_clock::now();
+            camera.open_time = opened - start;
+            camera.warmup = warm_up_camera(camera, warmup, &cancel_);
+            camera.warmup_time = std::chrono::steady_clock::now() - opened;
+            return camera;
+        });
+    }
+
+    ~PendingCamera() {
+        cancel_.store(true);
+        if (future_.valid()) {
+            future_.wait();
+        }
+    }
+
+    PendingCamera(const PendingCamera&) = delete;
+    PendingCamera& operator=(const PendingCamera&) = delete;
+
+    const std::string& source() const { return source_; }
+
+    // Waits for the camera; throws std::runtime_error if it could not be opened.
+    OpenedCamera get() { return future_.get(); }
+
+private:
+    std::string source_;
+    std::atomic<bool> cancel_{false};
+    std::future<OpenedCamera> future_;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <memory>
+
+// A frame kept in the camera's own pixel format (see v4l2_capture.hpp). The
+// detector works on the luma plane and only the face region is converted to
+// BGR, instead of converting every frame in full.
+class NativeFrame {
+public:
+    virtual ~NativeFrame() = default;
+
+    virtual cv::Size size() const = 0;
+    // 8-bit single-channel luma of the whole frame.
+    virtual const cv::Mat& gray() const = 0;
+    // BGR copy of `roi`, clipped to the frame.
+    virtual cv::Mat color(const cv::Rect& roi) const = 0;
+
+    cv::Mat color() const { return color(cv::Rect(0, 0, size().width, size().height)); }
+};
+
+// One frame from a capture source: a BGR image from an OpenCV backend, or a
+// native frame. Copies share the pixels.
+struct CameraFrame {
+    cv::Mat image;
+    std::shared_ptr<const NativeFrame> native;
+
+    bool empty() const { return native ? false : image.empty(); }
+
+    cv::Size size() const { return native ? native->size() : cv::Size(image.cols, image.rows); }
+
+    // Detector input: the luma plane of a native frame, otherwise the BGR image.
+    const cv::Mat& detection_image() const { return native ? native->gray() : image; }
+
+    // The whole frame in BGR (converts a native frame).
+    cv::Mat bgr() const { return native ? native->color() : image; }
+
+    // BGR pixels of `roi`: a view into the image (which it keeps alive), or
+    // the converted region of a native frame, whose buffer goes back to the
+    // driver.
+    cv::Mat crop(const cv::Rect& roi) const {
+        if (native) {
+            return native->color(roi);
+        }
+        return image(roi & cv::Rect(0, 0, image.cols, image.rows));
+    }
+};
@@ -0,0 +1,509 @@
+#pragma once
+
+#include "bounded_queue.hpp"
+#include "camera_frame.hpp"
+#include "cpu_affinity.hpp"
+#include "face_detector.hpp"
+#include "metrics.hpp"
+#include "work_stealing_pool.hpp"
+
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Capture -> detect pipeline feeding an embedding consumer.
+//
+// A producer thread pulls frames from a FrameSource into a bounded queue,
+// a pool of detector workers crops faces out of them, and the caller drains
+// the crops with next_batch() in micro-batches, typically embedding one batch
+// while the camera and the detectors already work on the next frames.
+//
+// When the detectors fall behind the frame queue fills and new frames are
+// dropped rather than stalling the camera, so crops always come from recent
+// frames. Crops are delivered in completion order, not frame order.
+//
+// Each worker tracks the face across the frames it handles (see
+// FaceDetector::track_faces), so most frames only search a small window.
+//
+// Several pipelines (one per camera) can share a CaptureFaceQueue, so one
+// consumer batches crops from every camera into the same forward pass.
+//
+// With a detection pool (lxfud) the pipeline starts no detector threads: its
+// frames are detected by tasks on the shared WorkStealingPool, at most one at
+// a time and in order, so tracking still sees a single stream.
+//
+// Faces below the detector's quality bar (FaceQualitySettings) are dropped
+// before they reach the crop queue; kept crops carry their quality score.
+//
+// Native frames (capture_backend=v4l2) are detected on their luma plane when
+// the detector takes grayscale input, and only the face region is converted
+// to BGR.
+
+struct CapturedFace {
+    cv::Mat image;
+    std::size_t frame_index = 0;
+    // CapturePipelineOptions::source of the pipeline that produced it.
+    std::size_t source = 0;
+    // FaceQuality::score (1 when the quality gate is off).
+    double quality = 1.0;
+};
+
+// Crop queue of one or more pipelines. It closes when the detector workers of
+// every attached pipeline have finished and the owner called release(), or
+// when any of the pipelines is stopped.
+class CaptureFaceQueue {
+public:
+    explicit CaptureFaceQueue(std::size_t capacity) : faces_(std::max<std::size_t>(2, capacity)) {}
+
+    CaptureFaceQueue(const CaptureFaceQueue&) = delete;
+    CaptureFaceQueue& operator=(const CaptureFaceQueue&) = delete;
+
+    // Drop the owner's hold once every pipeline has been created.
+    void release() { detach(); }
+
+private:
+    friend class CapturePipeline;
+
+    void attach(std::size_t writers) { writers_.fetch_add(writers); }
+
+    void detach() {
+        if (writers_.fetch_sub(1) == 1) {
+            faces_.close();
+        }
+    }
+
+    BoundedQueue<CapturedFace> faces_;
+    std::atomic<std::size_t> writers_{1};
+};
+
+struct CapturePipelineOptions {
+    std::size_t detector_threads = 1;
+    std::size_t frame_queue_capacity = 4;
+    std::size_t face_queue_capacity = 64;
+    // Producer stops after this long (0 = a single frame) or after max_frames.
+    double duration_seconds = 2.0;
+    std::size_t max_frames = 0;
+    // Pause between frame reads; the producer otherwise runs at camera rate.
+    double frame_interval_seconds = 0.0;
+    int max_consecutive_failures = 20;
+    // Settings for the detectors the pipeline loads itself; when a shared
+    // detector is passed its settings are used instead.
+    FaceDetectorSettings detector_settings;
+    // CPUs for the producer and detector threads (empty = not pinned), so they
+    // stay off the cores reserved for inference.
+    std::vector<int> cpu_affinity;
+    // Receives frame_read and detect timings when set.
+    StageClock* clock = nullptr;
+    // Tag for this pipeline's crops, and a queue shared with other pipelines
+    // (null = the pipeline's own queue of face_queue_capacity).
+    std::size_t source = 0;
+    std::shared_ptr<CaptureFaceQueue> faces;
+    // Detect on this shared pool instead of detector_threads own threads;
+    // must outlive the pipeline.
+    WorkStealingPool* detection_pool = nullptr;
+};
+
+// Faces found in one frame, kept so previews can draw them without detecting again.
+struct FrameDetection {
+    cv::Mat frame;
+    std::vector<cv::Rect> faces;
+    std::size_t frame_index = 0;
+};
+
+struct CaptureStats {
+    std::size_t frames = 0;
+    std::size_t dropped_frames = 0;
+    std::size_t frames_with_faces = 0;
+    // Faces dropped by the quality gate (not counted in frames_with_faces).
+    std::size_t low_quality_faces = 0;
+    int read_failures = 0;
+};
+
+class CapturePipeline {
+public:
+    // Reads one frame; returns false on a failed read. Runs on the producer
+    // thread and may throw to abort the capture.
+    using FrameSource = std::function<bool(CameraFrame& frame)>;
+    // Called on the producer thread after each failed read with the running
+    // count of consecutive failures.
+    using FailureHook = std::function<void(int consecutive_failures)>;
+
+    // `shared_detector` (optional) is used by the first worker; every other
+    // worker loads its own FaceDetector because cascades are not thread-safe.
+    CapturePipeline(FrameSource source,
+                    const CapturePipelineOptions& options,
+                    FaceDetector* shared_detector = nullptr,
+                    FailureHook on_failure = nullptr)
+        : source_(std::move(source)),
+          on_failure_(std::move(on_failure)),
+          options_(options),
+          frames_(std::max<std::size_t>(2, options.frame_queue_capacity)),
+          faces_(options.faces ? options.faces : std::make_shared<CaptureFaceQueue>(options.face_queue_capacity)) {
+        const std::size_t workers =
+            options_.detection_pool ? 1 : std::max<std::size_t>(1, options_.detector_threads);
+        if (shared_detector) {
+            options_.detector_settings = shared_detector->settings();
+        }
+        for (std::size_t i = 0; i < workers; ++i) {
+            if (i == 0 && shared_detector) {
+                detectors_.push_back(shared_detector);
+            } else {
+                owned_detectors_.push_back(std::make_unique<FaceDetector>(options_.detector_settings, /*verbose=*/false));
+                detectors_.push_back(owned_detectors_.back().get());
+            }
+        }
+        faces_->attach(workers);
+
+        if (options_.detection_pool) {
+            // A shared detector may still track a face from an earlier capture.
+            detectors_.front()->reset_tracking();
+        }
+        producer_ = std::thread([this] { run_producer(); });
+        if (!options_.detection_pool) {
+            for (FaceDetector* detector : detectors_) {
+                workers_.emplace_back([this, detector] { run_detector(*detector); });
+            }
+        }
+        if (!options_.faces) {
+            faces_->release();
+        }
+    }
+
+    ~CapturePipeline() {
+        stop();
+        join();
+    }
+
+    CapturePipeline(const CapturePipeline&) = delete;
+    CapturePipeline& operator=(const CapturePipeline&) = delete;
+
+    // Waits up to `timeout` for at least one crop, then takes whatever else is
+    // ready, up to `max_items`. Returns false once the pipeline has finished and
+    // every crop has been handed out. With a shared queue this drains the crops
+    // of every pipeline attached to it.
+    bool next_batch(std::vector<CapturedFace>& batch, std::size_t max_items,
+                    std::chrono::milliseconds timeout) {
+        batch.clear();
+        CapturedFace face;
+        if (!faces_->faces_.pop_until(face, std::chrono::steady_clock::now() + timeout)) {
+            return !faces_->faces_.closed();
+        }
+        batch.push_back(std::move(face));
+        while (batch.size() < max_items && faces_->faces_.try_pop(face)) {
+            batch.push_back(std::move(face));
+        }
+        return true;
+    }
+
+    // Ask every stage to wind down; next_batch() drains what is already queued.
+    // Closes a shared crop queue for all of its pipelines.
+    void stop() {
+        stop_requested_.store(true);
+        frames_.close();
+        faces_->faces_.close();
+    }
+
+    void join() {
+        if (producer_.joinable()) {
+            producer_.join();
+        }
+        for (auto& worker : workers_) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+        workers_.clear();
+        if (options_.detection_pool) {
+            std::unique_lock<std::mutex> lock(drain_mutex_);
+            drain_done_.wait(lock, [this] { return drained_; });
+        }
+    }
+
+    bool finished() const { return faces_->faces_.closed(); }
+
+    // Most recent frame read by the producer (empty before the first one).
+    CameraFrame latest_frame() const {
+        std::lock_guard<std::mutex> lock(latest_mutex_);
+        return latest_frame_;
+    }
+
+    // Detection result of the most recently processed frame, or an empty frame
+    // before any detector finished one. Converts native frames to BGR.
+    FrameDetection latest_detection() const {
+        std::lock_guard<std::mutex> lock(latest_mutex_);
+        return FrameDetection{latest_detection_.frame.bgr(), latest_detection_.faces, latest_detection_.frame_index};
+    }
+
+    CaptureStats stats() const {
+        CaptureStats stats;
+        stats.frames = frames_read_.load();
+        stats.dropped_frames = frames_dropped_.load();
+        stats.frames_with_faces = frames_with_faces_.load();
+        stats.low_quality_faces = low_quality_faces_.load();
+        stats.read_failures = read_failures_.load();
+        return stats;
+    }
+
+    // Set when the producer gave up (source threw or too many failed reads).
+    std::string error() const {
+        std::lock_guard<std::mutex> lock(latest_mutex_);
+        return error_;
+    }
+
+private:
+    struct Frame {
+        CameraFrame image;
+        std::size_t index = 0;
+    };
+
+    struct Detection {
+        CameraFrame frame;
+        std::vector<cv::Rect> faces;
+        std::size_t frame_index = 0;
+    };
+
+    void run_producer() {
+        pin_current_thread(options_.cpu_affinity);
+        const auto start = std::chrono::steady_clock::now();
+        const auto duration = std::chrono::duration<double>(std::max(0.0, options_.duration_seconds));
+        const auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::duration<double>(std::max(0.0, options_.frame_interval_seconds)));
+        int consecutive_failures = 0;
+
+        try {
+            while (!stop_requested_.load()) {
+                const std::size_t read = frames_read_.load();
+                if (duration.count() > 0.0) {
+                    if (std::chrono::steady_clock::now() - start >= duration) {
+                        break;
+                    }
+                } else if (read > 0) {
+                    break;
+                }
+                if (options_.max_frames > 0 && read >= options_.max_frames) {
+                    break;
+                }
+
+                CameraFrame image;
+                bool ok;
+                {
+                    StageTimer timer(options_.clock, Stage::FrameRead);
+                    ok = source_(image);
+                }
+                if (!ok || image.empty()) {
+                    ++consecutive_failures;
+                    read_failures_.fetch_add(1);
+                    if (on_failure_) {
+                        on_failure_(consecutive_failures);
+                    }
+                    if (consecutive_failures >= options_.max_consecutive_failures) {
+                        set_error("camera stopped producing frames");
+                        break;
+                    }
+                    if (interval.count() > 0) {
+                        std::this_thread::sleep_for(interval);
+                    }
+                    continue;
+                }
+                consecutive_failures = 0;
+
+                {
+                    std::lock_guard<std::mutex> lock(latest_mutex_);
+                    latest_frame_ = image;
+                }
+                // Pool mode: counted before the push, so a drain task never
+                // pops a frame it has not been told about.
+                pending_frames_.fetch_add(1);
+                if (frames_.try_push(Frame{image, frames_read_.fetch_add(1)})) {
+                    if (options_.detection_pool) {
+                        schedule_drain();
+                    }
+                } else {
+                    pending_frames_.fetch_sub(1);
+                    frames_dropped_.fetch_add(1);
+                }
+
+                if (interval.count() > 0) {
+                    std::this_thread::sleep_for(interval);
+                }
+            }
+        } catch (const std::exception& ex) {
+            set_error(ex.what());
+        }
+        frames_.close();
+        if (options_.detection_pool) {
+            std::lock_guard<std::mutex> lock(drain_mutex_);
+            producer_done_ = true;
+            if (!drain_scheduled_) {
+                finish_drain();
+            }
+        }
+    }
+
+    void run_detector(FaceDetector& detector) {
+        pin_current_thread(options_.cpu_affinity);
+        // A shared detector may still track a face from an earlier capture.
+        detector.reset_tracking();
+        Frame frame;
+        while (frames_.pop(frame)) {
+            if (stop_requested_.load()) {
+                continue; // drain without work
+            }
+            detect_frame_or_stop(detector, frame);
+        }
+        faces_->detach();
+    }
+
+    void detect_frame(FaceDetector& detector, Frame& frame) {
+        std::vector<cv::Rect> faces;
+        std::optional<cv::Mat> face;
+        double quality = 1.0;
+        bool rejected = false;
+        if (detector.settings().enabled) {
+            StageTimer timer(options_.clock, Stage::Detect);
+            const CameraFrame& image = frame.image;
+            cv::Mat converted;
+            if (image.native && !detector.accepts_gray()) {
+                converted = image.bgr();
+            }
+            const cv::Mat& input = converted.empty() ? image.detection_image() : converted;
+            faces = detector.track_faces(input);
+            if (auto largest = FaceDetector::largest_face(faces)) {
+                if (detector.settings().quality.enabled) {
+                    FaceQuality assessed = detector.assess_quality(input, *largest);
+                    quality = assessed.score;
+                    rejected = !assessed.acceptable;
+                }
+                if (!rejected) {
+                    face = image.crop(FaceDetector::padded_rect(*largest, image.size(), detector.settings().padding));
+                }
+            }
+        } else {
+            face = frame.image.bgr();
+        }
+        {
+            std::lock_guard<std::mutex> lock(latest_mutex_);
+            if (latest_detection_.frame.empty() || frame.index > latest_detection_.frame_index) {
+                latest_detection_ = Detection{frame.image, std::move(faces), frame.index};
+            }
+        }
+        if (rejected) {
+            low_quality_faces_.fetch_add(1);
+        }
+        if (!face) {
+            return;
+        }
+        frames_with_faces_.fetch_add(1);
+        faces_->faces_.push(CapturedFace{std::move(*face), frame.index, options_.source, quality});
+    }
+
+    // A frame that fails detection (a cv::Exception on a corrupt native
+    // frame, bad_alloc) ends the capture like a camera error. The exception
+    // must not escape: a detector thread would terminate the process, and a
+    // pool task would be dropped before drain() updated its bookkeeping,
+    // leaving join() waiting for good.
+    void detect_frame_or_stop(FaceDetector& detector, Frame& frame) {
+        try {
+            detect_frame(detector, frame);
+        } catch (const std::exception& ex) {
+            set_error(std::string("face detection failed: ") + ex.what());
+            stop_requested_.store(true);
+        } catch (...) {
+            set_error("face detection failed");
+            stop_requested_.store(true);
+        }
+    }
+
+    // Pool mode. `pending_frames_` counts frames queued but not yet detected;
+    // exactly one drain task is scheduled while it is non-zero, and the last
+    // one to run out of frames after the producer ended detaches from the
+    // crop queue.
+    void schedule_drain() {
+        std::lock_guard<std::mutex> lock(drain_mutex_);
+        if (!drain_scheduled_) {
+            drain_scheduled_ = true;
+            options_.detection_pool->submit([this] { drain(); });
+        }
+    }
+
+    void drain() {
+        pin_current_thread(options_.cpu_affinity);
+        FaceDetector& detector = *detectors_.front();
+        std::size_t done = 0;
+        Frame frame;
+        // A few frames per task, so the pool's workers rotate between sessions.
+        while (done < kFramesPerDrain && frames_.try_pop(frame)) {
+            if (!stop_requested_.load()) {
+                detect_frame_or_stop(detector, frame);
+            }
+            ++done;
+        }
+        std::lock_guard<std::mutex> lock(drain_mutex_);
+        if (pending_frames_.fetch_sub(done) > done) {
+            options_.detection_pool->submit([this] { drain(); });
+            return;
+        }
+        drain_scheduled_ = false;
+        if (producer_done_) {
+            finish_drain();
+        }
+    }
+
+    // Called with drain_mutex_ held.
+    void finish_drain() {
+        if (!drained_) {
+            drained_ = true;
+            faces_->detach();
+            drain_done_.notify_all();
+        }
+    }
+
+    void set_error(const std::string& message) {
+        std::lock_guard<std::mutex> lock(latest_mutex_);
+        error_ = message;
+    }
+
+    FrameSource source_;
+    FailureHook on_failure_;
+    CapturePipelineOptions options_;
+
+    BoundedQueue<Frame> frames_;
+    std::shared_ptr<CaptureFaceQueue> faces_;
+
+    std::vector<std::unique_ptr<FaceDetector>> owned_detectors_;
+    std::vector<FaceDetector*> detectors_;
+
+    std::atomic<bool> stop_requested_{false};
+    std::atomic<std::size_t> frames_read_{0};
+    std::atomic<std::size_t> frames_dropped_{0};
+    std::atomic<std::size_t> frames_with_faces_{0};
+    std::atomic<std::size_t> low_quality_faces_{0};
+    std::atomic<int> read_failures_{0};
+
+    mutable std::mutex latest_mutex_;
+    CameraFrame latest_frame_;
+    Detection latest_detection_;
+    std::string error_;
+
+    static constexpr std::size_t kFramesPerDrain = 2;
+    std::mutex drain_mutex_;
+    std::condition_variable drain_done_;
+    std::atomic<std::size_t> pending_frames_{0};
+    bool drain_scheduled_ = false;
+    bool producer_done_ = false;
+    bool drained_ = false;
+
+    std::thread producer_;
+    std::vector<std::thread> workers_;
+};
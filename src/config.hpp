@@ -7,6 +7,7 @@
 #include <filesystem>
 #include <iostream>
 #include <cstdlib>
+#include <cctype>
 #include <vector>
 #include <algorithm>
 
@@ -100,6 +101,35 @@ public:
         }
     }
 
+    double get_double(const std::string& key, double default_value) const {
+        try {
+            return std::stod(get(key, std::to_string(default_value)));
+        } catch (const std::exception&) {
+            return default_value;
+        }
+    }
+
+    int get_int(const std::string& key, int default_value) const {
+        try {
+            return std::stoi(get(key, std::to_string(default_value)));
+        } catch (const std::exception&) {
+            return default_value;
+        }
+    }
+
+    bool get_bool(const std::string& key, bool default_value) const {
+        std::string value = get(key);
+        std::transform(value.begin(), value.end(), value.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (value == "true" || value == "yes" || value == "on" || value == "1") {
+            return true;
+        }
+        if (value == "false" || value == "no" || value == "off" || value == "0") {
+            return false;
+        }
+        return default_value;
+    }
+
     std::string get_config_source() const {
         return config_source_;
     }
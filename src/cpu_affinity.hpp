@@ -0,0 +1,118 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// CPU lists in the kernel's cpuset syntax ("0-3,6") and thread pinning.
+
+inline std::vector<int> parse_cpu_list(const std::string& spec) {
+    std::vector<int> cpus;
+    std::size_t pos = 0;
+    while (pos < spec.size()) {
+        std::size_t end = spec.find(',', pos);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        item.erase(std::remove_if(item.begin(), item.end(), [](unsigned char c) { return std::isspace(c); }),
+                   item.end());
+        if (item.empty()) {
+            continue;
+        }
+        try {
+            std::size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            if (first < 0 || last < first || last >= CPU_SETSIZE) {
+                throw std::out_of_range(item);
+            }
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception&) {
+            throw std::runtime_error("Invalid CPU list '" + spec + "'");
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+// CPUs this process may run on.
+inline std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Allowed CPUs not in `cpus`; empty when that would leave nothing.
+inline std::vector<int> complement_cpus(const std::vector<int>& cpus) {
+    std::vector<int> rest;
+    if (cpus.empty()) {
+        return rest;
+    }
+    for (int cpu : allowed_cpus()) {
+        if (!std::binary_search(cpus.begin(), cpus.end(), cpu)) {
+            rest.push_back(cpu);
+        }
+    }
+    return rest;
+}
+
+inline bool pin_current_thread(const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// Pins the calling thread for the lifetime of the guard and then restores its
+// previous mask. Used where the thread belongs to someone else (the PAM host
+// process), so the pin must not outlive the work.
+class ScopedThreadAffinity {
+public:
+    explicit ScopedThreadAffinity(const std::vector<int>& cpus) {
+        if (cpus.empty()) {
+            return;
+        }
+        CPU_ZERO(&previous_);
+        if (pthread_getaffinity_np(pthread_self(), sizeof(previous_), &previous_) == 0) {
+            active_ = pin_current_thread(cpus);
+        }
+    }
+
+    ~ScopedThreadAffinity() {
+        if (active_) {
+            pthread_setaffinity_np(pthread_self(), sizeof(previous_), &previous_);
+        }
+    }
+
+    ScopedThreadAffinity(const ScopedThreadAffinity&) = delete;
+    ScopedThreadAffinity& operator=(const ScopedThreadAffinity&) = delete;
+
+private:
+    cpu_set_t previous_;
+    bool active_ = false;
+};
@@ -0,0 +1,356 @@
+#pragma once
+
+#include "face_auth.hpp"
+#include "metrics.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+// Wire protocol between pam_lxfu and lxfud.
+//
+// Messages are blocks of "key=value" lines (the same format as lxfu.conf)
+// terminated by an empty line. Every request carries an "op" key.
+
+constexpr const char* kDefaultDaemonSocket = "/run/lxfu/lxfud.sock";
+constexpr std::size_t kMaxDaemonMessageBytes = 64 * 1024;
+
+using DaemonMessage = std::map<std::string, std::string>;
+
+inline bool write_daemon_message(int fd, const DaemonMessage& message) {
+    std::string payload;
+    for (const auto& [key, value] : message) {
+        if (key.find_first_of("=\n") != std::string::npos || value.find('\n') != std::string::npos) {
+            throw std::runtime_error("Invalid character in daemon message field '" + key + "'");
+        }
+        payload += key;
+        payload += '=';
+        payload += value;
+        payload += '\n';
+    }
+    payload += '\n';
+
+    const char* data = payload.data();
+    std::size_t remaining = payload.size();
+    while (remaining > 0) {
+        ssize_t written = ::send(fd, data, remaining, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        remaining -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+inline std::optional<DaemonMessage> read_daemon_message(int fd) {
+    std::string buffer;
+    char chunk[1024];
+    while (buffer.size() < kMaxDaemonMessageBytes) {
+        ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return std::nullopt;
+        }
+        if (received == 0) {
+            return std::nullopt;
+        }
+        buffer.append(chunk, static_cast<std::size_t>(received));
+
+        std::size_t end = (buffer.front() == '\n') ? 0 : buffer.find("\n\n");
+        if (end == std::string::npos) {
+            continue;
+        }
+
+        DaemonMessage message;
+        std::size_t pos = 0;
+        while (pos < end) {
+            std::size_t eol = buffer.find('\n', pos);
+            std::string line = buffer.substr(pos, eol - pos);
+            pos = eol + 1;
+            std::size_t eq = line.find('=');
+            if (eq == std::string::npos) {
+                return std::nullopt;
+            }
+            message[line.substr(0, eq)] = line.substr(eq + 1);
+        }
+        return message;
+    }
+    return std::nullopt;
+}
+
+inline void set_socket_timeout(int fd, double seconds) {
+    if (seconds <= 0.0) {
+        return;
+    }
+    timeval tv{};
+    tv.tv_sec = static_cast<time_t>(seconds);
+    tv.tv_usec = static_cast<suseconds_t>((seconds - static_cast<double>(tv.tv_sec)) * 1'000'000.0);
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+inline sockaddr_un make_daemon_address(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Daemon socket path too long: " + path);
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+inline AuthStatus parse_auth_status(const std::string& value) {
+    if (value == "success") return AuthStatus::Success;
+    if (value == "nomatch") return AuthStatus::NoMatch;
+    return AuthStatus::Unavailable;
+}
+
+inline DaemonMessage encode_auth_request(const AuthRequest& req) {
+    DaemonMessage message;
+    message["op"] = "auth";
+    message["username"] = req.username;
+    if (req.target_name) message["target_name"] = *req.target_name;
+    if (req.source_path) message["source"] = *req.source_path;
+    message["device"] = join_device_list(req.device_paths);
+    message["embeddings_path"] = req.embeddings_path;
+    message["threshold"] = std::to_string(req.threshold);
+    message["debug"] = req.debug ? "1" : "0";
+    message["allow_all"] = req.allow_all ? "1" : "0";
+    message["warmup_delay"] = std::to_string(req.warmup_delay_seconds);
+    message["capture_duration"] = std::to_string(req.capture_duration_seconds);
+    message["frame_interval"] = std::to_string(req.frame_interval_seconds);
+    message["detector_threads"] = std::to_string(req.detector_threads);
+    message["early_accept"] = std::to_string(req.early_exit.accept_frames);
+    message["early_reject"] = std::to_string(req.early_exit.reject_frames);
+    message["reject_margin"] = std::to_string(req.early_exit.reject_margin);
+    message["profile_means"] = req.profile_means ? "1" : "0";
+    message["ann_enabled"] = req.ann.enabled ? "1" : "0";
+    message["ann_min_profiles"] = std::to_string(req.ann.min_profiles);
+    message["ann_candidates"] = std::to_string(req.ann.candidates);
+    message["ann_ef_search"] = std::to_string(req.ann.ef_search);
+    return message;
+}
+
+inline AuthRequest decode_auth_request(const DaemonMessage& message) {
+    auto text = [&](const char* key) -> std::optional<std::string> {
+        auto it = message.find(key);
+        if (it == message.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    };
+    auto number = [&](const char* key, double fallback) {
+        auto value = text(key);
+        if (!value) {
+            return fallback;
+        }
+        try {
+            return std::stod(*value);
+        } catch (const std::exception&) {
+            throw std::runtime_error(std::string("Invalid numeric field '") + key + "'");
+        }
+    };
+
+    AuthRequest req;
+    req.username = text("username").value_or("");
+    req.target_name = text("target_name");
+    req.source_path = text("source");
+    if (auto devices = text("device")) {
+        req.device_paths = parse_device_list(*devices);
+    }
+    req.embeddings_path = text("embeddings_path").value_or("");
+    req.threshold = number("threshold", req.threshold);
+    req.debug = text("debug").value_or("0") == "1";
+    req.allow_all = text("allow_all").value_or("0") == "1";
+    req.warmup_delay_seconds = number("warmup_delay", req.warmup_delay_seconds);
+    req.capture_duration_seconds = number("capture_duration", req.capture_duration_seconds);
+    req.frame_interval_seconds = number("frame_interval", req.frame_interval_seconds);
+    req.detector_threads = static_cast<std::size_t>(
+        std::clamp(number("detector_threads", static_cast<double>(req.detector_threads)), 1.0, 8.0));
+    req.early_exit.accept_frames = static_cast<std::size_t>(
+        std::max(0.0, number("early_accept", static_cast<double>(req.early_exit.accept_frames))));
+    req.early_exit.reject_frames = static_cast<std::size_t>(
+        std::max(0.0, number("early_reject", static_cast<double>(req.early_exit.reject_frames))));
+    req.early_exit.reject_margin = std::max(0.0, number("reject_margin", req.early_exit.reject_margin));
+    req.profile_means = text("profile_means").value_or("1") == "1";
+    req.ann.enabled = text("ann_enabled").value_or("0") == "1";
+    req.ann.min_profiles = static_cast<std::size_t>(
+        std::max(0.0, number("ann_min_profiles", static_cast<double>(req.ann.min_profiles))));
+    req.ann.candidates = static_cast<std::size_t>(
+        std::clamp(number("ann_candidates", static_cast<double>(req.ann.candidates)), 1.0, 4096.0));
+    req.ann.ef_search = static_cast<std::size_t>(
+        std::clamp(number("ann_ef_search", static_cast<double>(req.ann.ef_search)), 1.0, 4096.0));
+
+    if (req.username.empty() || req.embeddings_path.empty()) {
+        throw std::runtime_error("Auth request missing username or embeddings_path");
+    }
+    return req;
+}
+
+inline DaemonMessage encode_auth_result(const AuthResult& result) {
+    DaemonMessage message;
+    message["status"] = auth_status_name(result.status);
+    message["name"] = result.matched_name;
+    message["avg"] = std::to_string(result.avg_similarity);
+    message["max"] = std::to_string(result.max_similarity);
+    message["frames"] = std::to_string(result.frames);
+    return message;
+}
+
+inline AuthResult decode_auth_result(const DaemonMessage& message) {
+    AuthResult result;
+    auto it = message.find("status");
+    result.status = (it != message.end()) ? parse_auth_status(it->second) : AuthStatus::Unavailable;
+    if ((it = message.find("name")) != message.end()) result.matched_name = it->second;
+    try {
+        if ((it = message.find("avg")) != message.end()) result.avg_similarity = std::stof(it->second);
+        if ((it = message.find("max")) != message.end()) result.max_similarity = std::stof(it->second);
+        if ((it = message.find("frames")) != message.end()) result.frames = std::stoul(it->second);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Malformed daemon response");
+    }
+    return result;
+}
+
+// One request/response exchange with lxfud. Returns nullopt when the daemon
+// cannot be reached (connection refused, socket missing, timeout) or answers
+// with an error, with the reason in `error`.
+inline std::optional<DaemonMessage> daemon_round_trip(const std::string& socket_path,
+                                                      const DaemonMessage& request,
+                                                      double timeout_seconds,
+                                                      std::string& error) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = std::string("socket: ") + std::strerror(errno);
+        return std::nullopt;
+    }
+
+    sockaddr_un addr = make_daemon_address(socket_path);
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        error = "connect " + socket_path + ": " + std::strerror(errno);
+        ::close(fd);
+        return std::nullopt;
+    }
+
+    set_socket_timeout(fd, timeout_seconds);
+
+    if (!write_daemon_message(fd, request)) {
+        error = std::string("send: ") + std::strerror(errno);
+        ::close(fd);
+        return std::nullopt;
+    }
+
+    auto response = read_daemon_message(fd);
+    ::close(fd);
+    if (!response) {
+        error = "no response from daemon";
+        return std::nullopt;
+    }
+
+    auto err = response->find("error");
+    if (err != response->end()) {
+        error = "daemon error: " + err->second;
+        return std::nullopt;
+    }
+    return response;
+}
+
+// Send an auth request to lxfud. Returns nullopt when the daemon cannot be
+// reached, with the reason in `error`, so the caller can fall back to
+// in-process authentication.
+inline std::optional<AuthResult> request_daemon_auth(const std::string& socket_path,
+                                                     const AuthRequest& req,
+                                                     double timeout_seconds,
+                                                     std::string& error) {
+    auto response = daemon_round_trip(socket_path, encode_auth_request(req), timeout_seconds, error);
+    if (!response) {
+        return std::nullopt;
+    }
+    return decode_auth_result(*response);
+}
+
+// op=stats: "auths", "outcome.<name>" and "<stage>.samples|p50|p90|p99|max|sum_ms|count"
+// (milliseconds) for each stage that has run.
+inline DaemonMessage encode_metrics_snapshot(const MetricsSnapshot& snapshot) {
+    DaemonMessage message;
+    message["auths"] = std::to_string(snapshot.authentications);
+    for (const auto& [outcome, count] : snapshot.outcomes) {
+        message["outcome." + outcome] = std::to_string(count);
+    }
+    for (const auto& stage : snapshot.stages) {
+        const std::string prefix = std::string(stage_name(stage.stage)) + ".";
+        message[prefix + "samples"] = std::to_string(stage.samples);
+        message[prefix + "p50"] = std::to_string(stage.p50);
+        message[prefix + "p90"] = std::to_string(stage.p90);
+        message[prefix + "p99"] = std::to_string(stage.p99);
+        message[prefix + "max"] = std::to_string(stage.max);
+        message[prefix + "sum_ms"] = std::to_string(stage.sum_ms);
+        message[prefix + "count"] = std::to_string(stage.count);
+    }
+    return message;
+}
+
+inline MetricsSnapshot decode_metrics_snapshot(const DaemonMessage& message) {
+    MetricsSnapshot snapshot;
+    auto field = [&](const std::string& key) -> std::optional<double> {
+        auto it = message.find(key);
+        if (it == message.end()) {
+            return std::nullopt;
+        }
+        try {
+            return std::stod(it->second);
+        } catch (const std::exception&) {
+            throw std::runtime_error("Malformed stats field '" + key + "'");
+        }
+    };
+    snapshot.authentications = static_cast<std::uint64_t>(field("auths").value_or(0.0));
+    for (const auto& [key, value] : message) {
+        if (key.rfind("outcome.", 0) == 0) {
+            snapshot.outcomes[key.substr(8)] = static_cast<std::uint64_t>(field(key).value_or(0.0));
+        }
+    }
+    for (std::size_t i = 0; i < kStageCount; ++i) {
+        const Stage stage = static_cast<Stage>(i);
+        const std::string prefix = std::string(stage_name(stage)) + ".";
+        auto count = field(prefix + "count");
+        if (!count) {
+            continue;
+        }
+        StageSummary summary;
+        summary.stage = stage;
+        summary.count = static_cast<std::uint64_t>(*count);
+        summary.samples = static_cast<std::size_t>(field(prefix + "samples").value_or(0.0));
+        summary.p50 = field(prefix + "p50").value_or(0.0);
+        summary.p90 = field(prefix + "p90").value_or(0.0);
+        summary.p99 = field(prefix + "p99").value_or(0.0);
+        summary.max = field(prefix + "max").value_or(0.0);
+        summary.sum_ms = field(prefix + "sum_ms").value_or(0.0);
+        snapshot.stages.push_back(summary);
+    }
+    return snapshot;
+}
+
+inline std::optional<MetricsSnapshot> request_daemon_stats(const std::string& socket_path,
+                                                           double timeout_seconds,
+                                                           std::string& error) {
+    auto response = daemon_round_trip(socket_path, {{"op", "stats"}}, timeout_seconds, error);
+    if (!response) {
+        return std::nullopt;
+    }
+    return decode_metrics_snapshot(*response);
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "lmdb_store.hpp"
+#include "similarity.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Similarity scoring over the enrolled samples. There is no separate packed
+// copy of them: every LMDB value already holds one run of a profile's samples
+// as a contiguous row-major block, and a snapshot maps those blocks in place.
+// The sorted keys act as the profile -> rows table, and the scorers below
+// stream the mapped rows tile by tile through QueryBlock::accumulate. A
+// profile whose dimension differs from the queries is skipped on its own and
+// never affects how the others are scored.
+
+// Allocator handing out cache-line aligned blocks so packed rows can be streamed with aligned loads.
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() noexcept = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+using AlignedFloatVector = std::vector<float, AlignedAllocator<float>>;
+
+// Running similarity over query x sample pairs. Cosine scores are mapped from
+// [-1, 1] to [0, 1]; avg is the mean over every pair seen.
+struct SimilarityAccumulator {
+    double sum = 0.0;
+    float max = -1.0f;
+    std::size_t pairs = 0;
+    std::size_t samples = 0;
+
+    float avg() const { return pairs == 0 ? -1.0f : static_cast<float>(sum / static_cast<double>(pairs)); }
+};
+
+// Query embeddings packed into padded, aligned rows so one block can be
+// tile-scored against any run of stored samples.
+class QueryBlock {
+public:
+    explicit QueryBlock(const std::vector<std::vector<float>>& queries) {
+        if (queries.empty() || queries.front().empty()) {
+            return;
+        }
+        dim_ = queries.front().size();
+        for (const auto& q : queries) {
+            if (q.size() != dim_) {
+                throw std::runtime_error("Inconsistent query embedding dimension");
+            }
+        }
+        count_ = queries.size();
+        stride_ = (dim_ + kAlignmentFloats - 1) / kAlignmentFloats * kAlignmentFloats;
+        data_.assign(count_ * stride_, 0.0f);
+        for (std::size_t q = 0; q < count_; ++q) {
+            std::copy(queries[q].begin(), queries[q].end(),
+                      data_.begin() + static_cast<std::ptrdiff_t>(q * stride_));
+        }
+    }
+
+    bool empty() const { return count_ == 0; }
+    std::size_t dim() const { return dim_; }
+    std::size_t count() const { return count_; }
+
+    // Mean of the queries (not renormalised), for scoring against profile means.
+    std::vector<float> mean() const {
+        std::vector<float> result(dim_, 0.0f);
+        for (std::size_t q = 0; q < count_; ++q) {
+            const float* row = data_.data() + q * stride_;
+            for (std::size_t d = 0; d < dim_; ++d) {
+                result[d] += row[d];
+            }
+        }
+        for (float& v : result) {
+            v /= static_cast<float>(count_);
+        }
+        return result;
+    }
+
+    // Fold `row_count` samples (each `dim()` floats, `row_stride` apart) into `acc`.
+    void accumulate(const float* rows, std::size_t row_count, std::size_t row_stride,
+                    SimilarityAccumulator& acc) const {
+        for (std::size_t start = 0; start < row_count; start += kTileRows) {
+            const std::size_t tile_rows = std::min(kTileRows, row_count - start);
+            sims_.resize(count_ * tile_rows);
+            similarity::dot_tile(data_.data(), count_, stride_,
+                                 rows + start * row_stride, tile_rows, row_stride,
+                                 dim_, sims_.data(), tile_rows);
+            for (float s : sims_) {
+                float sim = (s + 1.0f) * 0.5f;
+                acc.sum += static_cast<double>(sim);
+                acc.max = std::max(acc.max, sim);
+            }
+        }
+        acc.pairs += count_ * row_count;
+        acc.samples += row_count;
+    }
+
+    // Fold a stored block of samples; fp16/int8 rows are scored in place.
+    void accumulate(const LMDBStore::EmbeddingView& view, SimilarityAccumulator& acc) const {
+        if (view.encoding == SampleEncoding::F32) {
+            accumulate(view.data, view.count, view.dim, acc);
+            return;
+        }
+        for (std::size_t r = 0; r < view.count; ++r) {
+            for (std::size_t q = 0; q < count_; ++q) {
+                float sim = (view.dot_row(data_.data() + q * stride_, r) + 1.0f) * 0.5f;
+                acc.sum += static_cast<double>(sim);
+                acc.max = std::max(acc.max, sim);
+            }
+        }
+        acc.pairs += count_ * view.count;
+        acc.samples += view.count;
+    }
+
+private:
+    static constexpr std::size_t kAlignmentFloats = 16;
+    // Rows scored per dot_tile call; keeps the similarity scratch buffer small.
+    static constexpr std::size_t kTileRows = 256;
+
+    std::size_t dim_ = 0;
+    std::size_t count_ = 0;
+    std::size_t stride_ = 0;
+    AlignedFloatVector data_;
+    mutable std::vector<float> sims_;
+};
+
+struct ProfileMatch {
+    std::string name;
+    float avg_similarity = -1.0f;
+    float max_similarity = -1.0f;
+    std::size_t samples = 0;
+};
+
+// Exact scores for just the `candidates` profiles (e.g. proposed by the ANN
+// index), in candidate order. Unknown names are skipped.
+inline std::vector<ProfileMatch> score_profiles(const LMDBStore::Snapshot& snapshot,
+                                                const QueryBlock& queries,
+                                                const std::vector<std::string>& candidates) {
+    std::vector<ProfileMatch> matches;
+    if (queries.empty()) {
+        return matches;
+    }
+    for (const auto& name : candidates) {
+        SimilarityAccumulator acc;
+        snapshot.for_each(name, [&](const LMDBStore::EmbeddingView& view) {
+            if (view.dim == queries.dim()) {
+                queries.accumulate(view, acc);
+            }
+        });
+        if (acc.pairs > 0) {
+            matches.push_back({name, acc.avg(), acc.max, acc.samples});
+        }
+    }
+    return matches;
+}
+
+// Score queries straight against the mapped LMDB pages, without building an
+// index. Profiles whose dimension differs from the queries are skipped. With
+// a target only that profile's keys are visited (a keyed range lookup), so
+// verifying one user costs the same regardless of headcount.
+inline std::vector<ProfileMatch> score_profiles(const LMDBStore::Snapshot& snapshot,
+                                                const QueryBlock& queries,
+                                                const std::optional<std::string>& target = std::nullopt) {
+    if (target) {
+        return score_profiles(snapshot, queries, std::vector<std::string>{*target});
+    }
+    std::vector<ProfileMatch> matches;
+    if (queries.empty()) {
+        return matches;
+    }
+
+    // A profile may arrive as several consecutive values; accumulate by name.
+    std::string current;
+    SimilarityAccumulator acc;
+    auto flush = [&]() {
+        if (acc.pairs > 0) {
+            matches.push_back({current, acc.avg(), acc.max, acc.samples});
+        }
+        acc = SimilarityAccumulator{};
+    };
+
+    snapshot.for_each([&](std::string_view name, const LMDBStore::EmbeddingView& view) {
+        if (name != current) {
+            flush();
+            current.assign(name.data(), name.size());
+        }
+        if (view.dim == queries.dim()) {
+            queries.accumulate(view, acc);
+        }
+    });
+    flush();
+    return matches;
+}
+
+// Average-only scoring from the cached per-profile means: the average over
+// every query x sample pair equals mean(queries) . mean(samples), so
+// avg_similarity matches score_profiles() at one dot product per profile.
+// max_similarity needs the samples and is left at -1. Profiles without a
+// cached mean are scored exactly.
+inline std::vector<ProfileMatch> score_profile_means(const LMDBStore::Snapshot& snapshot,
+                                                     const QueryBlock& queries,
+                                                     const std::optional<std::string>& target = std::nullopt) {
+    std::vector<ProfileMatch> matches;
+    if (queries.empty()) {
+        return matches;
+    }
+    const std::vector<float> query = queries.mean();
+    auto mean_match = [&](std::string_view name, const LMDBStore::EmbeddingView& mean) {
+        float sim = similarity::dot(query.data(), mean.data, mean.dim);
+        return ProfileMatch{std::string(name), (sim + 1.0f) * 0.5f, -1.0f, mean.count};
+    };
+
+    if (target) {
+        auto mean = snapshot.mean(*target);
+        if (!mean) {
+            return score_profiles(snapshot, queries, target);
+        }
+        if (mean->dim == queries.dim()) {
+            matches.push_back(mean_match(*target, *mean));
+        }
+        return matches;
+    }
+
+    std::vector<std::string> uncached;
+    snapshot.for_each_mean([&](std::string_view name, const LMDBStore::EmbeddingView* mean) {
+        if (!mean) {
+            uncached.emplace_back(name);
+        } else if (mean->dim == queries.dim()) {
+            matches.push_back(mean_match(name, *mean));
+        }
+    });
+    for (auto& match : score_profiles(snapshot, queries, uncached)) {
+        matches.push_back(std::move(match));
+    }
+    return matches;
+}
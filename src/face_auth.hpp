@@ -0,0 +1,665 @@
+#pragma once
+
+#include "face_engine.hpp"
+#include "face_detector.hpp"
+#include "lmdb_store.hpp"
+#include "embedding_index.hpp"
+#include "capture_pipeline.hpp"
+#include "streaming_match.hpp"
+#include "metrics.hpp"
+#include "camera.hpp"
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <syslog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Face authentication shared by the PAM module (in-process fallback) and lxfud.
+
+struct AuthRequest {
+    std::string username;
+    std::optional<std::string> target_name;
+    std::optional<std::string> source_path;
+    // Cameras captured in parallel (e.g. RGB and IR); see parse_device_list.
+    std::vector<std::string> device_paths{"/dev/video0"};
+    std::string embeddings_path;
+    double threshold = 0.75;
+    bool debug = false;
+    bool allow_all = false;
+    double warmup_delay_seconds = 0.0;
+    double capture_duration_seconds = 2.0;
+    double frame_interval_seconds = 0.1;
+    std::size_t detector_threads = 1;
+    EarlyExitPolicy early_exit;
+    // Score against cached per-profile means (no max similarity).
+    bool profile_means = true;
+    // Identify mode (allow_all) over large databases.
+    AnnSettings ann;
+};
+
+enum class AuthStatus { Success, NoMatch, Unavailable };
+
+struct AuthResult {
+    AuthStatus status = AuthStatus::Unavailable;
+    std::string matched_name;
+    float avg_similarity = -1.0f;
+    float max_similarity = -1.0f;
+    std::size_t frames = 0;
+    StageTimings timings;
+    // Abandoned through AuthOptions::cancelled; status is Unavailable.
+    bool cancelled = false;
+};
+
+inline const char* auth_status_name(AuthStatus status) {
+    switch (status) {
+        case AuthStatus::Success: return "success";
+        case AuthStatus::NoMatch: return "nomatch";
+        case AuthStatus::Unavailable: return "unavailable";
+    }
+    return "unavailable";
+}
+
+// printf-style logger; the sink decides where messages go (pam_syslog, syslog, ...).
+class AuthLogger {
+public:
+    using Sink = std::function<void(int priority, const char* message)>;
+
+    explicit AuthLogger(Sink sink) : sink_(std::move(sink)) {}
+
+    void log(int priority, const char* fmt, ...) const __attribute__((format(printf, 3, 4))) {
+        char buffer[1024];
+        va_list args;
+        va_start(args, fmt);
+        std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+        if (sink_) {
+            sink_(priority, buffer);
+        }
+    }
+
+private:
+    Sink sink_;
+};
+
+// Warm-up for the request: a fixed warmup_delay when configured, otherwise
+// until the camera's auto-exposure has settled.
+inline CameraWarmup auth_camera_warmup(const AuthRequest& req) {
+    CameraWarmup warmup;
+    warmup.fixed_seconds = std::max(0.0, req.warmup_delay_seconds);
+    return warmup;
+}
+
+// The request's cameras, one per device, all opening in the background.
+using PendingCameras = std::vector<std::unique_ptr<PendingCamera>>;
+
+inline PendingCameras start_auth_cameras(const AuthRequest& req, const CameraSettings& settings) {
+    PendingCameras cameras;
+    for (const auto& device : req.device_paths) {
+        cameras.push_back(std::make_unique<PendingCamera>(device, settings, auth_camera_warmup(req)));
+    }
+    return cameras;
+}
+
+// FaceDetectors kept per camera, so face tracking never mixes frames of
+// different sensors. A lease hands one out for exclusive use and returns it on
+// destruction; concurrent requests (lxfud) for the same device get separate
+// detectors, created on first use and then kept.
+class DeviceDetectors {
+public:
+    class Lease {
+    public:
+        Lease(DeviceDetectors& owner, std::string device, std::unique_ptr<FaceDetector> detector)
+            : owner_(&owner), device_(std::move(device)), detector_(std::move(detector)) {}
+
+        Lease(Lease&&) = default;
+        Lease& operator=(Lease&&) = delete;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease() {
+            if (detector_) {
+                owner_->give_back(device_, std::move(detector_));
+            }
+        }
+
+        FaceDetector& operator*() const { return *detector_; }
+        FaceDetector* operator->() const { return detector_.get(); }
+        FaceDetector* get() const { return detector_.get(); }
+
+    private:
+        DeviceDetectors* owner_;
+        std::string device_;
+        std::unique_ptr<FaceDetector> detector_;
+    };
+
+    explicit DeviceDetectors(FaceDetectorSettings settings) : settings_(std::move(settings)) {}
+
+    const FaceDetectorSettings& settings() const { return settings_; }
+
+    Lease for_device(const std::string& device) {
+        std::unique_ptr<FaceDetector> detector;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& idle = idle_[device];
+            if (!idle.empty()) {
+                detector = std::move(idle.back());
+                idle.pop_back();
+            }
+        }
+        if (!detector) {
+            // Loading the cascade takes a while; not under the lock.
+            detector = std::make_unique<FaceDetector>(settings_, /*verbose=*/false);
+        }
+        return Lease(*this, device, std::move(detector));
+    }
+
+    // Detector for source images.
+    Lease for_images() { return for_device(std::string()); }
+
+private:
+    void give_back(const std::string& device, std::unique_ptr<FaceDetector> detector) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_[device].push_back(std::move(detector));
+    }
+
+    FaceDetectorSettings settings_;
+    std::mutex mutex_;
+    std::map<std::string, std::vector<std::unique_ptr<FaceDetector>>> idle_;
+};
+
+// Turns face crops into embeddings, aligned with the images (empty where one
+// failed): FaceEngine on the calling thread, or lxfud's InferenceScheduler,
+// which batches the crops of concurrent requests together.
+class Embedder {
+public:
+    virtual ~Embedder() = default;
+
+    virtual std::vector<std::vector<float>> embed(const std::vector<cv::Mat>& images, StageClock* clock) = 0;
+
+    // CPUs reserved for inference; capture and detection stay off them.
+    virtual const std::vector<int>& inference_cpus() const = 0;
+};
+
+class EngineEmbedder : public Embedder {
+public:
+    explicit EngineEmbedder(FaceEngine& engine) : engine_(engine) {}
+
+    std::vector<std::vector<float>> embed(const std::vector<cv::Mat>& images, StageClock* clock) override {
+        return engine_.extract_embeddings(images, FaceEngine::kDefaultBatchSize, clock);
+    }
+
+    const std::vector<int>& inference_cpus() const override { return engine_.inference_cpus(); }
+
+private:
+    FaceEngine& engine_;
+};
+
+// Per-call context for authenticate_face beyond the request itself.
+struct AuthOptions {
+    // Cameras already opening req.device_paths; started by match_face if null.
+    PendingCameras* cameras = nullptr;
+    // How match_face opens the cameras when `cameras` is null (the caller's
+    // CameraSettings::from_config, so capture_backend is honoured).
+    CameraSettings camera;
+    // Shared detection workers (lxfud); null = each pipeline starts its own
+    // req.detector_threads.
+    WorkStealingPool* detection_pool = nullptr;
+    // Polled between micro-batches; returning true abandons the attempt
+    // (lxfud: the PAM conversation was aborted and the client hung up).
+    std::function<bool()> cancelled;
+};
+
+// Receives the embeddings one camera contributed to a forward pass. `source`
+// is the camera's index in req.device_paths (0 for a source image). Return
+// false to stop capturing.
+using EmbeddingBatchHandler = std::function<bool(std::vector<std::vector<float>>& batch, std::size_t source)>;
+
+constexpr std::size_t kMaxAuthFaces = 60;
+
+inline void embed_auth_batch(Embedder& embedder, const std::vector<cv::Mat>& images,
+                             std::vector<std::vector<float>>& out, StageClock* clock) {
+    out.clear();
+    for (auto& embedding : embedder.embed(images, clock)) {
+        if (!embedding.empty()) {
+            out.push_back(std::move(embedding));
+        }
+    }
+}
+
+// Camera capture runs as one pipeline per camera: each producer thread reads
+// frames and its detector workers crop faces into a queue shared by all
+// cameras, and this thread embeds the crops of every camera together in
+// micro-batches as they arrive, so the capture can end as soon as the handler
+// is satisfied (or the request is cancelled). Cameras that fail to open are
+// skipped.
+inline void stream_camera_embeddings(const AuthRequest& req, const AuthLogger& log,
+                                     DeviceDetectors& detectors, Embedder& embedder,
+                                     PendingCameras& cameras, const AuthOptions& auth,
+                                     const EmbeddingBatchHandler& on_batch, StageClock* clock) {
+    std::vector<OpenedCamera> opened;
+    std::vector<std::size_t> sources;
+    opened.reserve(cameras.size());
+    for (std::size_t i = 0; i < cameras.size(); ++i) {
+        PendingCamera& camera = *cameras[i];
+        try {
+            opened.push_back(camera.get());
+        } catch (const std::exception& ex) {
+            log.log(LOG_ERR, "%s", ex.what());
+            continue;
+        }
+        sources.push_back(i);
+        const OpenedCamera& cam = opened.back();
+        if (clock) {
+            clock->add(Stage::CameraOpen, cam.open_time);
+            clock->add(Stage::CameraWarmup, cam.warmup_time);
+        }
+        if (!cam.native_error.empty()) {
+            log.log(LOG_WARNING, "capture_backend=v4l2 unavailable (%s); using OpenCV", cam.native_error.c_str());
+        }
+        if (req.debug) {
+            log.log(LOG_DEBUG, "opened device '%s' via %s%s%s", camera.source().c_str(),
+                    camera_backend_name(cam.backend), cam.native ? " " : "",
+                    cam.native ? cam.native->format_name() : "");
+            log.log(LOG_DEBUG, "warmup read %d frames over %.2fs (%s, brightness %.1f)", cam.warmup.frames,
+                    std::chrono::duration<double>(cam.warmup_time).count(),
+                    req.warmup_delay_seconds > 0.0 ? "fixed" : cam.warmup.settled ? "settled" : "timed out",
+                    cam.warmup.brightness);
+        }
+    }
+    if (opened.empty()) {
+        throw std::runtime_error("capture device open failure");
+    }
+
+    CapturePipelineOptions options;
+    options.detector_threads = std::max<std::size_t>(1, req.detector_threads);
+    options.duration_seconds = std::max(0.0, req.capture_duration_seconds);
+    options.frame_interval_seconds = std::max(0.0, req.frame_interval_seconds);
+    options.max_consecutive_failures = 20;
+    options.cpu_affinity = complement_cpus(embedder.inference_cpus());
+    options.clock = clock;
+    options.faces = std::make_shared<CaptureFaceQueue>(options.face_queue_capacity * opened.size());
+    options.detection_pool = auth.detection_pool;
+
+    // Declared before the pipelines, which use them until they are destroyed.
+    std::vector<DeviceDetectors::Lease> leases;
+    leases.reserve(opened.size());
+    std::vector<std::unique_ptr<CapturePipeline>> pipelines;
+    for (std::size_t k = 0; k < opened.size(); ++k) {
+        const std::string& device = cameras[sources[k]]->source();
+        auto on_failure = [&req, &log, &device](int failures) {
+            if (req.debug && (failures == 1 || failures % 5 == 0)) {
+                log.log(LOG_DEBUG, "failed to capture frame from '%s' (%d)", device.c_str(), failures);
+            }
+        };
+        options.source = sources[k];
+        OpenedCamera& cam = opened[k];
+        leases.push_back(detectors.for_device(device));
+        pipelines.push_back(std::make_unique<CapturePipeline>(
+            [&cam](CameraFrame& frame) { return cam.read(frame); },
+            options, leases.back().get(), on_failure));
+    }
+    options.faces->release();
+
+    std::vector<CapturedFace> crops;
+    std::vector<cv::Mat> images;
+    std::vector<std::size_t> crop_sources;
+    std::vector<std::vector<float>> share;
+    std::size_t embedded = 0;
+    bool wanted_more = true;
+    const std::size_t batch_size = FaceEngine::kDefaultBatchSize;
+    auto cancelled = [&auth] { return auth.cancelled && auth.cancelled(); };
+    while (wanted_more && pipelines.front()->next_batch(crops, batch_size, std::chrono::milliseconds(100))) {
+        if (cancelled()) {
+            wanted_more = false;
+            break;
+        }
+        if (crops.empty()) {
+            continue;
+        }
+        images.clear();
+        crop_sources.clear();
+        for (auto& crop : crops) {
+            images.push_back(std::move(crop.image));
+            crop_sources.push_back(crop.source);
+        }
+        auto embeddings = embedder.embed(images, clock);
+        // Hand each camera its share of the forward pass.
+        bool delivered = false;
+        for (std::size_t source : sources) {
+            share.clear();
+            for (std::size_t j = 0; j < embeddings.size(); ++j) {
+                if (crop_sources[j] == source && !embeddings[j].empty()) {
+                    share.push_back(std::move(embeddings[j]));
+                }
+            }
+            if (share.empty()) {
+                continue;
+            }
+            embedded += share.size();
+            delivered = true;
+            if (!on_batch(share, source)) {
+                wanted_more = false;
+                break;
+            }
+        }
+        if (!delivered) {
+            // Every embedding in the pass failed; report it as a (empty) batch.
+            share.clear();
+            wanted_more = on_batch(share, crop_sources.front());
+        }
+    }
+    for (auto& pipeline : pipelines) {
+        pipeline->stop();
+    }
+    for (auto& pipeline : pipelines) {
+        pipeline->join();
+    }
+    for (auto& cam : opened) {
+        cam.release();
+    }
+
+    for (std::size_t k = 0; k < pipelines.size() && wanted_more && embedded == 0 && !cancelled(); ++k) {
+        // Last chance on the most recent frame, as the serial loop used to do.
+        cv::Mat last = pipelines[k]->latest_frame().bgr();
+        if (last.empty()) {
+            continue;
+        }
+        std::optional<cv::Mat> face;
+        {
+            StageTimer timer(clock, Stage::Detect);
+            face = leases[k]->face_region(last);
+        }
+        if (face) {
+            embed_auth_batch(embedder, {*face}, share, clock);
+            embedded += share.size();
+            wanted_more = on_batch(share, sources[k]);
+        }
+    }
+
+    if (req.debug) {
+        for (std::size_t k = 0; k < pipelines.size(); ++k) {
+            CaptureStats stats = pipelines[k]->stats();
+            const std::string& device = cameras[sources[k]]->source();
+            log.log(LOG_DEBUG, "'%s': captured %zu frames (%zu dropped), %zu with usable faces, %zu below quality bar",
+                    device.c_str(), stats.frames, stats.dropped_frames, stats.frames_with_faces,
+                    stats.low_quality_faces);
+            if (!pipelines[k]->error().empty()) {
+                log.log(LOG_DEBUG, "'%s': capture ended early: %s", device.c_str(), pipelines[k]->error().c_str());
+            }
+        }
+    }
+}
+
+// Produce query embeddings for the request, from the source image or the
+// cameras (already opening in the background; required unless source_path).
+inline void stream_auth_embeddings(const AuthRequest& req, const AuthLogger& log,
+                                   DeviceDetectors& detectors, Embedder& embedder, const AuthOptions& auth,
+                                   const EmbeddingBatchHandler& on_batch, StageClock* clock) {
+    if (req.source_path) {
+        cv::Mat image;
+        {
+            StageTimer timer(clock, Stage::FrameRead);
+            image = cv::imread(*req.source_path);
+        }
+        if (image.empty()) {
+            log.log(LOG_ERR, "failed to load image '%s'", req.source_path->c_str());
+            throw std::runtime_error("image load failure");
+        }
+        std::optional<cv::Mat> face;
+        {
+            StageTimer timer(clock, Stage::Detect);
+            face = detectors.for_images()->face_region(image);
+        }
+        if (!face) {
+            log.log(LOG_WARNING, "no face detected in source image '%s'", req.source_path->c_str());
+            return;
+        }
+        std::vector<std::vector<float>> embeddings;
+        embed_auth_batch(embedder, {*face}, embeddings, clock);
+        on_batch(embeddings, 0);
+        return;
+    }
+
+    PendingCameras* cameras = auth.cameras;
+    if (!cameras || cameras->empty()) {
+        throw std::runtime_error("no capture device for request");
+    }
+    if (req.debug) {
+        std::string devices;
+        for (const auto& camera : *cameras) {
+            devices += (devices.empty() ? "" : ",") + camera->source();
+        }
+        log.log(LOG_DEBUG,
+                "capturing from device '%s' (duration %.2fs, frame_interval %.2fs, warmup %.2fs)",
+                devices.c_str(),
+                std::max(0.0, req.capture_duration_seconds),
+                std::max(0.0, req.frame_interval_seconds),
+                std::max(0.0, req.warmup_delay_seconds));
+    }
+    stream_camera_embeddings(req, log, detectors, embedder, *cameras, auth, on_batch, clock);
+}
+
+// Capture faces for the request, embed them and score against the enrolled
+// profiles as they arrive, stopping early once the outcome is clear. Each
+// camera is scored on its own and the first one to accept ends the attempt;
+// otherwise the camera with the best average decides. `options.cameras` may
+// already be opening req.device_paths; if not, they are started here so the
+// open and warm-up overlap with the snapshot.
+inline AuthResult match_face(const AuthRequest& req,
+                             DeviceDetectors& detectors,
+                             Embedder& embedder,
+                             const LMDBStore& store,
+                             const AuthLogger& log,
+                             StageClock& clock,
+                             const AuthOptions& options) {
+    AuthResult result;
+    AuthOptions auth = options;
+
+    if (!req.source_path && req.device_paths.empty()) {
+        log.log(LOG_ERR, "no capture device configured");
+        result.status = AuthStatus::Unavailable;
+        return result;
+    }
+    PendingCameras own_cameras;
+    if (!req.source_path && !auth.cameras) {
+        own_cameras = start_auth_cameras(req, auth.camera);
+        auth.cameras = &own_cameras;
+    }
+
+    if (!detectors.settings().enabled) {
+        log.log(LOG_INFO, "face detection disabled; using full frame");
+    } else if (!(req.source_path ? detectors.for_images() : detectors.for_device(req.device_paths.front()))
+                    ->is_initialized()) {
+        log.log(LOG_WARNING, "face detector not available; using full frame");
+    }
+
+    LMDBStore::Snapshot snapshot = [&] {
+        StageTimer timer(&clock, Stage::Snapshot);
+        return store.snapshot();
+    }();
+    if (snapshot.empty()) {
+        log.log(LOG_WARNING, "no enrolled profiles available");
+        result.status = AuthStatus::Unavailable;
+        return result;
+    }
+
+    std::optional<std::string> target;
+    if (!req.allow_all) {
+        target = req.target_name.value_or(req.username);
+    }
+    const std::size_t source_count = req.source_path ? 1 : req.device_paths.size();
+    std::vector<StreamingMatcher> matchers;
+    matchers.reserve(source_count);
+    for (std::size_t i = 0; i < source_count; ++i) {
+        matchers.emplace_back(snapshot, target, req.threshold, req.early_exit);
+        matchers.back().use_profile_means(req.profile_means);
+    }
+    std::shared_ptr<const ProfileAnnIndex> ann_index;
+    if (!target && req.ann.enabled) {
+        ann_index = store.load_ann_index(snapshot);
+        if (ann_index && ann_index->profile_count() >= req.ann.min_profiles) {
+            for (auto& matcher : matchers) {
+                matcher.use_ann_index(*ann_index, req.ann);
+            }
+            if (req.debug) {
+                log.log(LOG_DEBUG, "identify mode via ANN index (%zu profiles)", ann_index->profile_count());
+            }
+        } else if (req.debug) {
+            log.log(LOG_DEBUG, ann_index ? "ANN index below ann_min_profiles; exact scan"
+                                         : "ANN index missing or stale; exact scan");
+        }
+    }
+    using Decision = StreamingMatcher::Decision;
+    std::vector<Decision> decisions(source_count, Decision::Continue);
+    auto total_frames = [&] {
+        std::size_t frames = 0;
+        for (const auto& matcher : matchers) {
+            frames += matcher.frames();
+        }
+        return frames;
+    };
+
+    bool any_face = false;
+    try {
+        stream_auth_embeddings(req, log, detectors, embedder, auth,
+                               [&](std::vector<std::vector<float>>& batch, std::size_t source) {
+            any_face = true;
+            if (decisions[source] == Decision::Continue) {
+                StageTimer timer(&clock, Stage::Score);
+                decisions[source] = matchers[source].add(batch);
+            }
+            if (decisions[source] == Decision::Accept) {
+                return false;
+            }
+            bool all_rejected = std::all_of(decisions.begin(), decisions.end(),
+                                            [](Decision d) { return d == Decision::Reject; });
+            return !all_rejected && total_frames() < kMaxAuthFaces;
+        }, &clock);
+    } catch (const std::exception& ex) {
+        log.log(LOG_ERR, "capture error: %s", ex.what());
+        result.status = AuthStatus::Unavailable;
+        return result;
+    }
+    if (auth.cancelled && auth.cancelled()) {
+        log.log(LOG_INFO, "request cancelled by the client");
+        result.status = AuthStatus::Unavailable;
+        result.cancelled = true;
+        return result;
+    }
+
+    if (!any_face) {
+        log.log(LOG_INFO, "no valid face frames captured");
+        result.status = AuthStatus::NoMatch;
+        return result;
+    }
+
+    result.frames = total_frames();
+    if (result.frames == 0) {
+        log.log(LOG_ERR, "embedding extraction failed for captured frames");
+        result.status = AuthStatus::Unavailable;
+        return result;
+    }
+
+    // An accepting camera wins; otherwise the one with the best average.
+    std::size_t winner = 0;
+    for (std::size_t i = 0; i < source_count; ++i) {
+        if (decisions[i] == Decision::Accept) {
+            winner = i;
+            break;
+        }
+        if (matchers[i].frames() > 0 &&
+            (matchers[winner].frames() == 0 ||
+             matchers[i].best().avg_similarity > matchers[winner].best().avg_similarity)) {
+            winner = i;
+        }
+    }
+    const Decision decision = decisions[winner];
+    if (req.debug && source_count > 1) {
+        for (std::size_t i = 0; i < source_count; ++i) {
+            log.log(LOG_DEBUG, "camera '%s': %zu frame(s), best avg %.2f%s", req.device_paths[i].c_str(),
+                    matchers[i].frames(), matchers[i].best().avg_similarity, i == winner ? " (decides)" : "");
+        }
+    }
+
+    StreamingMatcher::Best best = matchers[winner].best();
+    result.matched_name = best.name;
+    result.avg_similarity = best.avg_similarity;
+    result.max_similarity = best.max_similarity;
+
+    const char* how = decision == StreamingMatcher::Decision::Accept ? "early accept"
+                    : decision == StreamingMatcher::Decision::Reject ? "early reject"
+                    : "full capture";
+
+    if (target) {
+        if (best.avg_similarity < 0.0f) {
+            log.log(LOG_INFO, "no match for requested name '%s'", target->c_str());
+            result.status = AuthStatus::NoMatch;
+            return result;
+        }
+        if (decision == StreamingMatcher::Decision::Reject ||
+            best.avg_similarity < static_cast<float>(req.threshold)) {
+            log.log(LOG_INFO, "similarity %.2f below threshold %.2f for '%s' (%s after %zu frame(s))",
+                    best.avg_similarity, req.threshold, target->c_str(), how, result.frames);
+            result.status = AuthStatus::NoMatch;
+            return result;
+        }
+        if (req.debug) {
+            log.log(LOG_DEBUG, "user '%s' matched avg %.2f (max %.2f) using %zu frame(s), %s",
+                    target->c_str(), best.avg_similarity, best.max_similarity, result.frames, how);
+        }
+        result.status = AuthStatus::Success;
+        return result;
+    }
+
+    if (best.name.empty() || decision == StreamingMatcher::Decision::Reject ||
+        best.avg_similarity < static_cast<float>(req.threshold)) {
+        log.log(LOG_INFO, "no profile exceeded threshold %.2f (%s after %zu frame(s))",
+                req.threshold, how, result.frames);
+        result.status = AuthStatus::NoMatch;
+        return result;
+    }
+
+    if (req.debug) {
+        log.log(LOG_DEBUG, "matched profile '%s' avg %.2f (max %.2f) using %zu frame(s), %s",
+                best.name.c_str(), best.avg_similarity, best.max_similarity, result.frames, how);
+    }
+
+    result.status = AuthStatus::Success;
+    return result;
+}
+
+// match_face() plus per-stage timings: the result carries them and a one-line
+// "timing" summary is logged for every request.
+inline AuthResult authenticate_face(const AuthRequest& req,
+                                    DeviceDetectors& detectors,
+                                    Embedder& embedder,
+                                    const LMDBStore& store,
+                                    const AuthLogger& log,
+                                    const AuthOptions& options = {}) {
+    StageClock clock;
+    AuthResult result;
+    {
+        StageTimer timer(&clock, Stage::Total);
+        result = match_face(req, detectors, embedder, store, log, clock, options);
+    }
+    result.timings = clock.timings();
+    log.log(LOG_INFO, "timing user=%s outcome=%s frames=%zu %s", req.username.c_str(),
+            result.cancelled ? "cancelled" : auth_status_name(result.status), result.frames,
+            result.timings.summary().c_str());
+    return result;
+}
@@ -1,19 +1,196 @@
 #pragma once
 
+#include "config.hpp"
+
 #include <opencv2/opencv.hpp>
 #include <opencv2/objdetect.hpp>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <string>
+#include <vector>
+
+// cv::FaceDetectorYN (YuNet) ships with OpenCV 4.5.4 and later.
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 4)))
+#define LXFU_HAVE_YUNET 1
+#endif
+
+// Pre-inference quality gate (FaceDetector::assess_quality): capture
+// pipelines drop faces below these bars instead of spending a forward on them.
+struct FaceQualitySettings {
+    bool enabled = true;
+    // Variance of the Laplacian of the face, resampled to 96x96.
+    double min_sharpness = 15.0;
+    // Mean and standard deviation of the face's luma (0-255).
+    double min_brightness = 30.0;
+    double max_brightness = 230.0;
+    double min_contrast = 12.0;
+    // Shorter side of the detected face, in pixels.
+    int min_face_size = 48;
+    // Longer over shorter side of the padded crop; a crop cut off by the
+    // frame edge gets elongated.
+    double max_aspect = 1.6;
+
+    static FaceQualitySettings from_config(const Config& config) {
+        FaceQualitySettings s;
+        s.enabled = config.get_bool("face_quality", s.enabled);
+        s.min_sharpness = std::max(0.0, config.get_double("face_quality_min_sharpness", s.min_sharpness));
+        s.min_brightness = std::clamp(config.get_double("face_quality_min_brightness", s.min_brightness), 0.0, 255.0);
+        s.max_brightness = std::clamp(config.get_double("face_quality_max_brightness", s.max_brightness), s.min_brightness, 255.0);
+        s.min_contrast = std::max(0.0, config.get_double("face_quality_min_contrast", s.min_contrast));
+        s.min_face_size = std::max(0, config.get_int("face_quality_min_size", s.min_face_size));
+        s.max_aspect = std::max(1.0, config.get_double("face_quality_max_aspect", s.max_aspect));
+        return s;
+    }
+};
+
+struct FaceQuality {
+    double sharpness = 0.0;
+    double brightness = 0.0;
+    double contrast = 0.0;
+    int face_size = 0;
+    double aspect = 1.0;
+    // Every measure within FaceQualitySettings.
+    bool acceptable = false;
+    // 0-1 for ranking frames: the mean of each measure's margin over its bar.
+    double score = 0.0;
+};
+
+// Detector tuning, read from lxfu.conf (see FaceDetectorSettings::from_config).
+struct FaceDetectorSettings {
+    std::string backend = "haar"; // haar | yunet
+    bool enabled = true;
+    double scale_factor = 1.1;
+    int min_neighbors = 3;
+    int min_size = 30;
+    // The first detection pass runs on the frame resized by this factor and
+    // candidates are refined at full resolution (1 = full-resolution pass only).
+    double downscale = 0.5;
+    float padding = 0.2f;
+    std::string cascade_path;
+    std::string yunet_model_path = "/usr/share/lxfu/face_detection_yunet.onnx";
+    float score_threshold = 0.8f;
+    // Tracking mode (track_faces): search only around the previous face and
+    // run a full-frame detection when it is lost or every redetect_interval frames.
+    bool tracking = true;
+    int redetect_interval = 10;
+    // Search window margin on each side, as a fraction of the tracked face size.
+    double tracking_margin = 0.5;
+    FaceQualitySettings quality;
+
+    static FaceDetectorSettings from_config(const Config& config) {
+        FaceDetectorSettings s;
+        s.backend = config.get("face_detector", s.backend);
+        s.enabled = config.get_bool("face_detection_enabled", s.enabled);
+        s.scale_factor = std::max(1.01, config.get_double("face_detection_scale_factor", s.scale_factor));
+        s.min_neighbors = std::max(0, config.get_int("face_detection_min_neighbors", s.min_neighbors));
+        s.min_size = std::max(1, config.get_int("face_detection_min_size", s.min_size));
+        s.downscale = std::clamp(config.get_double("face_detection_downscale", s.downscale), 0.1, 1.0);
+        s.padding = std::max(0.0f, static_cast<float>(config.get_double("face_detection_padding", s.padding)));
+        s.cascade_path = config.get("haar_cascade_path", s.cascade_path);
+        s.yunet_model_path = config.get("yunet_model_path", s.yunet_model_path);
+        s.score_threshold = static_cast<float>(config.get_double("face_detection_score_threshold", s.score_threshold));
+        s.tracking = config.get_bool("face_tracking", s.tracking);
+        s.redetect_interval = std::max(1, config.get_int("face_tracking_redetect_interval", s.redetect_interval));
+        s.tracking_margin = std::clamp(config.get_double("face_tracking_margin", s.tracking_margin), 0.1, 2.0);
+        s.quality = FaceQualitySettings::from_config(config);
+        return s;
+    }
+};
+
+// A face detection backend. Implementations are not thread-safe; every thread
+// needs its own instance.
+class FaceDetectorBackend {
+public:
+    virtual ~FaceDetectorBackend() = default;
+    virtual bool ready() const = 0;
+    virtual const char* name() const = 0;
+    // Whether detect() works on single-channel input as well as on BGR.
+    virtual bool accepts_gray() const { return false; }
+    // Face rectangles in image coordinates.
+    virtual std::vector<cv::Rect> detect(const cv::Mat& image) = 0;
+};
+
+// Haar cascade. With downscale < 1 the cascade first scans a reduced copy of the
+// frame, then each candidate is re-detected in a small full-resolution window
+// around it so the reported box keeps full-resolution accuracy.
+class HaarFaceDetectorBackend : public FaceDetectorBackend {
+public:
+    HaarFaceDetectorBackend(const FaceDetectorSettings& settings, bool verbose) : settings_(settings) {
+        std::string cascade_path = settings_.cascade_path.empty() ? find_cascade_file() : settings_.cascade_path;
+
+        if (cascade_path.empty() || !std::filesystem::exists(cascade_path)) {
+            if (verbose) {
+                std::cerr << "⚠ Warning: Haar cascade file not found. Face detection disabled." << std::endl;
+                std::cerr << "⚠ Install opencv-data package or download haarcascade_frontalface_default.xml" << std::endl;
+            }
+            return;
+        }
+
+        if (!face_cascade_.load(cascade_path)) {
+            if (verbose) {
+                std::cerr << "⚠ Warning: Could not load Haar cascade from: " << cascade_path << std::endl;
+                std::cerr << "⚠ Face detection disabled." << std::endl;
+            }
+            return;
+        }
+
+        ready_ = true;
+        if (verbose) {
+            std::cout << "✓ Face detector initialized using: " << cascade_path << std::endl;
+        }
+    }
+
+    bool ready() const override { return ready_; }
+    const char* name() const override { return "haar"; }
+    bool accepts_gray() const override { return true; }
+
+    std::vector<cv::Rect> detect(const cv::Mat& image) override {
+        std::vector<cv::Rect> faces;
+        if (!ready_ || image.empty()) {
+            return faces;
+        }
+
+        if (image.channels() == 3) {
+            cv::cvtColor(image, gray_, cv::COLOR_BGR2GRAY);
+        } else {
+            gray_ = image;
+        }
+
+        const double scale = settings_.downscale;
+        const int small_cols = static_cast<int>(gray_.cols * scale);
+        const int small_rows = static_cast<int>(gray_.rows * scale);
+        if (scale >= 1.0 || small_cols < kCascadeWindow || small_rows < kCascadeWindow) {
+            cv::equalizeHist(gray_, equalized_);
+            face_cascade_.detectMultiScale(equalized_, faces, settings_.scale_factor, settings_.min_neighbors,
+                                           0, cv::Size(settings_.min_size, settings_.min_size));
+            return faces;
+        }
+
+        cv::resize(gray_, small_, cv::Size(small_cols, small_rows), 0, 0, cv::INTER_AREA);
+        cv::equalizeHist(small_, small_);
+        const int small_min = std::max(kCascadeWindow, static_cast<int>(settings_.min_size * scale));
+        std::vector<cv::Rect> candidates;
+        face_cascade_.detectMultiScale(small_, candidates, settings_.scale_factor, settings_.min_neighbors,
+                                       0, cv::Size(small_min, small_min));
+
+        const cv::Rect bounds(0, 0, gray_.cols, gray_.rows);
+        for (const auto& c : candidates) {
+            cv::Rect scaled(static_cast<int>(c.x / scale), static_cast<int>(c.y / scale),
+                            static_cast<int>(c.width / scale), static_cast<int>(c.height / scale));
+            faces.push_back(refine(scaled, bounds).value_or(scaled & bounds));
+        }
+        return faces;
+    }
 
-class FaceDetector {
 private:
-    cv::CascadeClassifier face_cascade_;
-    bool initialized_;
-    bool verbose_;
-    
-    // Try multiple possible locations for Haar cascade
-    std::string find_cascade_file() {
+    // Smallest face the stock frontal cascade can report.
+    static constexpr int kCascadeWindow = 24;
+
+    std::string find_cascade_file() const {
         std::vector<std::string> possible_paths = {
             // System-wide installations
             "/usr/share/opencv4/haarcascades/haarcascade_frontalface_default.xml",
@@ -29,169 +206,339 @@ private:
             "./haarcascade_frontalface_default.xml",
             "../haarcascade_frontalface_default.xml",
         };
-        
+
         for (const auto& path : possible_paths) {
             if (std::filesystem::exists(path)) {
                 return path;
             }
         }
-        
+
         return "";
     }
-    
-public:
-    explicit FaceDetector(bool verbose = true) : initialized_(false), verbose_(verbose) {
-        std::string cascade_path = find_cascade_file();
 
-        if (cascade_path.empty()) {
-            if (verbose_) {
-                std::cerr << "⚠ Warning: Haar cascade file not found. Face detection disabled." << std::endl;
-                std::cerr << "⚠ Install opencv-data package or download haarcascade_frontalface_default.xml" << std::endl;
+    // Re-detect a face found at reduced resolution inside a window a little
+    // larger than the scaled-up box, only at scales close to the candidate.
+    std::optional<cv::Rect> refine(const cv::Rect& candidate, const cv::Rect& bounds) {
+        const int margin_x = candidate.width / 4;
+        const int margin_y = candidate.height / 4;
+        cv::Rect window = cv::Rect(candidate.x - margin_x, candidate.y - margin_y,
+                                   candidate.width + 2 * margin_x, candidate.height + 2 * margin_y) & bounds;
+        if (window.width < kCascadeWindow || window.height < kCascadeWindow) {
+            return std::nullopt;
+        }
+
+        cv::equalizeHist(gray_(window), equalized_);
+        const int side = std::min(candidate.width, candidate.height);
+        std::vector<cv::Rect> found;
+        face_cascade_.detectMultiScale(equalized_, found, settings_.scale_factor, settings_.min_neighbors, 0,
+                                       cv::Size(side * 3 / 4, side * 3 / 4),
+                                       cv::Size(side * 5 / 4, side * 5 / 4));
+        if (found.empty()) {
+            return std::nullopt;
+        }
+        cv::Rect best = *std::max_element(found.begin(), found.end(),
+                                          [](const cv::Rect& a, const cv::Rect& b) { return a.area() < b.area(); });
+        best.x += window.x;
+        best.y += window.y;
+        return best;
+    }
+
+    FaceDetectorSettings settings_;
+    cv::CascadeClassifier face_cascade_;
+    bool ready_ = false;
+    cv::Mat gray_;
+    cv::Mat small_;
+    cv::Mat equalized_;
+};
+
+#ifdef LXFU_HAVE_YUNET
+// OpenCV DNN face detector (YuNet ONNX model). The network runs on the frame
+// resized by `downscale`; boxes are mapped back to frame coordinates.
+class YuNetFaceDetectorBackend : public FaceDetectorBackend {
+public:
+    YuNetFaceDetectorBackend(const FaceDetectorSettings& settings, bool verbose) : settings_(settings) {
+        if (!std::filesystem::exists(settings_.yunet_model_path)) {
+            if (verbose) {
+                std::cerr << "⚠ Warning: YuNet model not found: " << settings_.yunet_model_path << std::endl;
             }
             return;
         }
-
-        if (!face_cascade_.load(cascade_path)) {
-            if (verbose_) {
-                std::cerr << "⚠ Warning: Could not load Haar cascade from: " << cascade_path << std::endl;
-                std::cerr << "⚠ Face detection disabled." << std::endl;
+        try {
+            net_ = cv::FaceDetectorYN::create(settings_.yunet_model_path, "", cv::Size(320, 320),
+                                              settings_.score_threshold);
+        } catch (const cv::Exception& ex) {
+            if (verbose) {
+                std::cerr << "⚠ Warning: Could not load YuNet model: " << ex.what() << std::endl;
             }
             return;
         }
+        if (net_ && verbose) {
+            std::cout << "✓ Face detector initialized using: " << settings_.yunet_model_path << std::endl;
+        }
+    }
 
-        initialized_ = true;
-        if (verbose_) {
-            std::cout << "✓ Face detector initialized using: " << cascade_path << std::endl;
+    bool ready() const override { return static_cast<bool>(net_); }
+    const char* name() const override { return "yunet"; }
+
+    std::vector<cv::Rect> detect(const cv::Mat& image) override {
+        std::vector<cv::Rect> faces;
+        if (!net_ || image.empty()) {
+            return faces;
+        }
+
+        const double scale = settings_.downscale;
+        const cv::Mat* input = &image;
+        if (image.channels() == 1) {
+            cv::cvtColor(image, color_, cv::COLOR_GRAY2BGR);
+            input = &color_;
+        }
+        if (scale < 1.0) {
+            cv::resize(*input, small_, cv::Size(static_cast<int>(input->cols * scale),
+                                                static_cast<int>(input->rows * scale)),
+                       0, 0, cv::INTER_AREA);
+            input = &small_;
+        }
+
+        const cv::Size input_size(input->cols, input->rows);
+        if (input_size.width != input_size_.width || input_size.height != input_size_.height) {
+            net_->setInputSize(input_size);
+            input_size_ = input_size;
+        }
+
+        cv::Mat detections;
+        net_->detect(*input, detections);
+        const cv::Rect bounds(0, 0, image.cols, image.rows);
+        const int min_side = settings_.min_size;
+        for (int i = 0; i < detections.rows; ++i) {
+            cv::Rect box(static_cast<int>(detections.at<float>(i, 0) / scale),
+                         static_cast<int>(detections.at<float>(i, 1) / scale),
+                         static_cast<int>(detections.at<float>(i, 2) / scale),
+                         static_cast<int>(detections.at<float>(i, 3) / scale));
+            box = box & bounds;
+            if (box.width >= min_side && box.height >= min_side) {
+                faces.push_back(box);
+            }
+        }
+        return faces;
+    }
+
+private:
+    FaceDetectorSettings settings_;
+    cv::Ptr<cv::FaceDetectorYN> net_;
+    cv::Size input_size_;
+    cv::Mat color_;
+    cv::Mat small_;
+};
+#endif
+
+class FaceDetector {
+private:
+    FaceDetectorSettings settings_;
+    std::unique_ptr<FaceDetectorBackend> backend_;
+    bool verbose_;
+    std::optional<cv::Rect> track_;
+    int frames_since_detect_ = 0;
+    // assess_quality() scratch.
+    cv::Mat quality_gray_;
+    cv::Mat quality_small_;
+    cv::Mat quality_laplacian_;
+
+    static std::unique_ptr<FaceDetectorBackend> make_backend(const FaceDetectorSettings& settings, bool verbose) {
+        if (settings.backend == "yunet") {
+#ifdef LXFU_HAVE_YUNET
+            auto yunet = std::make_unique<YuNetFaceDetectorBackend>(settings, verbose);
+            if (yunet->ready()) {
+                return yunet;
+            }
+#endif
+            if (verbose) {
+                std::cerr << "⚠ Warning: YuNet detector unavailable, using Haar cascade" << std::endl;
+            }
+        } else if (settings.backend != "haar" && verbose) {
+            std::cerr << "⚠ Warning: Unknown face_detector '" << settings.backend << "', using Haar cascade" << std::endl;
         }
+        return std::make_unique<HaarFaceDetectorBackend>(settings, verbose);
     }
-    
+
+public:
+    explicit FaceDetector(bool verbose = true) : FaceDetector(FaceDetectorSettings{}, verbose) {}
+
+    explicit FaceDetector(const FaceDetectorSettings& settings, bool verbose = true)
+        : settings_(settings), verbose_(verbose) {
+        if (settings_.enabled) {
+            backend_ = make_backend(settings_, verbose_);
+        } else if (verbose_) {
+            std::cout << "Face detection disabled; using full frames" << std::endl;
+        }
+    }
+
     bool is_initialized() const {
-        return initialized_;
+        return backend_ && backend_->ready();
+    }
+
+    const FaceDetectorSettings& settings() const { return settings_; }
+
+    // True when a grayscale frame detects as well as its BGR original.
+    bool accepts_gray() const { return backend_ && backend_->accepts_gray(); }
+
+    void set_verbose(bool verbose) { verbose_ = verbose; }
+
+    // Every face in the frame, in frame coordinates.
+    std::vector<cv::Rect> detect_faces(const cv::Mat& image) {
+        if (!is_initialized()) {
+            return {};
+        }
+        return backend_->detect(image);
+    }
+
+    static std::optional<cv::Rect> largest_face(const std::vector<cv::Rect>& faces) {
+        if (faces.empty()) {
+            return std::nullopt;
+        }
+        return *std::max_element(faces.begin(), faces.end(),
+                                 [](const cv::Rect& a, const cv::Rect& b) { return a.area() < b.area(); });
+    }
+
+    // `face` grown by `padding` of its size on each side, clipped to the frame.
+    static cv::Rect padded_rect(const cv::Rect& face, const cv::Size& frame, float padding) {
+        int pad_x = static_cast<int>(face.width * padding);
+        int pad_y = static_cast<int>(face.height * padding);
+        return cv::Rect(face.x - pad_x, face.y - pad_y, face.width + 2 * pad_x, face.height + 2 * pad_y) &
+               cv::Rect(0, 0, frame.width, frame.height);
+    }
+
+    // Tracking variant of detect_faces() for consecutive frames of one camera.
+    // While a face is tracked only a window around it is searched; the whole
+    // frame is scanned when the face is lost there or every redetect_interval
+    // frames. Call reset_tracking() before starting a new capture.
+    std::vector<cv::Rect> track_faces(const cv::Mat& image) {
+        if (!is_initialized()) {
+            return {};
+        }
+        if (!settings_.tracking) {
+            return backend_->detect(image);
+        }
+
+        if (track_ && frames_since_detect_ < settings_.redetect_interval) {
+            const int margin_x = static_cast<int>(track_->width * settings_.tracking_margin);
+            const int margin_y = static_cast<int>(track_->height * settings_.tracking_margin);
+            cv::Rect window = cv::Rect(track_->x - margin_x, track_->y - margin_y,
+                                       track_->width + 2 * margin_x, track_->height + 2 * margin_y) &
+                              cv::Rect(0, 0, image.cols, image.rows);
+            if (window.width > 0 && window.height > 0) {
+                std::vector<cv::Rect> faces = backend_->detect(image(window));
+                if (auto largest = largest_face(faces)) {
+                    for (auto& face : faces) {
+                        face.x += window.x;
+                        face.y += window.y;
+                    }
+                    track_ = cv::Rect(largest->x + window.x, largest->y + window.y, largest->width, largest->height);
+                    ++frames_since_detect_;
+                    return faces;
+                }
+            }
+        }
+
+        // Lost (or due for a refresh): scan the whole frame.
+        std::vector<cv::Rect> faces = backend_->detect(image);
+        track_ = largest_face(faces);
+        frames_since_detect_ = 0;
+        return faces;
     }
-    
+
+    void reset_tracking() {
+        track_.reset();
+        frames_since_detect_ = 0;
+    }
+
     // Detect faces and return the largest one (assumed to be the primary face)
     std::optional<cv::Rect> detect_largest_face(const cv::Mat& image) {
-        if (!initialized_) {
+        if (!is_initialized()) {
             if (verbose_) {
                 std::cerr << "✗ Face detector unavailable; install OpenCV haarcascades" << std::endl;
             }
             return std::nullopt;
         }
-        
-        // Convert to grayscale for detection
-        cv::Mat gray;
-        if (image.channels() == 3) {
-            cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
-        } else {
-            gray = image.clone();
-        }
-        
-        // Equalize histogram for better detection
-        cv::equalizeHist(gray, gray);
-        
-        // Detect faces
-        std::vector<cv::Rect> faces;
-        face_cascade_.detectMultiScale(
-            gray,
-            faces,
-            1.1,    // scaleFactor
-            3,      // minNeighbors
-            0,      // flags
-            cv::Size(30, 30)  // minSize
-        );
-        
-        if (faces.empty()) {
+
+        std::vector<cv::Rect> faces = backend_->detect(image);
+        auto largest = largest_face(faces);
+        if (!largest) {
             if (verbose_) {
                 std::cout << "✗ No face detected" << std::endl;
             }
             return std::nullopt;
         }
-        
-        // Find largest face
-        cv::Rect largest_face = faces[0];
-        for (const auto& face : faces) {
-            if (face.area() > largest_face.area()) {
-                largest_face = face;
-            }
-        }
-        
+
         if (verbose_) {
-            std::cout << "✓ Face detected at (" << largest_face.x << ", " << largest_face.y 
-                      << ") size " << largest_face.width << "x" << largest_face.height << std::endl;
+            std::cout << "✓ Face detected at (" << largest->x << ", " << largest->y
+                      << ") size " << largest->width << "x" << largest->height << std::endl;
         }
 
         if (verbose_ && faces.size() > 1) {
             std::cout << "  Note: " << faces.size() << " faces detected, using largest" << std::endl;
         }
-        
-        return largest_face;
+
+        return largest;
+    }
+
+    // Copy of the padded face region.
+    cv::Mat crop_face(const cv::Mat& image, const cv::Rect& face, float padding) const {
+        cv::Mat cropped = image(padded_rect(face, cv::Size(image.cols, image.rows), padding)).clone();
+
+        if (verbose_) {
+            std::cout << "✓ Cropped to face region: " << cropped.cols << "x" << cropped.rows
+                      << " (from " << image.cols << "x" << image.rows << ")" << std::endl;
+        }
+
+        return cropped;
     }
 
-    // Crop image to face region with optional padding
-    std::optional<cv::Mat> crop_to_face(const cv::Mat& image, float padding = 0.2f) {
+    // The largest face, padded by the configured padding, as a view into
+    // `image` (frame and rect, no copy): FaceEngine samples its input
+    // straight from the frame. With detection disabled in the config the
+    // whole frame is returned.
+    std::optional<cv::Mat> face_region(const cv::Mat& image) {
+        if (!settings_.enabled) {
+            return image;
+        }
         auto face_rect = detect_largest_face(image);
         if (!face_rect) {
             return std::nullopt;
         }
-
-        // Add padding around face
-        int pad_x = static_cast<int>(face_rect->width * padding);
-        int pad_y = static_cast<int>(face_rect->height * padding);
-
-        face_rect->x = std::max(0, face_rect->x - pad_x);
-        face_rect->y = std::max(0, face_rect->y - pad_y);
-        face_rect->width = std::min(image.cols - face_rect->x, face_rect->width + 2 * pad_x);
-        face_rect->height = std::min(image.rows - face_rect->y, face_rect->height + 2 * pad_y);
-
-        // Crop to face region
-        cv::Rect roi = *face_rect;
-        cv::Mat cropped = image(roi).clone();
-
+        cv::Mat region = image(padded_rect(*face_rect, cv::Size(image.cols, image.rows), settings_.padding));
         if (verbose_) {
-            std::cout << "✓ Cropped to face region: " << cropped.cols << "x" << cropped.rows 
+            std::cout << "✓ Face region: " << region.cols << "x" << region.rows
                       << " (from " << image.cols << "x" << image.rows << ")" << std::endl;
         }
+        return region;
+    }
 
-        return cropped;
+    // Like face_region(), but an owned copy, for crops kept after the frame.
+    std::optional<cv::Mat> crop_to_face(const cv::Mat& image) {
+        return crop_to_face(image, settings_.padding);
     }
-    
-    // Draw detected faces on image (for preview mode)
-    void draw_faces(cv::Mat& image) {
-        if (!initialized_) {
-            return;
+
+    std::optional<cv::Mat> crop_to_face(const cv::Mat& image, float padding) {
+        if (!settings_.enabled) {
+            return image.clone();
         }
-        
-        cv::Mat gray;
-        if (image.channels() == 3) {
-            cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
-        } else {
-            gray = image.clone();
+        auto face_rect = detect_largest_face(image);
+        if (!face_rect) {
+            return std::nullopt;
         }
-        
-        cv::equalizeHist(gray, gray);
-        
-        std::vector<cv::Rect> faces;
-        face_cascade_.detectMultiScale(gray, faces, 1.1, 3, 0, cv::Size(30, 30));
-        
-        // Draw rectangles around faces
+        return crop_face(image, *face_rect, padding);
+    }
+
+    // Draw already detected faces on image (for preview mode)
+    void draw_faces(cv::Mat& image, const std::vector<cv::Rect>& faces) const {
         for (const auto& face : faces) {
             cv::rectangle(image, face, cv::Scalar(0, 255, 0), 2);
-            
+
             // Draw padding preview
-            float padding = 0.2f;
-            int pad_x = static_cast<int>(face.width * padding);
-            int pad_y = static_cast<int>(face.height * padding);
-            
-            cv::Rect padded_face(
-                std::max(0, face.x - pad_x),
-                std::max(0, face.y - pad_y),
-                std::min(image.cols - face.x + pad_x, face.width + 2 * pad_x),
-                std::min(image.rows - face.y + pad_y, face.height + 2 * pad_y)
-            );
-            
-            cv::rectangle(image, padded_face, cv::Scalar(255, 255, 0), 1, cv::LINE_8);
-        }
-        
+            cv::rectangle(image, padded_rect(face, cv::Size(image.cols, image.rows), settings_.padding),
+                          cv::Scalar(255, 255, 0), 1, cv::LINE_8);
+        }
+
         // Draw face count
         if (!faces.empty()) {
             std::string text = "Faces: " + std::to_string(faces.size());
@@ -199,4 +546,62 @@ public:
                        cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(0, 255, 0), 2);
         }
     }
+
+    // Cheap checks on a detected face before it is embedded: blur (Laplacian
+    // variance), exposure (mean and spread of the luma), size, and the aspect
+    // of the padded crop. Works on BGR or gray frames and costs a 96x96
+    // resample of the face.
+    FaceQuality assess_quality(const cv::Mat& image, const cv::Rect& face) {
+        constexpr int kSampleSize = 96;
+        const FaceQualitySettings& bar = settings_.quality;
+        FaceQuality quality;
+        const cv::Rect box = face & cv::Rect(0, 0, image.cols, image.rows);
+        if (box.width <= 0 || box.height <= 0) {
+            return quality;
+        }
+
+        const cv::Mat roi = image(box);
+        if (roi.channels() == 1) {
+            quality_gray_ = roi;
+        } else {
+            cv::cvtColor(roi, quality_gray_, roi.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        }
+        cv::resize(quality_gray_, quality_small_, cv::Size(kSampleSize, kSampleSize), 0, 0, cv::INTER_AREA);
+
+        cv::Scalar mean;
+        cv::Scalar stddev;
+        cv::meanStdDev(quality_small_, mean, stddev);
+        quality.brightness = mean[0];
+        quality.contrast = stddev[0];
+        cv::Laplacian(quality_small_, quality_laplacian_, CV_16S);
+        cv::meanStdDev(quality_laplacian_, mean, stddev);
+        quality.sharpness = stddev[0] * stddev[0];
+
+        const cv::Rect padded = padded_rect(face, cv::Size(image.cols, image.rows), settings_.padding);
+        quality.face_size = std::min(face.width, face.height);
+        quality.aspect = static_cast<double>(std::max(padded.width, padded.height)) /
+                         std::max(1, std::min(padded.width, padded.height));
+
+        quality.acceptable = quality.sharpness >= bar.min_sharpness &&
+                             quality.brightness >= bar.min_brightness && quality.brightness <= bar.max_brightness &&
+                             quality.contrast >= bar.min_contrast && quality.face_size >= bar.min_face_size &&
+                             quality.aspect <= bar.max_aspect;
+
+        // A measure at twice its bar (or mid-range brightness) scores 1.
+        auto margin = [](double value, double bar_value) {
+            return bar_value > 0.0 ? std::clamp(value / (2.0 * bar_value), 0.0, 1.0) : 1.0;
+        };
+        const double mid = 0.5 * (bar.min_brightness + bar.max_brightness);
+        const double half_range = std::max(1.0, 0.5 * (bar.max_brightness - bar.min_brightness));
+        const double exposure = std::clamp(1.0 - std::abs(quality.brightness - mid) / half_range, 0.0, 1.0);
+        quality.score = (margin(quality.sharpness, bar.min_sharpness) + exposure +
+                         margin(quality.contrast, bar.min_contrast) +
+                         margin(quality.face_size, bar.min_face_size)) / 4.0;
+        return quality;
+    }
+
+    // Detect once and draw the result.
+    void draw_faces(cv::Mat& image) {
+        draw_faces(image, detect_faces(image));
+    }
 };
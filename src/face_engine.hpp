@@ -3,134 +3,469 @@
 #include <torch/script.h>
 #include <torch/torch.h>
 #include <opencv2/opencv.hpp>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <filesystem>
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <optional>
+#include <sstream>
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#if defined(LXFU_TORCH_CUDA) && __has_include(<c10/cuda/CUDACachingAllocator.h>)
+#include <c10/cuda/CUDACachingAllocator.h>
+#define LXFU_HAVE_CUDA_CACHE 1
+#endif
+
+#include "config.hpp"
+#include "cpu_affinity.hpp"
+#include "metrics.hpp"
+
+// Numeric precision the model runs in. FP16/BF16 cast the weights and inputs
+// on CUDA; INT8 loads a dynamically quantized artifact and always runs on the CPU.
+enum class ModelPrecision { FP32, FP16, BF16, INT8 };
+
+inline std::optional<ModelPrecision> parse_model_precision(const std::string& value) {
+    if (value == "fp32") return ModelPrecision::FP32;
+    if (value == "fp16") return ModelPrecision::FP16;
+    if (value == "bf16") return ModelPrecision::BF16;
+    if (value == "int8") return ModelPrecision::INT8;
+    return std::nullopt;
+}
+
+inline const char* model_precision_name(ModelPrecision precision) {
+    switch (precision) {
+        case ModelPrecision::FP32: return "fp32";
+        case ModelPrecision::FP16: return "fp16";
+        case ModelPrecision::BF16: return "bf16";
+        case ModelPrecision::INT8: return "int8";
+    }
+    return "fp32";
+}
+
+// Which model file to load and how, from model_path, model_precision and
+// quantized_model_path (defaults to model_path with an ".int8" infix).
+struct ModelSettings {
+    std::string path;
+    std::string quantized_path;
+    ModelPrecision precision = ModelPrecision::FP32;
+    // Intra-op threads (0 = libtorch default, or one per cpu_affinity CPU).
+    int inference_threads = 0;
+    // Inter-op threads (0 = libtorch default). Process-wide and fixed once set.
+    int interop_threads = 0;
+    // CPUs inference runs on; empty = no pinning.
+    std::vector<int> cpu_affinity;
+    // Freeze the TorchScript module and run optimize_for_inference on load.
+    bool optimize = true;
+    // Dummy forward passes per batch size in FaceEngine::warm_up().
+    int warmup_runs = 2;
+    std::vector<int> warmup_batch_sizes = {1, 16}; // single frames and FaceEngine::kDefaultBatchSize
+
+    static std::string default_quantized_path(const std::string& model_path) {
+        std::filesystem::path p(model_path);
+        return (p.parent_path() / (p.stem().string() + ".int8" + p.extension().string())).string();
+    }
+
+    static ModelSettings from_config(const Config& config) {
+        ModelSettings s;
+        s.path = config.get("model_path");
+        s.quantized_path = config.get("quantized_model_path", default_quantized_path(s.path));
+        std::string precision = config.get("model_precision", "fp32");
+        auto parsed = parse_model_precision(precision);
+        if (!parsed) {
+            throw std::runtime_error("Unknown model_precision '" + precision + "' (expected fp32, fp16, bf16 or int8)");
+        }
+        s.precision = *parsed;
+        s.inference_threads = std::max(0, config.get_int("inference_threads", 0));
+        s.interop_threads = std::max(0, config.get_int("interop_threads", 0));
+        s.cpu_affinity = parse_cpu_list(config.get("cpu_affinity"));
+        s.optimize = config.get_bool("model_optimize", s.optimize);
+        s.warmup_runs = std::max(0, config.get_int("model_warmup_runs", s.warmup_runs));
+        std::string sizes = config.get("model_warmup_batch_sizes");
+        if (!sizes.empty()) {
+            s.warmup_batch_sizes = parse_batch_sizes(sizes);
+        }
+        return s;
+    }
+
+    // "1,16" -> {1, 16}
+    static std::vector<int> parse_batch_sizes(const std::string& value) {
+        std::vector<int> sizes;
+        std::stringstream stream(value);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            try {
+                int size = std::stoi(item);
+                if (size > 0) {
+                    sizes.push_back(size);
+                }
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid model_warmup_batch_sizes '" + value + "'");
+            }
+        }
+        return sizes;
+    }
+
+    const std::string& file() const {
+        return precision == ModelPrecision::INT8 ? quantized_path : path;
+    }
+};
+
+// DINOv3 embedding model. Preprocessing reuses per-engine scratch buffers,
+// so the entry points that touch them (extract_embeddings, preprocess,
+// warm_up) lock the engine and run one at a time; an engine may be shared by
+// threads, but they do not get parallel forward passes. lxfud funnels
+// concurrent sessions through InferenceScheduler to batch them instead.
 class FaceEngine {
 private:
     torch::jit::script::Module model_;
     torch::Device device_;
-    int feature_dim_;
+    ModelPrecision precision_;
+    torch::ScalarType compute_type_;
+    std::atomic<int> feature_dim_;
     bool verbose_;
+    std::vector<int> inference_cpus_;
+
+    static torch::Device pick_device(ModelPrecision precision) {
+        // Quantized kernels only exist for the CPU.
+        if (precision != ModelPrecision::INT8 && torch::cuda::is_available()) {
+            return torch::Device(torch::kCUDA);
+        }
+        return torch::Device(torch::kCPU);
+    }
     
-    // Helper to preprocess image
-    torch::Tensor preprocess_image(const cv::Mat& image) {
-        cv::Mat rgb_image;
-        cv::cvtColor(image, rgb_image, cv::COLOR_BGR2RGB);
+    static constexpr int kInputSize = 224;
+
+    // Reused across calls so steady-state preprocessing does not allocate:
+    // the 224x224 warp target and the [N, 3, 224, 224] input batch (pinned on
+    // CUDA so the host-to-device copy can run asynchronously).
+    cv::Mat square_;
+    torch::Tensor input_batch_;
+    // Guards square_ and input_batch_; held for a whole call, so callers
+    // sharing one engine (pam_lxfu's concurrent in-process logins) take turns
+    // instead of overwriting each other's input batch.
+    std::mutex scratch_mutex_;
+
+    torch::Tensor& input_batch(int64_t count) {
+        if (!input_batch_.defined() || input_batch_.size(0) < count) {
+            input_batch_ = torch::empty({count, 3, kInputSize, kInputSize},
+                                        torch::TensorOptions(torch::kFloat32).pinned_memory(device_.is_cuda()));
+        }
+        return input_batch_;
+    }
 
-        const int target_size = 224;
+    // Equivalent to resizing so the short side is 224 / 0.875 (bicubic) and
+    // center-cropping 224x224, but the crop is worked out first and a single
+    // bicubic warp samples only those pixels of `image`, which may be a view
+    // into a larger frame (FaceDetector::face_region). The result is written
+    // as RGB, ImageNet-normalized CHW floats straight into `out` (3 * 224 *
+    // 224 floats); gray and BGRA inputs are expanded in that same pass.
+    // Writes square_: call with scratch_mutex_ held.
+    void preprocess_image(const cv::Mat& image, float* out) {
+        const int target_size = kInputSize;
         const float crop_pct = 0.875f;
         const int resize_size = static_cast<int>(std::round(target_size / crop_pct));
 
         int resize_width = 0;
         int resize_height = 0;
-        if (rgb_image.cols >= rgb_image.rows) {
+        if (image.cols >= image.rows) {
             resize_height = resize_size;
             resize_width = static_cast<int>(std::round(
-                resize_size * static_cast<float>(rgb_image.cols) / static_cast<float>(rgb_image.rows)));
+                resize_size * static_cast<float>(image.cols) / static_cast<float>(image.rows)));
         } else {
             resize_width = resize_size;
             resize_height = static_cast<int>(std::round(
-                resize_size * static_cast<float>(rgb_image.rows) / static_cast<float>(rgb_image.cols)));
+                resize_size * static_cast<float>(image.rows) / static_cast<float>(image.cols)));
         }
-
         resize_width = std::max(resize_width, target_size);
         resize_height = std::max(resize_height, target_size);
+        const int x0 = (resize_width - target_size) / 2;
+        const int y0 = (resize_height - target_size) / 2;
 
-        cv::Mat resized;
-        cv::resize(rgb_image, resized, cv::Size(resize_width, resize_height), 0.0, 0.0, cv::INTER_CUBIC);
-
-        const int raw_x0 = (resized.cols - target_size) / 2;
-        const int raw_y0 = (resized.rows - target_size) / 2;
-        const int max_x = std::max(0, resized.cols - target_size);
-        const int max_y = std::max(0, resized.rows - target_size);
-        const int x0 = std::clamp(raw_x0, 0, max_x);
-        const int y0 = std::clamp(raw_y0, 0, max_y);
-        const int crop_width = std::min(target_size, resized.cols);
-        const int crop_height = std::min(target_size, resized.rows);
-        cv::Rect crop{x0, y0, crop_width, crop_height};
-        cv::Mat cropped = resized(crop).clone();
-        if (cropped.cols != target_size || cropped.rows != target_size) {
-            cv::resize(cropped, cropped, cv::Size(target_size, target_size), 0.0, 0.0, cv::INTER_CUBIC);
-        }
-
-        // Convert to float and normalize to [0, 1]
-        cv::Mat float_image;
-        cropped.convertTo(float_image, CV_32FC3, 1.0 / 255.0);
-        
-        // ImageNet normalization
-        const std::vector<float> mean = {0.485f, 0.456f, 0.406f};
-        const std::vector<float> std = {0.229f, 0.224f, 0.225f};
-        
-        std::vector<cv::Mat> channels(3);
-        cv::split(float_image, channels);
-        
-        for (int i = 0; i < 3; ++i) {
-            channels[i] = (channels[i] - mean[i]) / std[i];
+        // Output pixel (x, y) of the crop is resized pixel (x0 + x, y0 + y),
+        // which cv::resize samples at ((x0 + x + 0.5) / scale - 0.5) in the
+        // source; this is that mapping as an inverse affine transform.
+        const double scale_x = static_cast<double>(resize_width) / image.cols;
+        const double scale_y = static_cast<double>(resize_height) / image.rows;
+        const cv::Matx23d to_source(1.0 / scale_x, 0.0, (x0 + 0.5) / scale_x - 0.5,
+                                    0.0, 1.0 / scale_y, (y0 + 0.5) / scale_y - 0.5);
+        cv::warpAffine(image, square_, to_source, cv::Size(target_size, target_size),
+                       cv::INTER_CUBIC | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+        const cv::Mat& cropped = square_;
+        const int channels = cropped.channels();
+        // Gray reads its one channel three times; BGR(A) reads B, G, R.
+        const int g_offset = channels >= 3 ? 1 : 0;
+        const int r_offset = channels >= 3 ? 2 : 0;
+
+        // (x / 255 - mean) / std == x * scale + bias, per RGB channel.
+        constexpr float mean[3] = {0.485f, 0.456f, 0.406f};
+        constexpr float stddev[3] = {0.229f, 0.224f, 0.225f};
+        float scale[3];
+        float bias[3];
+        for (int c = 0; c < 3; ++c) {
+            scale[c] = 1.0f / (255.0f * stddev[c]);
+            bias[c] = -mean[c] / stddev[c];
         }
+
+        const std::size_t plane = static_cast<std::size_t>(target_size) * target_size;
+        float* r_plane = out;
+        float* g_plane = out + plane;
+        float* b_plane = out + 2 * plane;
+        for (int y = 0; y < target_size; ++y) {
+            const unsigned char* px = cropped.ptr<unsigned char>(y);
+            const std::size_t row = static_cast<std::size_t>(y) * target_size;
+            float* r = r_plane + row;
+            float* g = g_plane + row;
+            float* b = b_plane + row;
+            for (int x = 0; x < target_size; ++x, px += channels) {
+                b[x] = static_cast<float>(px[0]) * scale[2] + bias[2];
+                g[x] = static_cast<float>(px[g_offset]) * scale[1] + bias[1];
+                r[x] = static_cast<float>(px[r_offset]) * scale[0] + bias[0];
+            }
+        }
+    }
+
+    // Forward a [N, 3, H, W] batch and return L2-normalized [N, D] features on the CPU.
+    torch::Tensor forward_batch(const torch::Tensor& batch) {
+        std::vector<torch::jit::IValue> inputs;
+        inputs.emplace_back(batch.to(device_, compute_type_, /*non_blocking=*/batch.is_pinned()));
+
+        torch::Tensor output = model_.forward(inputs).toTensor();
+        output = output.cpu().to(torch::kFloat32);
         
-        cv::merge(channels, float_image);
-        
-        // Convert to tensor: HWC -> CHW
-        torch::Tensor tensor = torch::from_blob(
-            float_image.data,
-            {float_image.rows, float_image.cols, 3},
-            torch::kFloat32
-        ).clone();
+        // Flatten if needed
+        if (output.dim() > 2) {
+            output = output.flatten(1);
+        }
+        output = output.contiguous();
         
-        tensor = tensor.permute({2, 0, 1}).unsqueeze(0);
-        return tensor.to(device_);
+        // L2 normalize for cosine similarity
+        output.div_(output.norm(2, 1, /*keepdim=*/true).clamp_min(1e-12));
+        return output;
     }
     
 public:
-    FaceEngine(const std::string& model_path, bool verbose = true) 
-        : device_(torch::cuda::is_available() ? torch::kCUDA : torch::kCPU),
+    static constexpr std::size_t kDefaultBatchSize = 16;
+
+    FaceEngine(const std::string& model_path, bool verbose = true,
+               ModelPrecision precision = ModelPrecision::FP32)
+        : device_(pick_device(precision)),
+          precision_(precision),
+          compute_type_(torch::kFloat32),
           feature_dim_(0),
           verbose_(verbose) {
 
         if (!std::filesystem::exists(model_path)) {
+            if (precision == ModelPrecision::INT8) {
+                throw std::runtime_error("Quantized model not found: " + model_path +
+                                         " (create it with 'lxfu model quantize')");
+            }
             throw std::runtime_error("Model file not found: " + model_path);
         }
 
+        if ((precision_ == ModelPrecision::FP16 || precision_ == ModelPrecision::BF16) && !device_.is_cuda()) {
+            if (verbose_) {
+                std::cerr << "⚠ Warning: model_precision=" << model_precision_name(precision_)
+                          << " needs CUDA; using fp32 (int8 is the CPU option)" << std::endl;
+            }
+            precision_ = ModelPrecision::FP32;
+        }
+
         if (verbose_) {
             std::cout << "Loading DINOv3 model on " 
-                      << (torch::cuda::is_available() ? "CUDA" : "CPU") << "..." << std::endl;
+                      << (device_.is_cuda() ? "CUDA" : "CPU")
+                      << " (" << model_precision_name(precision_) << ")..." << std::endl;
         }
         
         model_ = torch::jit::load(model_path, device_);
         model_.eval();
+
+        if (precision_ == ModelPrecision::FP16) {
+            compute_type_ = torch::kHalf;
+        } else if (precision_ == ModelPrecision::BF16) {
+            compute_type_ = torch::kBFloat16;
+        }
+        if (compute_type_ != torch::kFloat32) {
+            model_.to(compute_type_);
+        }
+    }
+
+    FaceEngine(const ModelSettings& settings, bool verbose = true)
+        : FaceEngine(settings.file(), verbose, settings.precision) {
+        configure_threads(settings);
+        if (settings.optimize) {
+            optimize_module();
+        }
+    }
+
+    // Freeze the module (inlining weights and attributes as constants) and apply
+    // the inference-only graph rewrites. Keeps the loaded module if either fails,
+    // e.g. for scripted models with mutable attributes.
+    bool optimize_module() {
+        try {
+            torch::jit::Module frozen = torch::jit::freeze(model_);
+            model_ = torch::jit::optimize_for_inference(frozen);
+            return true;
+        } catch (const std::exception& ex) {
+            if (verbose_) {
+                std::cerr << "⚠ Warning: Model optimization skipped: " << ex.what() << std::endl;
+            }
+            return false;
+        }
+    }
+
+    // Run dummy 224x224 batches through the model so the JIT profiling and
+    // fusion passes and the allocator warm-up happen before the first real
+    // request. Each batch size gets its own shape-specialized graph.
+    void warm_up(const std::vector<int>& batch_sizes, int runs) {
+        if (runs <= 0 || batch_sizes.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> scratch(scratch_mutex_);
+        torch::NoGradGuard no_grad;
+        ScopedThreadAffinity affinity(inference_cpus_);
+        for (int size : batch_sizes) {
+            const auto count = static_cast<int64_t>(size);
+            torch::Tensor& input = input_batch(count);
+            input.zero_();
+            for (int run = 0; run < runs; ++run) {
+                torch::Tensor output = forward_batch(input.narrow(0, 0, count));
+                feature_dim_ = static_cast<int>(output.size(1));
+            }
+        }
+    }
+
+    void warm_up(const ModelSettings& settings) {
+        warm_up(settings.warmup_batch_sizes, settings.warmup_runs);
+    }
+
+    // Apply inference_threads / interop_threads / cpu_affinity. Thread counts
+    // are process-wide libtorch settings; the affinity is applied around each
+    // forward pass (see extract_embeddings).
+    void configure_threads(const ModelSettings& settings) {
+        inference_cpus_ = settings.cpu_affinity;
+        int threads = settings.inference_threads;
+        if (threads == 0 && !inference_cpus_.empty()) {
+            threads = static_cast<int>(inference_cpus_.size());
+        }
+        if (threads > 0) {
+            torch::set_num_threads(threads);
+        }
+
+        // libtorch rejects a second call, or any call once inter-op work started.
+        static bool interop_configured = false;
+        if (settings.interop_threads > 0 && !interop_configured) {
+            try {
+                torch::set_num_interop_threads(settings.interop_threads);
+                interop_configured = true;
+            } catch (const std::exception& ex) {
+                if (verbose_) {
+                    std::cerr << "⚠ Warning: Could not set interop_threads: " << ex.what() << std::endl;
+                }
+            }
+        }
+
+        if (verbose_ && (threads > 0 || !inference_cpus_.empty())) {
+            std::cout << "Inference threads: " << torch::get_num_threads();
+            if (!inference_cpus_.empty()) {
+                std::cout << " on " << inference_cpus_.size() << " pinned CPU(s)";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    // CPUs inference is pinned to (empty when not pinned). Capture threads
+    // should run on complement_cpus() of this set.
+    const std::vector<int>& inference_cpus() const { return inference_cpus_; }
+
+    bool uses_cuda() const { return device_.is_cuda(); }
+
+    // Floats preprocess() writes per image: a [3, 224, 224] CHW tensor.
+    static constexpr std::size_t input_floats() { return 3 * static_cast<std::size_t>(kInputSize) * kInputSize; }
+
+    // The per-image preprocessing extract_embeddings() runs, on its own (for benchmarks).
+    void preprocess(const cv::Mat& image, float* out) {
+        std::lock_guard<std::mutex> scratch(scratch_mutex_);
+        preprocess_image(image, out);
     }
     
     // Extract embedding from image
     std::vector<float> extract_embedding(const cv::Mat& image) {
-        torch::Tensor input = preprocess_image(image);
-        
-        std::vector<torch::jit::IValue> inputs;
-        inputs.emplace_back(std::move(input));
-        
-        torch::Tensor output = model_.forward(inputs).toTensor();
-        output = output.cpu();
-        
-        // Flatten if needed
-        if (output.dim() > 2) {
-            output = output.flatten(1);
+        auto embeddings = extract_embeddings({image}, 1);
+        return embeddings.empty() ? std::vector<float>{} : std::move(embeddings.front());
+    }
+
+    // Extract embeddings for several images, running one forward pass per batch of
+    // at most max_batch images. Results are returned in input order; `clock`
+    // (optional) receives the preprocess and forward timings.
+    std::vector<std::vector<float>> extract_embeddings(const std::vector<cv::Mat>& images,
+                                                       std::size_t max_batch = kDefaultBatchSize,
+                                                       StageClock* clock = nullptr) {
+        std::vector<std::vector<float>> embeddings;
+        embeddings.reserve(images.size());
+        max_batch = std::max<std::size_t>(1, max_batch);
+
+        std::lock_guard<std::mutex> scratch(scratch_mutex_);
+        torch::NoGradGuard no_grad;
+        // Pinned only for the duration of the call: in pam_lxfu this is the
+        // host process's thread. The intra-op workers libtorch starts from
+        // here inherit the mask and stay on the inference CPUs.
+        ScopedThreadAffinity affinity(inference_cpus_);
+        for (std::size_t start = 0; start < images.size(); start += max_batch) {
+            const std::size_t end = std::min(images.size(), start + max_batch);
+
+            const auto count = static_cast<int64_t>(end - start);
+            torch::Tensor& input = input_batch(count);
+            float* slot = input.data_ptr<float>();
+            const std::size_t slot_floats = 3 * static_cast<std::size_t>(kInputSize) * kInputSize;
+            {
+                StageTimer timer(clock, Stage::Preprocess);
+                for (std::size_t i = start; i < end; ++i) {
+                    preprocess_image(images[i], slot);
+                    slot += slot_floats;
+                }
+            }
+
+            torch::Tensor output;
+            {
+                StageTimer timer(clock, Stage::Forward);
+                output = forward_batch(input.narrow(0, 0, count));
+            }
+            const int64_t rows = output.size(0);
+            const int64_t dim = output.size(1);
+            feature_dim_ = static_cast<int>(dim);
+
+            const float* data = output.data_ptr<float>();
+            for (int64_t row = 0; row < rows; ++row) {
+                embeddings.emplace_back(data + row * dim, data + (row + 1) * dim);
+            }
         }
-        
-        // L2 normalize for cosine similarity
-        output = torch::nn::functional::normalize(output, 
-            torch::nn::functional::NormalizeFuncOptions().p(2).dim(1));
-        
-        // Convert to vector
-        float* data = output.data_ptr<float>();
-        int64_t size = output.size(1);
-        feature_dim_ = static_cast<int>(size);
 
-        return std::vector<float>(data, data + size);
+        return embeddings;
     }
 
     int embedding_dim() const { return feature_dim_; }
+
+    // Precision actually in use (fp16/bf16 fall back to fp32 without CUDA).
+    ModelPrecision precision() const { return precision_; }
 };
+
+// Hands memory freed by a destroyed FaceEngine back to the system. glibc
+// keeps freed weight and activation buffers in its arenas, and libtorch's
+// CUDA caching allocator keeps device blocks reserved; without this the
+// host process's RSS (and VRAM) stays at its peak after the model is gone.
+inline void release_cached_memory() {
+#ifdef LXFU_HAVE_CUDA_CACHE
+    if (torch::cuda::is_available()) {
+        c10::cuda::CUDACachingAllocator::emptyCache();
+    }
+#endif
+#ifdef __GLIBC__
+    ::malloc_trim(0);
+#endif
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "config.hpp"
+#include "face_auth.hpp"
+#include "face_engine.hpp"
+#include "metrics.hpp"
+
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Dynamic batching for lxfud. Every session hands its micro-batches of face
+// crops to one inference thread, which coalesces whatever is queued into a
+// single forward pass of up to max_batch crops. A pass starts as soon as it
+// is full, or when the oldest queued crop has waited max_wait_ms; a lone
+// request therefore waits at most max_wait_ms plus the pass that is already
+// running, and concurrent logins share passes instead of queueing behind
+// each other's.
+
+struct InferenceBatchSettings {
+    std::size_t max_batch = 32;
+    double max_wait_ms = 5.0;
+
+    static InferenceBatchSettings from_config(const Config& config) {
+        InferenceBatchSettings s;
+        s.max_batch = static_cast<std::size_t>(std::max(1, config.get_int("daemon_batch_size", static_cast<int>(s.max_batch))));
+        s.max_wait_ms = std::max(0.0, config.get_double("daemon_batch_wait_ms", s.max_wait_ms));
+        return s;
+    }
+};
+
+class InferenceScheduler : public Embedder {
+public:
+    InferenceScheduler(FaceEngine& engine, InferenceBatchSettings settings)
+        : engine_(engine), settings_(settings), thread_([this] { run(); }) {}
+
+    ~InferenceScheduler() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    InferenceScheduler(const InferenceScheduler&) = delete;
+    InferenceScheduler& operator=(const InferenceScheduler&) = delete;
+
+    // Blocks until the pass containing `images` has run. The wait for the
+    // pass goes to batch_wait in `clock`, and the pass's own preprocess and
+    // forward time to every request that shared it.
+    std::vector<std::vector<float>> embed(const std::vector<cv::Mat>& images, StageClock* clock) override {
+        if (images.empty()) {
+            return {};
+        }
+        Job job{images, clock, std::chrono::steady_clock::now(), {}};
+        auto result = job.result.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_images_ += job.images.size();
+            jobs_.push_back(std::move(job));
+        }
+        wake_.notify_all();
+        return result.get();
+    }
+
+    const std::vector<int>& inference_cpus() const override { return engine_.inference_cpus(); }
+
+private:
+    struct Job {
+        // Headers only; the pixels stay shared with the caller.
+        std::vector<cv::Mat> images;
+        StageClock* clock = nullptr;
+        std::chrono::steady_clock::time_point queued;
+        std::promise<std::vector<std::vector<float>>> result;
+    };
+
+    void run() {
+        std::vector<Job> batch;
+        std::vector<cv::Mat> images;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    return; // stopping and drained
+                }
+                const auto deadline = jobs_.front().queued + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                                 std::chrono::duration<double, std::milli>(settings_.max_wait_ms));
+                wake_.wait_until(lock, deadline, [this] { return stop_ || queued_images_ >= settings_.max_batch; });
+                // Whole jobs only, oldest first; a job larger than max_batch
+                // still goes alone (FaceEngine splits it into passes).
+                std::size_t taken = 0;
+                while (!jobs_.empty() &&
+                       (batch.empty() || taken + jobs_.front().images.size() <= settings_.max_batch)) {
+                    taken += jobs_.front().images.size();
+                    batch.push_back(std::move(jobs_.front()));
+                    jobs_.pop_front();
+                }
+                queued_images_ -= taken;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            images.clear();
+            for (const Job& job : batch) {
+                images.insert(images.end(), job.images.begin(), job.images.end());
+            }
+            StageClock pass;
+            std::vector<std::vector<float>> embeddings;
+            std::exception_ptr error;
+            try {
+                embeddings = engine_.extract_embeddings(images, settings_.max_batch, &pass);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            const StageTimings timings = pass.timings();
+
+            std::size_t offset = 0;
+            for (Job& job : batch) {
+                if (job.clock) {
+                    job.clock->add(Stage::BatchWait, start - job.queued);
+                    for (Stage stage : {Stage::Preprocess, Stage::Forward}) {
+                        if (timings.count(stage) > 0) {
+                            job.clock->add(stage, std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                      std::chrono::duration<double, std::milli>(timings.at(stage))));
+                        }
+                    }
+                }
+                if (error) {
+                    job.result.set_exception(error);
+                    continue;
+                }
+                std::vector<std::vector<float>> share;
+                share.reserve(job.images.size());
+                for (std::size_t i = 0; i < job.images.size(); ++i, ++offset) {
+                    share.push_back(offset < embeddings.size() ? std::move(embeddings[offset]) : std::vector<float>{});
+                }
+                job.result.set_value(std::move(share));
+            }
+            batch.clear();
+        }
+    }
+
+    FaceEngine& engine_;
+    InferenceBatchSettings settings_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Job> jobs_;
+    std::size_t queued_images_ = 0;
+    bool stop_ = false;
+
+    // Last, so the queue exists before the thread starts.
+    std::thread thread_;
+};
@@ -1,6 +1,16 @@
 #pragma once
 
+#include "ann_index.hpp"
+#include "config.hpp"
+#include "sample_selection.hpp"
+#include "similarity.hpp"
+
 #include <lmdb.h>
+#include <sys/stat.h>
+#include <cctype>
+#include <cmath>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <stdexcept>
@@ -8,6 +18,39 @@
 #include <filesystem>
 #include <utility>
 #include <cstdint>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+
+// How sample values are written (storage_format). Reads accept every encoding.
+enum class SampleEncoding : std::uint8_t { F32 = 0, F16 = 1, I8 = 2 };
+
+inline std::optional<SampleEncoding> parse_sample_encoding(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (value == "f32" || value == "fp32" || value == "float32") return SampleEncoding::F32;
+    if (value == "f16" || value == "fp16" || value == "float16") return SampleEncoding::F16;
+    if (value == "int8" || value == "i8") return SampleEncoding::I8;
+    return std::nullopt;
+}
+
+inline const char* sample_encoding_name(SampleEncoding encoding) {
+    switch (encoding) {
+        case SampleEncoding::F32: return "f32";
+        case SampleEncoding::F16: return "f16";
+        case SampleEncoding::I8: return "int8";
+    }
+    return "f32";
+}
+
+inline SampleEncoding sample_encoding_from_config(const Config& config) {
+    const std::string value = config.get("storage_format", "f32");
+    auto encoding = parse_sample_encoding(value);
+    if (!encoding) {
+        throw std::runtime_error("Unknown storage_format '" + value + "' (expected f32, f16 or int8)");
+    }
+    return *encoding;
+}
 
 class LMDBStore {
 public:
@@ -15,39 +58,219 @@ public:
     using Embedding = std::vector<float>;
     using EmbeddingList = std::vector<Embedding>;
 
+    // Samples of one stored value, read in place: `count` rows of `dim`
+    // elements. F32 rows are at `data`; F16 (IEEE half) and I8 rows at
+    // `packed`, I8 with one float scale per row at `scales`.
+    struct EmbeddingView {
+        const float* data = nullptr;
+        std::size_t count = 0;
+        std::size_t dim = 0;
+        SampleEncoding encoding = SampleEncoding::F32;
+        const void* packed = nullptr;
+        const float* scales = nullptr;
+
+        // F32 views only.
+        const float* row(std::size_t i) const { return data + i * dim; }
+
+        const std::uint16_t* half_row(std::size_t i) const {
+            return static_cast<const std::uint16_t*>(packed) + i * dim;
+        }
+
+        const std::int8_t* int8_row(std::size_t i) const {
+            return static_cast<const std::int8_t*>(packed) + i * dim;
+        }
+
+        // dot(query, row i), whatever the encoding.
+        float dot_row(const float* query, std::size_t i) const {
+            switch (encoding) {
+                case SampleEncoding::F16: return similarity::dot_f16(query, half_row(i), dim);
+                case SampleEncoding::I8: return similarity::dot_i8(query, int8_row(i), dim) * scales[i];
+                case SampleEncoding::F32: break;
+            }
+            return similarity::dot(query, row(i), dim);
+        }
+
+        void decode_row(std::size_t i, float* out) const {
+            switch (encoding) {
+                case SampleEncoding::F32:
+                    std::memcpy(out, row(i), dim * sizeof(float));
+                    break;
+                case SampleEncoding::F16:
+                    for (std::size_t d = 0; d < dim; ++d) {
+                        out[d] = similarity::half_to_float(half_row(i)[d]);
+                    }
+                    break;
+                case SampleEncoding::I8:
+                    for (std::size_t d = 0; d < dim; ++d) {
+                        out[d] = static_cast<float>(int8_row(i)[d]) * scales[i];
+                    }
+                    break;
+            }
+        }
+    };
+
+    struct AppendResult {
+        std::size_t added = 0;      // incoming samples now stored
+        std::size_t duplicates = 0; // incoming samples dropped as near-duplicates
+        std::size_t evicted = 0;    // samples dropped to respect the cap
+        std::size_t total = 0;      // profile's sample count afterwards
+    };
+
+    class Snapshot;
+
 private:
     MDB_env* env_;
     MDB_dbi dbi_;
     std::string db_path_;
     Mode mode_;
+    SampleEncoding encoding_ = SampleEncoding::F32;
 
-    static std::vector<std::uint8_t> serialize_embeddings(const EmbeddingList& embeddings) {
-        const std::int32_t count = static_cast<std::int32_t>(embeddings.size());
-        const std::int32_t dim = count > 0 ? static_cast<std::int32_t>(embeddings.front().size()) : 0;
+    // Identifies one saved ann.hnsw file: save() renames a fresh file into
+    // place, so a new inode or mtime means it was rewritten.
+    struct FileStamp {
+        ino_t inode = 0;
+        off_t size = 0;
+        std::int64_t mtime_ns = 0;
+
+        bool operator==(const FileStamp& other) const {
+            return inode == other.inode && size == other.size && mtime_ns == other.mtime_ns;
+        }
+    };
+
+    static std::optional<FileStamp> file_stamp(const std::string& path) {
+        struct stat st {};
+        if (::stat(path.c_str(), &st) != 0) {
+            return std::nullopt;
+        }
+        return FileStamp{st.st_ino, st.st_size,
+                         static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec};
+    }
 
-        std::size_t payload = sizeof(count) + sizeof(dim);
-        payload += static_cast<std::size_t>(count) * static_cast<std::size_t>(dim) * sizeof(float);
+    // Last loaded ANN index, shared by every snapshot with the same txn id, so
+    // repeated authentications do not re-read the file. Each version of the
+    // file is parsed once, even when it turns out stale or unreadable.
+    mutable std::mutex ann_cache_mutex_;
+    mutable std::shared_ptr<const ProfileAnnIndex> ann_cache_;
+    mutable std::optional<FileStamp> ann_cache_stamp_;
 
-        std::vector<std::uint8_t> buffer(payload);
-        std::size_t offset = 0;
+    // Value layouts, all native-endian:
+    //   legacy  int32 dim, dim floats (one sample)
+    //   v2      int32 count, int32 dim, count*dim floats
+    //   v3      int32 -3, uint8 encoding, 3 reserved bytes, int32 count,
+    //           int32 dim, then (int8 only) count float scales, then
+    //           count*dim elements of the encoding
+    // float32 is still written as v2 so older builds can read it.
+    static constexpr std::int32_t kFormatV3 = -3;
+    static constexpr std::size_t kV3HeaderBytes = 16;
 
-        std::memcpy(buffer.data() + offset, &count, sizeof(count));
-        offset += sizeof(count);
-        std::memcpy(buffer.data() + offset, &dim, sizeof(dim));
-        offset += sizeof(dim);
+    // tests/lxfu_tests.cpp round-trips the value codecs below without a database.
+    friend struct LMDBStoreCodecAccess;
 
+    static std::vector<std::uint8_t> serialize_embeddings(const EmbeddingList& embeddings,
+                                                          SampleEncoding encoding = SampleEncoding::F32) {
+        const std::int32_t count = static_cast<std::int32_t>(embeddings.size());
+        const std::int32_t dim = count > 0 ? static_cast<std::int32_t>(embeddings.front().size()) : 0;
         for (const auto& embedding : embeddings) {
             if (static_cast<std::int32_t>(embedding.size()) != dim) {
                 throw std::runtime_error("Inconsistent embedding dimension for serialization");
             }
-            std::memcpy(buffer.data() + offset, embedding.data(), embedding.size() * sizeof(float));
-            offset += embedding.size() * sizeof(float);
         }
+        const std::size_t elements = static_cast<std::size_t>(count) * static_cast<std::size_t>(dim);
 
+        if (encoding == SampleEncoding::F32) {
+            std::vector<std::uint8_t> buffer(sizeof(count) + sizeof(dim) + elements * sizeof(float));
+            std::size_t offset = 0;
+            std::memcpy(buffer.data() + offset, &count, sizeof(count));
+            offset += sizeof(count);
+            std::memcpy(buffer.data() + offset, &dim, sizeof(dim));
+            offset += sizeof(dim);
+            for (const auto& embedding : embeddings) {
+                std::memcpy(buffer.data() + offset, embedding.data(), embedding.size() * sizeof(float));
+                offset += embedding.size() * sizeof(float);
+            }
+            return buffer;
+        }
+
+        const bool int8 = encoding == SampleEncoding::I8;
+        std::vector<std::uint8_t> buffer(kV3HeaderBytes + (int8 ? count * sizeof(float) + elements
+                                                                : elements * sizeof(std::uint16_t)));
+        std::memcpy(buffer.data(), &kFormatV3, sizeof(kFormatV3));
+        buffer[4] = static_cast<std::uint8_t>(encoding);
+        std::memcpy(buffer.data() + 8, &count, sizeof(count));
+        std::memcpy(buffer.data() + 12, &dim, sizeof(dim));
+        std::uint8_t* out = buffer.data() + kV3HeaderBytes;
+
+        if (int8) {
+            // Symmetric per-sample scale: the largest magnitude maps to 127.
+            std::uint8_t* codes = out + count * sizeof(float);
+            for (const auto& embedding : embeddings) {
+                float peak = 0.0f;
+                for (float v : embedding) {
+                    peak = std::max(peak, std::fabs(v));
+                }
+                const float scale = peak > 0.0f ? peak / 127.0f : 1.0f;
+                std::memcpy(out, &scale, sizeof(scale));
+                out += sizeof(scale);
+                for (float v : embedding) {
+                    long code = std::lround(v / scale);
+                    *codes++ = static_cast<std::uint8_t>(static_cast<std::int8_t>(std::clamp(code, -127L, 127L)));
+                }
+            }
+        } else {
+            for (const auto& embedding : embeddings) {
+                for (float v : embedding) {
+                    std::uint16_t half = similarity::float_to_half(v);
+                    std::memcpy(out, &half, sizeof(half));
+                    out += sizeof(half);
+                }
+            }
+        }
         return buffer;
     }
 
-    static EmbeddingList deserialize_embeddings(const MDB_val& value) {
+    static EmbeddingView parse_v3(const MDB_val& value) {
+        const std::uint8_t* data = static_cast<const std::uint8_t*>(value.mv_data);
+        if (value.mv_size < kV3HeaderBytes) {
+            throw std::runtime_error("LMDB value too small for v3 embedding header");
+        }
+        std::int32_t count = 0;
+        std::int32_t dim = 0;
+        std::memcpy(&count, data + 8, sizeof(count));
+        std::memcpy(&dim, data + 12, sizeof(dim));
+        if (count <= 0 || dim <= 0 || data[4] > static_cast<std::uint8_t>(SampleEncoding::I8)) {
+            throw std::runtime_error("Invalid v3 embedding header");
+        }
+        EmbeddingView view;
+        view.count = static_cast<std::size_t>(count);
+        view.dim = static_cast<std::size_t>(dim);
+        view.encoding = static_cast<SampleEncoding>(data[4]);
+        const std::size_t elements = view.count * view.dim;
+        const std::uint8_t* payload = data + kV3HeaderBytes;
+        std::size_t expected = kV3HeaderBytes;
+        switch (view.encoding) {
+            case SampleEncoding::F32:
+                expected += elements * sizeof(float);
+                view.data = reinterpret_cast<const float*>(payload);
+                break;
+            case SampleEncoding::F16:
+                expected += elements * sizeof(std::uint16_t);
+                view.packed = payload;
+                break;
+            case SampleEncoding::I8:
+                expected += view.count * sizeof(float) + elements;
+                view.scales = reinterpret_cast<const float*>(payload);
+                view.packed = payload + view.count * sizeof(float);
+                break;
+        }
+        if (expected != value.mv_size) {
+            throw std::runtime_error("LMDB embedding payload size mismatch");
+        }
+        return view;
+    }
+
+    // Locate the float payload of a stored value without copying it. The pointer
+    // may not be float-aligned; see align_view().
+    static EmbeddingView parse_embeddings(const MDB_val& value) {
         if (value.mv_size < sizeof(std::int32_t)) {
             throw std::runtime_error("LMDB value too small to contain embedding metadata");
         }
@@ -55,6 +278,9 @@ private:
         const std::uint8_t* data = static_cast<const std::uint8_t*>(value.mv_data);
         std::int32_t first = 0;
         std::memcpy(&first, data, sizeof(first));
+        if (first == kFormatV3) {
+            return parse_v3(value);
+        }
 
         if (value.mv_size >= 2 * sizeof(std::int32_t)) {
             std::int32_t second = 0;
@@ -63,12 +289,8 @@ private:
                 std::size_t expected = sizeof(std::int32_t) * 2 +
                     static_cast<std::size_t>(first) * static_cast<std::size_t>(second) * sizeof(float);
                 if (expected == value.mv_size) {
-                    EmbeddingList embeddings(static_cast<std::size_t>(first), Embedding(static_cast<std::size_t>(second)));
-                    const float* payload = reinterpret_cast<const float*>(data + sizeof(std::int32_t) * 2);
-                    for (std::int32_t i = 0; i < first; ++i) {
-                        std::copy(payload + i * second, payload + (i + 1) * second, embeddings[static_cast<std::size_t>(i)].begin());
-                    }
-                    return embeddings;
+                    return {reinterpret_cast<const float*>(data + sizeof(std::int32_t) * 2),
+                            static_cast<std::size_t>(first), static_cast<std::size_t>(second)};
                 }
             }
         }
@@ -82,24 +304,357 @@ private:
         if (expected_old != value.mv_size) {
             throw std::runtime_error("LMDB embedding payload size mismatch");
         }
-        EmbeddingList embeddings;
-        embeddings.emplace_back(static_cast<std::size_t>(dim));
-        const float* payload = reinterpret_cast<const float*>(data + sizeof(std::int32_t));
-        std::copy(payload, payload + dim, embeddings.front().begin());
-        return embeddings;
+        return {reinterpret_cast<const float*>(data + sizeof(std::int32_t)), 1, static_cast<std::size_t>(dim)};
     }
 
-    EmbeddingList fetch_embeddings_for_key(MDB_txn* txn, MDB_val& key) const {
-        EmbeddingList embeddings;
-        MDB_val existing_value;
-        int rc = mdb_get(txn, dbi_, &key, &existing_value);
-        if (rc == MDB_NOTFOUND) {
-            return embeddings;
+    // Values large enough to live on overflow pages are page-aligned, but small
+    // ones sit right after their key inside a leaf node and can start at any
+    // even address. Those are copied into `scratch` so callers always get
+    // aligned float (or half) pointers.
+    static EmbeddingView align_view(EmbeddingView view, std::vector<float>& scratch) {
+        auto misaligned = [](const void* p, std::size_t alignment) {
+            return reinterpret_cast<std::uintptr_t>(p) % alignment != 0;
+        };
+        switch (view.encoding) {
+            case SampleEncoding::F32:
+                if (misaligned(view.data, alignof(float))) {
+                    scratch.resize(view.count * view.dim);
+                    std::memcpy(scratch.data(), view.data, scratch.size() * sizeof(float));
+                    view.data = scratch.data();
+                }
+                break;
+            case SampleEncoding::F16:
+                if (misaligned(view.packed, alignof(std::uint16_t))) {
+                    const std::size_t bytes = view.count * view.dim * sizeof(std::uint16_t);
+                    scratch.resize((bytes + sizeof(float) - 1) / sizeof(float));
+                    std::memcpy(scratch.data(), view.packed, bytes);
+                    view.packed = scratch.data();
+                }
+                break;
+            case SampleEncoding::I8:
+                if (misaligned(view.scales, alignof(float))) {
+                    scratch.resize(view.count);
+                    std::memcpy(scratch.data(), view.scales, view.count * sizeof(float));
+                    view.scales = scratch.data();
+                }
+                break;
+        }
+        return view;
+    }
+
+    // A mean view holds one row whatever its `count`.
+    static EmbeddingView align_mean(EmbeddingView view, std::vector<float>& scratch) {
+        if (reinterpret_cast<std::uintptr_t>(view.data) % alignof(float) == 0) {
+            return view;
         }
+        scratch.resize(view.dim);
+        std::memcpy(scratch.data(), view.data, view.dim * sizeof(float));
+        view.data = scratch.data();
+        return view;
+    }
+
+    void put_value(MDB_txn* txn, const std::string& key_bytes, const std::vector<std::uint8_t>& bytes,
+                   const char* what, unsigned int flags = 0) {
+        MDB_val key;
+        key.mv_size = key_bytes.size();
+        key.mv_data = const_cast<char*>(key_bytes.data());
+        MDB_val val;
+        val.mv_size = bytes.size();
+        val.mv_data = const_cast<std::uint8_t*>(bytes.data());
+        int rc = mdb_put(txn, dbi_, &key, &val, flags);
         if (rc != 0) {
-            throw std::runtime_error("Failed to read existing embedding: " + std::string(mdb_strerror(rc)));
+            throw std::runtime_error(std::string(what) + ": " + mdb_strerror(rc));
+        }
+    }
+
+    static void append_view(EmbeddingList& embeddings, const EmbeddingView& view) {
+        embeddings.reserve(embeddings.size() + view.count);
+        for (std::size_t i = 0; i < view.count; ++i) {
+            embeddings.emplace_back(view.dim);
+            view.decode_row(i, embeddings.back().data());
+        }
+    }
+
+    // A profile owns the key "<name>" (legacy and compacted samples) plus
+    // sub-keys "<name>\0<tag>...". Each appended batch of samples is its own
+    // segment "<name>\0s<seq>" (8-byte big-endian sequence), so enrolling new
+    // samples never rewrites existing values. NUL sorts before any other byte,
+    // which keeps every key of a profile adjacent in LMDB's key order.
+    //
+    // "<name>\0m" caches the mean of all the profile's samples (same layout as
+    // a sample value: count of samples summarised, dim, then the mean). It is
+    // rewritten by every append; profiles enrolled before it existed have none
+    // until their next enroll.
+    static constexpr char kSubkeySeparator = '\0';
+    static constexpr char kSegmentTag = 's';
+    static constexpr char kMeanTag = 'm';
+    static constexpr std::size_t kSegmentSeqBytes = 8;
+
+    static std::string_view key_view(const MDB_val& key) {
+        return std::string_view(static_cast<const char*>(key.mv_data), key.mv_size);
+    }
+
+    static std::string_view profile_name(const MDB_val& key) {
+        std::string_view view = key_view(key);
+        return view.substr(0, view.find(kSubkeySeparator));
+    }
+
+    static bool is_segment_key(const MDB_val& key, std::string_view name) {
+        return key.mv_size == name.size() + 2 + kSegmentSeqBytes &&
+               key_view(key)[name.size() + 1] == kSegmentTag;
+    }
+
+    // True for values holding samples: the base key or a segment.
+    static bool is_sample_key(const MDB_val& key) {
+        std::string_view name = profile_name(key);
+        return key.mv_size == name.size() || is_segment_key(key, name);
+    }
+
+    static bool is_mean_key(const MDB_val& key) {
+        std::string_view name = profile_name(key);
+        return key.mv_size == name.size() + 2 && key_view(key)[name.size() + 1] == kMeanTag;
+    }
+
+    static std::string mean_key(const std::string& name) {
+        std::string key = name;
+        key += kSubkeySeparator;
+        key += kMeanTag;
+        return key;
+    }
+
+    static std::vector<std::uint8_t> serialize_mean(const std::vector<double>& sum, std::size_t count) {
+        const auto samples = static_cast<std::int32_t>(count);
+        const auto dim = static_cast<std::int32_t>(sum.size());
+        std::vector<std::uint8_t> buffer(sizeof(samples) + sizeof(dim) + sum.size() * sizeof(float));
+        std::memcpy(buffer.data(), &samples, sizeof(samples));
+        std::memcpy(buffer.data() + sizeof(samples), &dim, sizeof(dim));
+        auto* out = buffer.data() + sizeof(samples) + sizeof(dim);
+        for (std::size_t i = 0; i < sum.size(); ++i) {
+            float mean = static_cast<float>(sum[i] / static_cast<double>(count));
+            std::memcpy(out + i * sizeof(float), &mean, sizeof(float));
+        }
+        return buffer;
+    }
+
+    // `count` of the view is the number of samples the mean summarises.
+    static EmbeddingView parse_mean(const MDB_val& value) {
+        std::int32_t header[2] = {0, 0};
+        if (value.mv_size >= sizeof(header)) {
+            std::memcpy(header, value.mv_data, sizeof(header));
+        }
+        if (header[0] <= 0 || header[1] <= 0 ||
+            value.mv_size != sizeof(header) + static_cast<std::size_t>(header[1]) * sizeof(float)) {
+            throw std::runtime_error("Invalid profile mean stored in LMDB");
+        }
+        // The view's row is the single mean vector; count carries the sample total.
+        return {reinterpret_cast<const float*>(static_cast<const std::uint8_t*>(value.mv_data) + sizeof(header)),
+                static_cast<std::size_t>(header[0]), static_cast<std::size_t>(header[1])};
+    }
+
+    static std::uint64_t segment_seq(const MDB_val& key) {
+        const auto* bytes = static_cast<const std::uint8_t*>(key.mv_data) + key.mv_size - kSegmentSeqBytes;
+        std::uint64_t seq = 0;
+        for (std::size_t i = 0; i < kSegmentSeqBytes; ++i) {
+            seq = (seq << 8) | bytes[i];
+        }
+        return seq;
+    }
+
+    static std::string segment_key(const std::string& name, std::uint64_t seq) {
+        std::string key = name;
+        key += kSubkeySeparator;
+        key += kSegmentTag;
+        for (std::size_t i = kSegmentSeqBytes; i-- > 0;) {
+            key += static_cast<char>((seq >> (i * 8)) & 0xff);
+        }
+        return key;
+    }
+
+    // Visit every key/value of the profile `name`, in key order.
+    template <typename Fn>
+    static void for_each_profile_entry(MDB_txn* txn, MDB_dbi dbi, const std::string& name, Fn&& fn) {
+        MDB_cursor* cursor = nullptr;
+        int rc = mdb_cursor_open(txn, dbi, &cursor);
+        if (rc != 0) {
+            throw std::runtime_error("Failed to open LMDB cursor: " + std::string(mdb_strerror(rc)));
+        }
+
+        try {
+            MDB_val key;
+            key.mv_size = name.size();
+            key.mv_data = const_cast<char*>(name.data());
+            MDB_val val;
+            rc = mdb_cursor_get(cursor, &key, &val, MDB_SET_RANGE);
+            while (rc == 0 && profile_name(key) == name) {
+                fn(cursor, key, val);
+                rc = mdb_cursor_get(cursor, &key, &val, MDB_NEXT);
+            }
+        } catch (...) {
+            mdb_cursor_close(cursor);
+            throw;
+        }
+        mdb_cursor_close(cursor);
+
+        if (rc != 0 && rc != MDB_NOTFOUND) {
+            throw std::runtime_error("Failed while iterating LMDB: " + std::string(mdb_strerror(rc)));
+        }
+    }
+
+    // Visit every key/value in the database, in key order.
+    template <typename Fn>
+    static void for_each_entry(MDB_txn* txn, MDB_dbi dbi, Fn&& fn) {
+        MDB_cursor* cursor = nullptr;
+        int rc = mdb_cursor_open(txn, dbi, &cursor);
+        if (rc != 0) {
+            throw std::runtime_error("Failed to open LMDB cursor: " + std::string(mdb_strerror(rc)));
+        }
+
+        try {
+            MDB_val key, val;
+            rc = mdb_cursor_get(cursor, &key, &val, MDB_FIRST);
+            while (rc == 0) {
+                fn(key, val);
+                rc = mdb_cursor_get(cursor, &key, &val, MDB_NEXT);
+            }
+        } catch (...) {
+            mdb_cursor_close(cursor);
+            throw;
+        }
+        mdb_cursor_close(cursor);
+
+        if (rc != MDB_NOTFOUND) {
+            throw std::runtime_error("Failed while iterating LMDB: " + std::string(mdb_strerror(rc)));
+        }
+    }
+
+    // The ANN index exists only once built (`lxfu ann build` or enroll with
+    // ann_enabled); from then on every committed write keeps it current.
+    // Incremental updates apply only when the index reflects the transaction
+    // just before ours; otherwise, or once too many tombstones pile up, it is
+    // rebuilt from a fresh snapshot.
+    static constexpr double kAnnRebuildDeletedFraction = 0.3;
+
+    template <typename Update>
+    void sync_ann_index(std::uint64_t txn_id, Update&& update) {
+        if (!has_ann_index()) {
+            return;
+        }
+        try {
+            auto index = ProfileAnnIndex::load(ann_index_path());
+            if (index && index->txn_id() + 1 == txn_id &&
+                index->deleted_fraction() < kAnnRebuildDeletedFraction && update(*index)) {
+                index->set_txn_id(txn_id);
+                index->save(ann_index_path());
+            } else {
+                build_ann_index(index ? index->build_settings() : AnnSettings{});
+            }
+        } catch (const std::exception&) {
+            // Readers ignore a stale index, but drop it so it is not trusted later.
+            drop_ann_index();
+        }
+    }
+
+    // Samples an append wrote, replayed into the ANN index after commit.
+    struct StoredSamples {
+        EmbeddingList samples; // the whole profile when compacted
+        bool compacted = false;
+    };
+
+    AppendResult append_in_txn(MDB_txn* txn, const std::string& name, const EmbeddingList& embeddings,
+                               const SampleLimits& limits, StoredSamples& stored) {
+        AppendResult result;
+        EmbeddingList incoming;
+        std::size_t existing = 0;
+        std::size_t dim = 0;
+        std::uint64_t last_seq = 0;
+        // The mean is recomputed from every sample, which also backfills
+        // profiles that predate it.
+        std::vector<double> sum;
+        std::vector<float> scratch;
+        std::vector<float> decoded;
+        EmbeddingList existing_samples;
+        for_each_profile_entry(txn, dbi_, name, [&](MDB_cursor*, const MDB_val& key, const MDB_val& val) {
+            if (is_segment_key(key, name)) {
+                last_seq = std::max(last_seq, segment_seq(key));
+            } else if (key.mv_size != name.size()) {
+                return;
+            }
+            EmbeddingView view = align_view(parse_embeddings(val), scratch);
+            if (existing > 0 && view.dim != dim) {
+                throw std::runtime_error("Inconsistent embedding dimension within profile '" + name + "'");
+            }
+            existing += view.count;
+            dim = view.dim;
+            sum.resize(dim, 0.0);
+            decoded.resize(dim);
+            for (std::size_t i = 0; i < view.count; ++i) {
+                view.decode_row(i, decoded.data());
+                for (std::size_t d = 0; d < dim; ++d) {
+                    sum[d] += decoded[d];
+                }
+            }
+            if (limits.active()) {
+                append_view(existing_samples, view);
+            }
+        });
+
+        result.total = existing;
+        if (embeddings.empty()) {
+            return result;
+        }
+        if (existing > 0 && dim != embeddings.front().size()) {
+            throw std::runtime_error("Embedding dimension mismatch while appending to existing profile");
+        }
+        dim = embeddings.front().size();
+
+        for (std::size_t i : deduplicate_samples(existing_samples, embeddings, limits.dedup_threshold)) {
+            incoming.push_back(embeddings[i]);
+        }
+        result.duplicates = embeddings.size() - incoming.size();
+        if (incoming.empty()) {
+            return result;
+        }
+
+        stored.compacted = limits.max_samples > 0 && existing + incoming.size() > limits.max_samples;
+        if (stored.compacted) {
+            EmbeddingList& kept = stored.samples;
+            EmbeddingList all = std::move(existing_samples);
+            all.insert(all.end(), incoming.begin(), incoming.end());
+            for (std::size_t i : farthest_point_selection(all, limits.max_samples)) {
+                result.added += i >= existing ? 1 : 0;
+                kept.push_back(std::move(all[i]));
+            }
+            result.evicted = all.size() - kept.size();
+            result.total = kept.size();
+
+            for_each_profile_entry(txn, dbi_, name, [&](MDB_cursor* cursor, const MDB_val&, const MDB_val&) {
+                int del_rc = mdb_cursor_del(cursor, 0);
+                if (del_rc != 0) {
+                    throw std::runtime_error("Failed to compact profile: " + std::string(mdb_strerror(del_rc)));
+                }
+            });
+            put_value(txn, name, serialize_embeddings(kept, encoding_), "Failed to store embedding");
+            sum.assign(dim, 0.0);
+            for (const auto& embedding : kept) {
+                for (std::size_t d = 0; d < dim; ++d) {
+                    sum[d] += embedding[d];
+                }
+            }
+        } else {
+            put_value(txn, segment_key(name, last_seq + 1), serialize_embeddings(incoming, encoding_),
+                      "Failed to store embedding", MDB_NOOVERWRITE);
+            sum.resize(incoming.front().size(), 0.0);
+            for (const auto& embedding : incoming) {
+                for (std::size_t d = 0; d < embedding.size(); ++d) {
+                    sum[d] += embedding[d];
+                }
+            }
+            result.added = incoming.size();
+            result.total = existing + incoming.size();
+            stored.samples = std::move(incoming);
         }
-        return deserialize_embeddings(existing_value);
+        put_value(txn, mean_key(name), serialize_mean(sum, result.total), "Failed to store profile mean");
+        return result;
     }
 
 public:
@@ -151,103 +706,97 @@ public:
         }
     }
 
-    std::size_t store_embedding(const std::string& name, const Embedding& embedding) {
-        if (mode_ == Mode::ReadOnly) {
-            throw std::runtime_error("Attempted to write to LMDB opened read-only");
-        }
-        MDB_txn* txn = nullptr;
-        int rc = mdb_txn_begin(env_, nullptr, 0, &txn);
-        if (rc != 0) {
-            throw std::runtime_error("Failed to begin transaction: " + std::string(mdb_strerror(rc)));
-        }
+    // Encoding for values written from now on; existing values keep theirs
+    // until the profile is compacted.
+    void set_sample_encoding(SampleEncoding encoding) { encoding_ = encoding; }
+    SampleEncoding sample_encoding() const { return encoding_; }
 
-        MDB_val key;
-        key.mv_size = name.size();
-        key.mv_data = const_cast<char*>(name.data());
-
-        EmbeddingList embeddings = fetch_embeddings_for_key(txn, key);
-        if (!embeddings.empty() && embeddings.front().size() != embedding.size()) {
-            mdb_txn_abort(txn);
-            throw std::runtime_error("Embedding dimension mismatch while appending to existing profile");
-        }
-        embeddings.push_back(embedding);
+    // Read-only view of the database that keeps one read transaction open.
+    Snapshot snapshot() const;
 
-        auto buffer = serialize_embeddings(embeddings);
-        MDB_val val;
-        val.mv_size = buffer.size();
-        val.mv_data = buffer.data();
-
-        rc = mdb_put(txn, dbi_, &key, &val, 0);
-        if (rc != 0) {
-            mdb_txn_abort(txn);
-            throw std::runtime_error("Failed to store embedding: " + std::string(mdb_strerror(rc)));
-        }
+    // Visit every profile in place: fn(std::string_view name, const EmbeddingView& samples).
+    template <typename Fn>
+    void for_each_profile(Fn&& fn) const;
 
-        mdb_txn_commit(txn);
-        return embeddings.size();
+    std::size_t store_embedding(const std::string& name, const Embedding& embedding) {
+        return store_embeddings(name, EmbeddingList{embedding});
     }
 
-    std::vector<std::pair<std::string, EmbeddingList>> get_all_embeddings() const {
-        MDB_txn* txn = nullptr;
-        int rc = mdb_txn_begin(env_, nullptr, MDB_RDONLY, &txn);
-        if (rc != 0) {
-            throw std::runtime_error("Failed to begin read transaction: " + std::string(mdb_strerror(rc)));
-        }
+    // Append a batch of samples to `name` as one new segment, in one transaction.
+    // Existing values are left untouched. Returns the profile's total sample count.
+    std::size_t store_embeddings(const std::string& name, const EmbeddingList& embeddings) {
+        return append_samples(name, embeddings, SampleLimits::none()).total;
+    }
 
-        MDB_cursor* cursor = nullptr;
-        rc = mdb_cursor_open(txn, dbi_, &cursor);
-        if (rc != 0) {
-            mdb_txn_abort(txn);
-            throw std::runtime_error("Failed to open LMDB cursor: " + std::string(mdb_strerror(rc)));
-        }
+    // Like store_embeddings(), but first drops incoming near-duplicates of
+    // samples already kept. If the profile would then exceed the cap, its
+    // samples are reduced by farthest-point selection and rewritten as a single
+    // compacted value under the base key. All in one transaction.
+    AppendResult append_samples(const std::string& name, const EmbeddingList& embeddings, const SampleLimits& limits) {
+        return append_profiles({{name, embeddings}}, limits).front();
+    }
 
-        std::vector<std::pair<std::string, EmbeddingList>> entries;
-        MDB_val key, val;
-        rc = mdb_cursor_get(cursor, &key, &val, MDB_FIRST);
-        while (rc == 0) {
-            std::string name(static_cast<char*>(key.mv_data), key.mv_size);
-            entries.emplace_back(name, deserialize_embeddings(val));
-            rc = mdb_cursor_get(cursor, &key, &val, MDB_NEXT);
+    // append_samples() for several profiles in a single transaction (bulk
+    // enrollment, import). Results are in input order.
+    std::vector<AppendResult> append_profiles(const std::vector<std::pair<std::string, EmbeddingList>>& batch,
+                                              const SampleLimits& limits) {
+        if (mode_ == Mode::ReadOnly) {
+            throw std::runtime_error("Attempted to write to LMDB opened read-only");
         }
-
-        if (rc != MDB_NOTFOUND) {
-            mdb_cursor_close(cursor);
-            mdb_txn_abort(txn);
-            throw std::runtime_error("Failed while iterating LMDB: " + std::string(mdb_strerror(rc)));
+        for (const auto& entry : batch) {
+            if (entry.first.find(kSubkeySeparator) != std::string::npos) {
+                throw std::runtime_error("Profile name must not contain NUL characters");
+            }
         }
 
-        mdb_cursor_close(cursor);
-        mdb_txn_abort(txn);
-        return entries;
-    }
-
-    EmbeddingList get_embeddings(const std::string& name) const {
         MDB_txn* txn = nullptr;
-        int rc = mdb_txn_begin(env_, nullptr, MDB_RDONLY, &txn);
+        int rc = mdb_txn_begin(env_, nullptr, 0, &txn);
         if (rc != 0) {
-            throw std::runtime_error("Failed to begin read transaction: " + std::string(mdb_strerror(rc)));
+            throw std::runtime_error("Failed to begin transaction: " + std::string(mdb_strerror(rc)));
         }
 
-        MDB_val key;
-        key.mv_size = name.size();
-        key.mv_data = const_cast<char*>(name.data());
-
-        MDB_val value;
-        rc = mdb_get(txn, dbi_, &key, &value);
-        if (rc == MDB_NOTFOUND) {
+        std::vector<AppendResult> results;
+        std::vector<StoredSamples> stored(batch.size());
+        bool wrote = false;
+        try {
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                results.push_back(append_in_txn(txn, batch[i].first, batch[i].second, limits, stored[i]));
+                wrote = wrote || results.back().added > 0 || stored[i].compacted;
+            }
+        } catch (...) {
             mdb_txn_abort(txn);
-            return {};
+            throw;
         }
-        if (rc != 0) {
+        if (!wrote) {
             mdb_txn_abort(txn);
-            throw std::runtime_error("Failed to read embeddings: " + std::string(mdb_strerror(rc)));
+            return results;
         }
 
-        EmbeddingList result = deserialize_embeddings(value);
-        mdb_txn_abort(txn);
-        return result;
+        const std::uint64_t txn_id = mdb_txn_id(txn);
+        rc = mdb_txn_commit(txn);
+        if (rc != 0) {
+            throw std::runtime_error("Failed to commit embeddings: " + std::string(mdb_strerror(rc)));
+        }
+        sync_ann_index(txn_id, [&](ProfileAnnIndex& index) {
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                if (stored[i].compacted) {
+                    index.remove_profile(batch[i].first);
+                }
+                for (const auto& embedding : stored[i].samples) {
+                    if (!index.add_samples(batch[i].first, embedding.data(), 1, embedding.size(), embedding.size())) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        });
+        return results;
     }
 
+    std::vector<std::pair<std::string, EmbeddingList>> get_all_embeddings() const;
+    EmbeddingList get_embeddings(const std::string& name) const;
+
+    // Remove the profile's base key and every sub-key (segments, metadata).
     bool delete_embedding(const std::string& name) {
         if (mode_ == Mode::ReadOnly) {
             throw std::runtime_error("Attempted to delete from LMDB opened read-only");
@@ -258,21 +807,34 @@ public:
             throw std::runtime_error("Failed to begin transaction: " + std::string(mdb_strerror(rc)));
         }
 
-        MDB_val key;
-        key.mv_size = name.size();
-        key.mv_data = const_cast<char*>(name.data());
+        std::size_t removed = 0;
+        try {
+            for_each_profile_entry(txn, dbi_, name, [&](MDB_cursor* cursor, const MDB_val&, const MDB_val&) {
+                int del_rc = mdb_cursor_del(cursor, 0);
+                if (del_rc != 0) {
+                    throw std::runtime_error("Failed to delete embedding: " + std::string(mdb_strerror(del_rc)));
+                }
+                ++removed;
+            });
+        } catch (...) {
+            mdb_txn_abort(txn);
+            throw;
+        }
 
-        rc = mdb_del(txn, dbi_, &key, nullptr);
-        if (rc == MDB_NOTFOUND) {
+        if (removed == 0) {
             mdb_txn_abort(txn);
             return false;
         }
+
+        const std::uint64_t txn_id = mdb_txn_id(txn);
+        rc = mdb_txn_commit(txn);
         if (rc != 0) {
-            mdb_txn_abort(txn);
-            throw std::runtime_error("Failed to delete embedding: " + std::string(mdb_strerror(rc)));
+            throw std::runtime_error("Failed to commit delete: " + std::string(mdb_strerror(rc)));
         }
-
-        mdb_txn_commit(txn);
+        sync_ann_index(txn_id, [&](ProfileAnnIndex& index) {
+            index.remove_profile(name);
+            return true;
+        });
         return true;
     }
 
@@ -292,21 +854,228 @@ public:
             throw std::runtime_error("Failed to drop LMDB database: " + std::string(mdb_strerror(rc)));
         }
 
+        const std::uint64_t txn_id = mdb_txn_id(txn);
         mdb_txn_commit(txn);
+        sync_ann_index(txn_id, [](ProfileAnnIndex&) { return false; });
     }
 
+    std::string ann_index_path() const { return db_path_ + "/" + ProfileAnnIndex::kFileName; }
+
+    bool has_ann_index() const { return std::filesystem::exists(ann_index_path()); }
+
+    // Build the index from the current contents and save it beside the environment.
+    ProfileAnnIndex build_ann_index(const AnnSettings& settings);
+
+    void drop_ann_index() {
+        std::error_code ec;
+        std::filesystem::remove(ann_index_path(), ec);
+    }
+
+    // The saved index, but only if it reflects exactly this snapshot. The file
+    // is parsed once per (txn id, file) and shared until either changes.
+    std::shared_ptr<const ProfileAnnIndex> load_ann_index(const Snapshot& snapshot) const;
+
+    // Number of distinct profiles (a profile may span several keys).
     std::size_t size() const {
         MDB_txn* txn = nullptr;
         int rc = mdb_txn_begin(env_, nullptr, MDB_RDONLY, &txn);
         if (rc != 0) {
             return 0;
         }
-        MDB_stat stat{};
-        rc = mdb_stat(txn, dbi_, &stat);
+        std::size_t profiles = 0;
+        try {
+            std::string_view last;
+            bool first = true;
+            for_each_entry(txn, dbi_, [&](const MDB_val& key, const MDB_val&) {
+                std::string_view name = profile_name(key);
+                if (first || name != last) {
+                    ++profiles;
+                    last = name;
+                    first = false;
+                }
+            });
+        } catch (const std::exception&) {
+            mdb_txn_abort(txn);
+            return 0;
+        }
         mdb_txn_abort(txn);
+        return profiles;
+    }
+};
+
+// Holds a read transaction so views point straight into the memory map.
+// Views and names passed to callbacks are only valid for the duration of the call.
+class LMDBStore::Snapshot {
+public:
+    explicit Snapshot(const LMDBStore& store) : dbi_(store.dbi_) {
+        int rc = mdb_txn_begin(store.env_, nullptr, MDB_RDONLY, &txn_);
         if (rc != 0) {
-            return 0;
+            throw std::runtime_error("Failed to begin read transaction: " + std::string(mdb_strerror(rc)));
+        }
+    }
+
+    ~Snapshot() {
+        if (txn_) {
+            mdb_txn_abort(txn_);
+        }
+    }
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // LMDB transaction id this snapshot reads.
+    std::uint64_t txn_id() const { return mdb_txn_id(txn_); }
+
+    bool empty() const {
+        MDB_stat stat{};
+        int rc = mdb_stat(txn_, dbi_, &stat);
+        if (rc != 0) {
+            throw std::runtime_error("Failed to stat LMDB database: " + std::string(mdb_strerror(rc)));
         }
-        return static_cast<std::size_t>(stat.ms_entries);
+        return stat.ms_entries == 0;
     }
+
+    // fn(std::string_view name, const EmbeddingView& samples) for every block of
+    // samples. A profile stored as several segments is delivered as consecutive
+    // calls with the same name.
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for_each_entry(txn_, dbi_, [&](const MDB_val& key, const MDB_val& val) {
+            if (is_sample_key(key)) {
+                fn(profile_name(key), align_view(parse_embeddings(val), scratch_));
+            }
+        });
+    }
+
+    // fn(std::string_view name, const EmbeddingView* mean) once per profile, in
+    // key order. `mean` is one row whose `count` is the number of samples it
+    // covers, or null when the profile has no cached mean yet.
+    template <typename Fn>
+    void for_each_mean(Fn&& fn) const {
+        std::string current;
+        bool has_current = false;
+        bool delivered = false;
+        auto finish = [&]() {
+            if (has_current && !delivered) {
+                fn(std::string_view(current), static_cast<const EmbeddingView*>(nullptr));
+            }
+        };
+        for_each_entry(txn_, dbi_, [&](const MDB_val& key, const MDB_val& val) {
+            std::string_view name = profile_name(key);
+            if (!has_current || name != current) {
+                finish();
+                current.assign(name.data(), name.size());
+                has_current = true;
+                delivered = false;
+            }
+            if (!delivered && is_mean_key(key)) {
+                EmbeddingView mean = align_mean(parse_mean(val), scratch_);
+                fn(name, &mean);
+                delivered = true;
+            }
+        });
+        finish();
+    }
+
+    // Cached mean of `name`; the view is valid until the next read through this snapshot.
+    std::optional<EmbeddingView> mean(const std::string& name) const {
+        std::string key_bytes = mean_key(name);
+        MDB_val key;
+        key.mv_size = key_bytes.size();
+        key.mv_data = key_bytes.data();
+        MDB_val val;
+        int rc = mdb_get(txn_, dbi_, &key, &val);
+        if (rc == MDB_NOTFOUND) {
+            return std::nullopt;
+        }
+        if (rc != 0) {
+            throw std::runtime_error("Failed to read profile mean: " + std::string(mdb_strerror(rc)));
+        }
+        return align_mean(parse_mean(val), scratch_);
+    }
+
+    // fn(const EmbeddingView& samples) for every block of samples of `name`.
+    template <typename Fn>
+    void for_each(const std::string& name, Fn&& fn) const {
+        for_each_profile_entry(txn_, dbi_, name, [&](MDB_cursor*, const MDB_val& key, const MDB_val& val) {
+            if (is_sample_key(key)) {
+                fn(align_view(parse_embeddings(val), scratch_));
+            }
+        });
+    }
+
+private:
+    MDB_txn* txn_ = nullptr;
+    MDB_dbi dbi_;
+    mutable std::vector<float> scratch_;
 };
+
+inline LMDBStore::Snapshot LMDBStore::snapshot() const {
+    return Snapshot(*this);
+}
+
+template <typename Fn>
+void LMDBStore::for_each_profile(Fn&& fn) const {
+    Snapshot(*this).for_each(std::forward<Fn>(fn));
+}
+
+inline std::vector<std::pair<std::string, LMDBStore::EmbeddingList>> LMDBStore::get_all_embeddings() const {
+    std::vector<std::pair<std::string, EmbeddingList>> entries;
+    Snapshot(*this).for_each([&](std::string_view name, const EmbeddingView& view) {
+        if (entries.empty() || entries.back().first != name) {
+            entries.emplace_back(std::string(name), EmbeddingList{});
+        }
+        append_view(entries.back().second, view);
+    });
+    return entries;
+}
+
+inline ProfileAnnIndex LMDBStore::build_ann_index(const AnnSettings& settings) {
+    if (mode_ == Mode::ReadOnly) {
+        throw std::runtime_error("Attempted to build the ANN index from LMDB opened read-only");
+    }
+    Snapshot snap(*this);
+    ProfileAnnIndex index(settings);
+    std::vector<float> rows;
+    snap.for_each([&](std::string_view name, const EmbeddingView& view) {
+        const float* data = view.data;
+        if (view.encoding != SampleEncoding::F32) {
+            rows.resize(view.count * view.dim);
+            for (std::size_t i = 0; i < view.count; ++i) {
+                view.decode_row(i, rows.data() + i * view.dim);
+            }
+            data = rows.data();
+        }
+        index.add_samples(std::string(name), data, view.count, view.dim, view.dim);
+    });
+    index.set_txn_id(snap.txn_id());
+    index.save(ann_index_path());
+    return index;
+}
+
+inline std::shared_ptr<const ProfileAnnIndex> LMDBStore::load_ann_index(const Snapshot& snapshot) const {
+    const std::string path = ann_index_path();
+    auto stamp = file_stamp(path);
+    if (!stamp) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(ann_cache_mutex_);
+    if (!ann_cache_stamp_ || !(*ann_cache_stamp_ == *stamp)) {
+        auto index = ProfileAnnIndex::load(path);
+        ann_cache_ = index ? std::make_shared<const ProfileAnnIndex>(std::move(*index)) : nullptr;
+        ann_cache_stamp_ = *stamp;
+    }
+    if (ann_cache_ && ann_cache_->txn_id() != snapshot.txn_id()) {
+        return nullptr;
+    }
+    return ann_cache_;
+}
+
+inline LMDBStore::EmbeddingList LMDBStore::get_embeddings(const std::string& name) const {
+    EmbeddingList result;
+    Snapshot(*this).for_each(name, [&](const EmbeddingView& view) {
+        append_view(result, view);
+    });
+    return result;
+}
@@ -1,7 +1,13 @@
 #include "face_engine.hpp"
 #include "lmdb_store.hpp"
+#include "embedding_index.hpp"
 #include "config.hpp"
 #include "face_detector.hpp"
+#include "capture_pipeline.hpp"
+#include "profile_archive.hpp"
+#include "daemon_protocol.hpp"
+#include "camera.hpp"
+#include "work_stealing_pool.hpp"
 
 #include <iostream>
 #include <string>
@@ -11,23 +17,46 @@
 #include <vector>
 #include <algorithm>
 #include <numeric>
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 #include <thread>
+#include <cerrno>
+#include <cmath>
+#include <cctype>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
 Config g_config;
-FaceDetector g_face_detector;
+
+// Loaded on first use so it picks up the detector settings from g_config.
+FaceDetector& face_detector() {
+    static FaceDetector detector(FaceDetectorSettings::from_config(g_config));
+    return detector;
+}
 
 void print_usage(const char* program_name) {
     std::cout << "LXFU - Linux Face Utility\n\n";
     std::cout << "Usage:\n";
     std::cout << "  " << program_name << " [--preview] enroll [--device PATH|--file PATH] [--name NAME]\n";
     std::cout << "  " << program_name << " [--preview] query [--device PATH|--file PATH] [--name NAME|--all]\n";
+    std::cout << "  " << program_name << " enroll-batch --manifest FILE|--dir DIR [--threads N]\n";
     std::cout << "  " << program_name << " list\n";
     std::cout << "  " << program_name << " delete --name NAME [--confirm]\n";
     std::cout << "  " << program_name << " clear [--confirm]\n";
-    std::cout << "  " << program_name << " config\n\n";
+    std::cout << "  " << program_name << " config\n";
+    std::cout << "  " << program_name << " export --output FILE [--name NAME]\n";
+    std::cout << "  " << program_name << " import --input FILE\n";
+    std::cout << "  " << program_name << " model quantize [--input PATH] [--output PATH] [--python PATH]\n";
+    std::cout << "  " << program_name << " model check [--precision P] [--file PATH]... [--dir DIR] [--device PATH]\n";
+    std::cout << "  " << program_name << " ann build|status|drop\n";
+    std::cout << "  " << program_name << " stats [--socket PATH]\n\n";
     std::cout << "Legacy positional fallback:\n";
     std::cout << "  " << program_name << " enroll <device|image_path> <name>\n";
     std::cout << "  " << program_name << " query <device|image_path> [name]\n\n";
@@ -86,69 +115,21 @@ bool confirm_action(bool auto_confirm, const std::string& prompt) {
     return response == "yes";
 }
 
-bool parse_device_index(const std::string& path, int& index) {
-    if (path.rfind("/dev/video", 0) != 0) {
-        return false;
-    }
-    try {
-        index = std::stoi(path.substr(10));
-        return true;
-    } catch (const std::exception&) {
-        return false;
-    }
-}
-
-bool open_video_capture(cv::VideoCapture& cap, const std::string& source) {
-    cap.release();
-
-    // Try explicit path first so that non-sequential devices (e.g. IR cameras) work.
-    if (cap.open(source, cv::CAP_V4L2)) {
-        return true;
-    }
-    if (cap.open(source)) {
-        return true;
-    }
-
-    int index = 0;
-    if (parse_device_index(source, index) && cap.open(index)) {
-        return true;
-    }
-
-    return false;
-}
-
-void apply_camera_defaults(cv::VideoCapture& cap) {
-    struct CameraProp { int property; double value; };
-    const CameraProp desired_props[] = {
-        {cv::CAP_PROP_FRAME_WIDTH, 640},
-        {cv::CAP_PROP_FRAME_HEIGHT, 480},
-        {cv::CAP_PROP_FPS, 30},
-    };
-
-    for (const auto& prop : desired_props) {
-        cap.set(prop.property, prop.value);
-    }
-}
-
-void warm_up_camera(cv::VideoCapture& cap, int frames_to_discard = 10) {
-    cv::Mat dummy;
-    for (int i = 0; i < frames_to_discard; ++i) {
-        if (!cap.read(dummy) || dummy.empty()) {
-            break;
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+// Once built, the ANN index follows every write; only the first build is explicit.
+void ensure_ann_index(LMDBStore& store) {
+    AnnSettings ann = AnnSettings::from_config(g_config);
+    if (ann.enabled && !store.has_ann_index()) {
+        std::cout << "\nBuilding ANN index..." << std::endl;
+        store.build_ann_index(ann);
     }
 }
 
 }
 
-cv::Mat capture_from_device(const std::string& device_path, bool show_preview = false) {
-    cv::VideoCapture cap;
-    if (!open_video_capture(cap, device_path)) {
-        throw std::runtime_error("Failed to open device: " + device_path);
-    }
-
-    apply_camera_defaults(cap);
+// The camera starts opening when `camera` is constructed, so callers create it
+// before loading the model.
+cv::Mat capture_from_device(PendingCamera& camera, bool show_preview = false) {
+    OpenedCamera cap = camera.get();
 
     cv::Mat frame;
 
@@ -189,7 +170,7 @@ cv::Mat capture_from_device(const std::string& device_path, bool show_preview =
                         0.7, cv::Scalar(0, 255, 0), 2);
 
             cv::Mat preview_frame = current_frame.clone();
-            g_face_detector.draw_faces(preview_frame);
+            face_detector().draw_faces(preview_frame);
 
             try {
                 cv::imshow("LXFU Preview - Press SPACE to capture, ESC to cancel", preview_frame);
@@ -226,9 +207,13 @@ cv::Mat capture_from_device(const std::string& device_path, bool show_preview =
     return frame;
 }
 
-cv::Mat load_image_or_capture(const std::string& source, bool show_preview) {
+cv::Mat load_image_or_capture(const std::string& source, bool show_preview, PendingCamera* camera = nullptr) {
+    if (camera) {
+        return capture_from_device(*camera, show_preview);
+    }
     if (source.rfind("/dev/video", 0) == 0) {
-        return capture_from_device(source, show_preview);
+        PendingCamera device(source, CameraSettings::from_config(g_config), CameraWarmup{});
+        return capture_from_device(device, show_preview);
     }
 
     if (!fs::exists(source)) {
@@ -267,13 +252,28 @@ cv::Mat load_image_or_capture(const std::string& source, bool show_preview) {
 
 void enroll(const EnrollOptions& opts) {
     try {
-        std::string model_path = g_config.get("model_path");
-        FaceEngine engine(model_path);
-
         // Check if source is a device (camera) or file
         bool is_device = (opts.source.rfind("/dev/video", 0) == 0);
-        
+
+        // Open and warm up the camera while the model loads.
+        std::optional<PendingCamera> camera;
+        if (is_device) {
+            camera.emplace(opts.source, CameraSettings::from_config(g_config), CameraWarmup{});
+        }
+        FaceEngine engine(ModelSettings::from_config(g_config));
+
+        // Crops waiting to be embedded, and the embeddings produced so far.
         std::vector<cv::Mat> face_images;
+        LMDBStore::EmbeddingList new_embeddings;
+        const std::size_t batch_size = FaceEngine::kDefaultBatchSize;
+        auto embed_pending = [&]() {
+            for (auto& embedding : engine.extract_embeddings(face_images, batch_size)) {
+                if (!embedding.empty()) {
+                    new_embeddings.push_back(std::move(embedding));
+                }
+            }
+            face_images.clear();
+        };
 
         if (is_device) {
             // Multi-frame capture mode for camera
@@ -287,17 +287,12 @@ void enroll(const EnrollOptions& opts) {
             std::cout << "  • Keep your face visible at all times" << std::endl;
             std::cout << "\nCapturing frames for 10 seconds..." << std::endl;
 
-            cv::VideoCapture cap;
-            if (!open_video_capture(cap, opts.source)) {
-                throw std::runtime_error("Failed to open device: " + opts.source);
-            }
-
-            // Set camera properties for better quality
-            apply_camera_defaults(cap);
-
-            // Warm up camera
             std::cout << "\nWarming up camera..." << std::endl;
-            warm_up_camera(cap);
+            OpenedCamera cap = camera->get();
+            if (!cap.native_error.empty()) {
+                std::cout << "⚠ Warning: capture_backend=v4l2 unavailable (" << cap.native_error
+                          << "), using OpenCV" << std::endl;
+            }
 
             bool show_preview = opts.show_preview;
             if (show_preview) {
@@ -320,91 +315,114 @@ void enroll(const EnrollOptions& opts) {
                 }
             }
 
-            auto start_time = std::chrono::steady_clock::now();
             const int capture_duration_sec = 10;
-            int frames_captured = 0;
-            int frames_with_faces = 0;
-            int last_second_shown = -1;
-            int consecutive_failures = 0;
             int reopen_attempts = 0;
             const int max_reopen_attempts = 2;
             const int max_consecutive_failures = 45; // ~4.5s with 100ms sleep
             const int failure_reopen_threshold = 15;
 
             std::cout << "\nStarting capture..." << std::endl;
-            g_face_detector = FaceDetector(false); // Disable verbose for frame-by-frame
-
-            while (true) {
-                auto now = std::chrono::steady_clock::now();
-                auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - start_time).count();
-                
-                if (elapsed >= capture_duration_sec) {
-                    break;
+            face_detector().set_verbose(false); // Disable verbose for frame-by-frame
+
+            // Frames are read and cropped on background threads; this thread
+            // embeds crops in micro-batches and drives the preview window.
+            CapturePipelineOptions capture_options;
+            capture_options.duration_seconds = capture_duration_sec;
+            capture_options.frame_interval_seconds = 0.1; // ~10 FPS for processing
+            capture_options.max_consecutive_failures = max_consecutive_failures;
+            capture_options.detector_threads = std::clamp<std::size_t>(std::thread::hardware_concurrency() / 2, 1, 4);
+            capture_options.face_queue_capacity = 128;
+            capture_options.detector_settings = face_detector().settings();
+            capture_options.cpu_affinity = complement_cpus(engine.inference_cpus());
+
+            auto on_read_failure = [&](int failures) {
+                if (failures == 1 || failures % 5 == 0) {
+                    std::cout << "⚠ Warning: Failed to capture frame, retrying..." << std::endl;
+                }
+                if (failures == failure_reopen_threshold && reopen_attempts < max_reopen_attempts) {
+                    std::cout << "⚠ Attempting to reinitialize device..." << std::endl;
+                    ++reopen_attempts;
+                    cap.release();
+                    cap = start_camera(opts.source, CameraSettings::from_config(g_config));
+                    CameraWarmup rewarm;
+                    rewarm.max_seconds = 0.5;
+                    warm_up_camera(cap, rewarm);
+                }
+            };
+
+            // enroll_top_k > 0: keep only the best-scoring crops of the whole
+            // window (a min-heap on quality) and embed them once capture ends;
+            // 0 embeds every crop while capturing.
+            const std::size_t top_k = static_cast<std::size_t>(std::max(0, g_config.get_int("enroll_top_k", 30)));
+            std::vector<CapturedFace> best_crops;
+            auto worse = [](const CapturedFace& a, const CapturedFace& b) { return a.quality > b.quality; };
+            auto keep_if_better = [&](CapturedFace& crop) {
+                if (best_crops.size() < top_k) {
+                    best_crops.push_back(std::move(crop));
+                    std::push_heap(best_crops.begin(), best_crops.end(), worse);
+                } else if (crop.quality > best_crops.front().quality) {
+                    std::pop_heap(best_crops.begin(), best_crops.end(), worse);
+                    best_crops.back() = std::move(crop);
+                    std::push_heap(best_crops.begin(), best_crops.end(), worse);
+                }
+            };
+
+            const auto start_time = std::chrono::steady_clock::now();
+            int last_second_shown = -1;
+            std::size_t crops_received = 0;
+            std::vector<CapturedFace> crops;
+
+            CapturePipeline pipeline([&cap](CameraFrame& frame) { return cap.read(frame); },
+                                     capture_options, nullptr, on_read_failure);
+            const auto poll = std::chrono::milliseconds(show_preview ? 30 : 100);
+            while (pipeline.next_batch(crops, FaceEngine::kDefaultBatchSize, poll)) {
+                for (auto& crop : crops) {
+                    if (top_k > 0) {
+                        keep_if_better(crop);
+                    } else {
+                        face_images.push_back(std::move(crop.image));
+                    }
+                }
+                crops_received += crops.size();
+                if (face_images.size() >= FaceEngine::kDefaultBatchSize) {
+                    embed_pending();
                 }
 
+                auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::steady_clock::now() - start_time).count();
+                int current_second = static_cast<int>(std::min<long long>(elapsed, capture_duration_sec - 1));
+                int remaining = capture_duration_sec - current_second;
+
                 // Show countdown every second
-                int current_second = static_cast<int>(elapsed);
                 if (current_second != last_second_shown) {
-                    int remaining = capture_duration_sec - current_second;
                     std::cout << "⏱  " << remaining << " seconds remaining... "
-                              << "(captured " << frames_with_faces << " valid frames)" << std::endl;
+                              << "(captured " << crops_received << " valid frames)" << std::endl;
                     last_second_shown = current_second;
                 }
 
-                cv::Mat frame;
-                if (!cap.read(frame) || frame.empty()) {
-                    consecutive_failures++;
-
-                    if (consecutive_failures == 1 || consecutive_failures % 5 == 0) {
-                        std::cout << "⚠ Warning: Failed to capture frame, retrying..." << std::endl;
-                    }
-
-                    if (consecutive_failures == failure_reopen_threshold && reopen_attempts < max_reopen_attempts) {
-                        std::cout << "⚠ Attempting to reinitialize device..." << std::endl;
-                        ++reopen_attempts;
-                        if (!open_video_capture(cap, opts.source)) {
-                            throw std::runtime_error("Failed to reinitialize device: " + opts.source);
-                        }
-                        apply_camera_defaults(cap);
-                        warm_up_camera(cap, 5);
-                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (show_preview) {
+                    // Draw the boxes the workers already found instead of detecting again.
+                    FrameDetection detection = pipeline.latest_detection();
+                    if (detection.frame.empty()) {
                         continue;
                     }
+                    cv::Mat preview_frame = detection.frame.clone();
+                    face_detector().draw_faces(preview_frame, detection.faces);
 
-                    if (consecutive_failures >= max_consecutive_failures) {
-                        throw std::runtime_error("Camera did not produce frames. Check cable and pixel format settings for " + opts.source);
-                    }
-
-                    std::this_thread::sleep_for(std::chrono::milliseconds(60));
-                    continue;
-                }
-
-                consecutive_failures = 0;
-
-                frames_captured++;
-
-                // Try to detect and crop face
-                auto face_image = g_face_detector.crop_to_face(frame);
-                
-                if (show_preview) {
-                    cv::Mat preview_frame = frame.clone();
-                    g_face_detector.draw_faces(preview_frame);
-                    
                     // Draw countdown on preview
-                    int remaining = capture_duration_sec - current_second;
                     std::string countdown_text = std::to_string(remaining) + "s";
                     cv::putText(preview_frame, countdown_text,
                                 cv::Point(preview_frame.cols - 100, 60),
                                 cv::FONT_HERSHEY_SIMPLEX, 2.0,
                                 cv::Scalar(0, 255, 255), 3);
-                    
+
                     // Draw frame counter
-                    std::string counter_text = "Valid: " + std::to_string(frames_with_faces);
+                    std::string counter_text = "Valid: " + std::to_string(crops_received);
                     cv::putText(preview_frame, counter_text,
                                 cv::Point(10, 60),
                                 cv::FONT_HERSHEY_SIMPLEX, 0.7,
                                 cv::Scalar(0, 255, 0), 2);
-                    
+
                     try {
                         cv::imshow(window_name, preview_frame);
                         cv::waitKey(1);
@@ -412,15 +430,8 @@ void enroll(const EnrollOptions& opts) {
                         show_preview = false;
                     }
                 }
-
-                if (face_image) {
-                    face_images.push_back(*face_image);
-                    frames_with_faces++;
-                }
-
-                // Small delay to control frame rate (~10 FPS for processing)
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
             }
+            pipeline.join();
 
             cap.release();
             if (show_preview) {
@@ -428,15 +439,34 @@ void enroll(const EnrollOptions& opts) {
                 cv::waitKey(1);
             }
 
+            CaptureStats capture_stats = pipeline.stats();
+            if (!pipeline.error().empty() && crops_received == 0) {
+                throw std::runtime_error("Camera did not produce frames (" + pipeline.error() +
+                                         "). Check cable and pixel format settings for " + opts.source);
+            }
+
             std::cout << "\n✓ Capture complete!" << std::endl;
-            std::cout << "  Total frames processed: " << frames_captured << std::endl;
-            std::cout << "  Frames with detected faces: " << frames_with_faces << std::endl;
+            std::cout << "  Total frames processed: " << capture_stats.frames << std::endl;
+            std::cout << "  Frames with detected faces: " << capture_stats.frames_with_faces << std::endl;
             std::cout << "  Detection rate: " << std::fixed << std::setprecision(1)
-                      << (100.0 * frames_with_faces / std::max(1, frames_captured)) << "%" << std::endl;
+                      << (100.0 * capture_stats.frames_with_faces / std::max<std::size_t>(1, capture_stats.frames))
+                      << "%" << std::endl;
+            if (capture_stats.low_quality_faces > 0) {
+                std::cout << "  Faces below the quality bar (blur, exposure, size): "
+                          << capture_stats.low_quality_faces << std::endl;
+            }
+            if (top_k > 0 && crops_received > best_crops.size()) {
+                std::cout << "  Embedding the best " << best_crops.size() << " of " << crops_received
+                          << " faces (enroll_top_k)" << std::endl;
+            }
+            for (auto& crop : best_crops) {
+                face_images.push_back(std::move(crop.image));
+            }
+            best_crops.clear();
 
-            g_face_detector = FaceDetector(true); // Re-enable verbose
+            face_detector().set_verbose(true); // Re-enable verbose
 
-            if (face_images.empty()) {
+            if (crops_received == 0) {
                 std::cout << "\n✗ Enrollment failed: No valid faces detected during capture" << std::endl;
                 std::cout << "  Please ensure:" << std::endl;
                 std::cout << "  • Your face is clearly visible and well-lit" << std::endl;
@@ -451,7 +481,7 @@ void enroll(const EnrollOptions& opts) {
             cv::Mat image = load_image_or_capture(opts.source, opts.show_preview);
             std::cout << "Image loaded: " << image.cols << "x" << image.rows << std::endl;
 
-            auto face_image = g_face_detector.crop_to_face(image);
+            auto face_image = face_detector().face_region(image);
             if (!face_image) {
                 std::cout << "✗ Enrollment aborted: no face detected in image" << std::endl;
                 return;
@@ -460,31 +490,37 @@ void enroll(const EnrollOptions& opts) {
             face_images.push_back(*face_image);
         }
 
-        // Extract embeddings for all captured faces
-        std::cout << "\nExtracting embeddings from " << face_images.size() << " frame(s)..." << std::endl;
-        
+        // Extract embeddings for the faces not yet embedded during capture
+        if (!face_images.empty()) {
+            std::cout << "\nExtracting embeddings from " << face_images.size() << " frame(s)..." << std::endl;
+            embed_pending();
+        }
+
         std::string lmdb_path = g_config.get_embeddings_path();
         LMDBStore store(lmdb_path);
-        
-        int embeddings_stored = 0;
-        for (size_t i = 0; i < face_images.size(); ++i) {
-            if ((i + 1) % 10 == 0 || i == 0 || i == face_images.size() - 1) {
-                std::cout << "  Processing frame " << (i + 1) << "/" << face_images.size() << "..." << std::endl;
-            }
-            
-            std::vector<float> embedding = engine.extract_embedding(face_images[i]);
-            store.store_embedding(opts.name, embedding);
-            embeddings_stored++;
-        }
+        store.set_sample_encoding(sample_encoding_from_config(g_config));
+
+        // One commit for the whole capture; near-duplicate frames are dropped and
+        // the profile stays within max_samples_per_profile.
+        LMDBStore::AppendResult appended =
+            store.append_samples(opts.name, new_embeddings, SampleLimits::from_config(g_config));
+        std::size_t total_samples = appended.total;
+        std::size_t embeddings_stored = appended.added;
 
-        std::size_t total_samples = store.get_embeddings(opts.name).size();
+        ensure_ann_index(store);
 
         std::cout << "\n╔════════════════════════════════════════════════════╗" << std::endl;
         std::cout << "║  ✓ ENROLLMENT SUCCESSFUL!                          ║" << std::endl;
         std::cout << "╚════════════════════════════════════════════════════╝" << std::endl;
         std::cout << "\n  Profile: " << opts.name << std::endl;
-        std::cout << "  Embedding dimensions: " << (face_images.empty() ? 0 : 384) << std::endl;
+        std::cout << "  Embedding dimensions: " << (new_embeddings.empty() ? 0 : new_embeddings.front().size()) << std::endl;
         std::cout << "  New samples added: " << embeddings_stored << std::endl;
+        if (appended.duplicates > 0) {
+            std::cout << "  Near-duplicate frames skipped: " << appended.duplicates << std::endl;
+        }
+        if (appended.evicted > 0) {
+            std::cout << "  Samples pruned to stay within the profile cap: " << appended.evicted << std::endl;
+        }
         std::cout << "  Total samples for profile: " << total_samples << std::endl;
         std::cout << "  Total profiles in database: " << store.size() << std::endl;
         std::cout << std::endl;
@@ -497,14 +533,17 @@ void enroll(const EnrollOptions& opts) {
 
 void query(const QueryOptions& opts) {
     try {
-        std::string model_path = g_config.get("model_path");
-        FaceEngine engine(model_path);
+        std::optional<PendingCamera> camera;
+        if (opts.source.rfind("/dev/video", 0) == 0) {
+            camera.emplace(opts.source, CameraSettings::from_config(g_config), CameraWarmup{});
+        }
+        FaceEngine engine(ModelSettings::from_config(g_config));
 
         std::cout << "Loading/capturing face..." << std::endl;
-        cv::Mat image = load_image_or_capture(opts.source, opts.show_preview);
+        cv::Mat image = load_image_or_capture(opts.source, opts.show_preview, camera ? &*camera : nullptr);
         std::cout << "Image loaded: " << image.cols << "x" << image.rows << std::endl;
 
-        auto face_image = g_face_detector.crop_to_face(image);
+        auto face_image = face_detector().face_region(image);
         if (!face_image) {
             std::cout << "✗ Query aborted: no face detected" << std::endl;
             return;
@@ -515,9 +554,9 @@ void query(const QueryOptions& opts) {
 
         std::string lmdb_path = g_config.get_embeddings_path();
         LMDBStore store(lmdb_path, LMDBStore::Mode::ReadOnly);
-        auto entries = store.get_all_embeddings();
+        LMDBStore::Snapshot snapshot = store.snapshot();
 
-        if (entries.empty()) {
+        if (snapshot.empty()) {
             std::cout << "\n⚠ No profiles enrolled yet." << std::endl;
             return;
         }
@@ -533,52 +572,44 @@ void query(const QueryOptions& opts) {
         bool considered_any = false;
         bool matched_name_present = false;
 
-        for (const auto& [name, stored_embedding] : entries) {
-            if (require_specific && name != desired) {
-                continue;
-            }
-            if (stored_embedding.empty()) {
-                continue;
-            }
+        std::optional<std::string> target;
+        if (require_specific) {
+            target = desired;
+        }
 
-            bool dimension_mismatch = std::any_of(
-                stored_embedding.begin(), stored_embedding.end(),
-                [&](const auto& emb) { return emb.size() != embedding.size(); });
-            if (dimension_mismatch) {
-                continue;
-            }
+        // Identify mode over a large database: let the ANN index propose
+        // candidates and re-rank only those exactly.
+        QueryBlock query({embedding});
+        std::vector<ProfileMatch> matches;
+        AnnSettings ann = AnnSettings::from_config(g_config);
+        std::shared_ptr<const ProfileAnnIndex> ann_index;
+        if (!target && ann.enabled) {
+            ann_index = store.load_ann_index(snapshot);
+        }
+        if (ann_index && ann_index->profile_count() >= ann.min_profiles) {
+            auto candidates = ann_index->search(embedding.data(), embedding.size(), ann.candidates, ann.ef_search);
+            std::cout << "  (ANN index: " << candidates.size() << " candidate(s) of "
+                      << ann_index->profile_count() << " profiles)" << std::endl;
+            matches = score_profiles(snapshot, query, candidates);
+        } else {
+            matches = score_profiles(snapshot, query, target);
+        }
 
+        for (const auto& match : matches) {
             considered_any = true;
             if (require_specific) {
                 matched_name_present = true;
             }
 
-            std::vector<float> similarities;
-            similarities.reserve(stored_embedding.size());
-            for (const auto& emb : stored_embedding) {
-                float sim = std::inner_product(embedding.begin(), embedding.end(),
-                                               emb.begin(), 0.0f);
-                sim = (sim + 1.0f) * 0.5f;
-                similarities.push_back(sim);
-            }
-
-            if (similarities.empty()) {
-                continue;
-            }
-
-            float avg_similarity = std::accumulate(similarities.begin(), similarities.end(), 0.0f) /
-                                   static_cast<float>(similarities.size());
-            float max_similarity = *std::max_element(similarities.begin(), similarities.end());
-
-            std::cout << "  " << name << ": avg "
-                      << std::fixed << std::setprecision(2) << (avg_similarity * 100.0f)
-                      << "% (samples: " << similarities.size()
-                      << ", max: " << (max_similarity * 100.0f) << "%)" << std::endl;
+            std::cout << "  " << match.name << ": avg "
+                      << std::fixed << std::setprecision(2) << (match.avg_similarity * 100.0f)
+                      << "% (samples: " << match.samples
+                      << ", max: " << (match.max_similarity * 100.0f) << "%)" << std::endl;
 
-            if (avg_similarity > best_avg_similarity) {
-                best_avg_similarity = avg_similarity;
-                best_max_similarity = max_similarity;
-                best_name = name;
+            if (match.avg_similarity > best_avg_similarity) {
+                best_avg_similarity = match.avg_similarity;
+                best_max_similarity = match.max_similarity;
+                best_name = match.name;
             }
         }
 
@@ -624,26 +655,37 @@ void list_profiles() {
             return;
         }
         LMDBStore store(lmdb_path, LMDBStore::Mode::ReadOnly);
-        auto entries = store.get_all_embeddings();
+        struct ProfileSummary {
+            std::string name;
+            std::size_t samples = 0;
+            std::size_t dimension = 0;
+            std::string format;
+        };
+        std::vector<ProfileSummary> entries;
+        store.for_each_profile([&](std::string_view name, const LMDBStore::EmbeddingView& view) {
+            const std::string format = sample_encoding_name(view.encoding);
+            if (entries.empty() || entries.back().name != name) {
+                entries.push_back({std::string(name), 0, view.dim, format});
+            } else if (entries.back().format.find(format) == std::string::npos) {
+                entries.back().format += "+" + format;
+            }
+            entries.back().samples += view.count;
+        });
         if (entries.empty()) {
             std::cout << "No profiles enrolled." << std::endl;
             return;
         }
 
-        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
-            return a.first < b.first;
-        });
-
         std::cout << std::left << std::setw(24) << "Name"
                   << std::setw(12) << "Samples"
-                  << "Dim" << std::endl;
-        std::cout << std::string(48, '-') << std::endl;
-        for (const auto& [name, embedding_list] : entries) {
-            std::size_t samples = embedding_list.size();
-            std::size_t dimension = samples > 0 ? embedding_list.front().size() : 0;
-            std::cout << std::left << std::setw(24) << (name.empty() ? "<unnamed>" : name)
-                      << std::setw(12) << samples
-                      << dimension << std::endl;
+                  << std::setw(8) << "Dim"
+                  << "Format" << std::endl;
+        std::cout << std::string(56, '-') << std::endl;
+        for (const auto& entry : entries) {
+            std::cout << std::left << std::setw(24) << (entry.name.empty() ? "<unnamed>" : entry.name)
+                      << std::setw(12) << entry.samples
+                      << std::setw(8) << entry.dimension
+                      << entry.format << std::endl;
         }
         std::cout << "\nTotal profiles: " << entries.size() << std::endl;
     } catch (const std::exception& ex) {
@@ -735,6 +777,700 @@ void clear_profiles(const std::vector<std::string>& args) {
     }
 }
 
+namespace {
+
+std::string find_quantize_script() {
+    const std::vector<std::string> possible_paths = {
+        "/usr/share/lxfu/quantize_model.py",
+        "/usr/local/share/lxfu/quantize_model.py",
+        // Local development
+        "./scripts/quantize_model.py",
+        "../scripts/quantize_model.py",
+    };
+    for (const auto& path : possible_paths) {
+        if (fs::exists(path)) {
+            return path;
+        }
+    }
+    return "";
+}
+
+// Run a program with the given arguments and wait for it; returns its exit
+// status, or -1 when it could not be started or was killed.
+int run_program(const std::vector<std::string>& command) {
+    std::vector<char*> argv;
+    for (const auto& arg : command) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        ::execvp(argv[0], argv.data());
+        ::_exit(127);
+    }
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool is_image_file(const fs::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp";
+}
+
+// Best-scoring enrolled profile for each embedding; nullopt when nothing is enrolled.
+std::optional<std::vector<ProfileMatch>> best_enrolled_matches(const std::vector<std::vector<float>>& embeddings) {
+    std::string lmdb_path = g_config.get_embeddings_path();
+    if (!fs::exists(lmdb_path)) {
+        return std::nullopt;
+    }
+    LMDBStore store(lmdb_path, LMDBStore::Mode::ReadOnly);
+    LMDBStore::Snapshot snapshot = store.snapshot();
+    if (snapshot.empty()) {
+        return std::nullopt;
+    }
+    std::vector<ProfileMatch> best(embeddings.size());
+    for (std::size_t i = 0; i < embeddings.size(); ++i) {
+        for (auto& match : score_profile_means(snapshot, QueryBlock({embeddings[i]}))) {
+            if (match.avg_similarity > best[i].avg_similarity) {
+                best[i] = std::move(match);
+            }
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+void quantize_model(const std::vector<std::string>& args) {
+    ModelSettings model = ModelSettings::from_config(g_config);
+    std::string input = model.path;
+    std::string output = model.quantized_path;
+    std::string python = "python3";
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--input") {
+            input = require_value(args, i, "--input");
+        } else if (arg == "--output") {
+            output = require_value(args, i, "--output");
+        } else if (arg == "--python") {
+            python = require_value(args, i, "--python");
+        } else {
+            throw std::runtime_error("Unknown quantize option: " + arg);
+        }
+    }
+
+    if (!fs::exists(input)) {
+        throw std::runtime_error("Model file not found: " + input);
+    }
+    std::string script = find_quantize_script();
+    if (script.empty()) {
+        throw std::runtime_error("quantize_model.py not found (expected in /usr/share/lxfu)");
+    }
+
+    // Dynamic quantization is only exposed through PyTorch's Python API.
+    std::cout << "Quantizing " << input << " -> " << output << " ..." << std::endl;
+    int rc = run_program({python, script, input, output});
+    if (rc != 0) {
+        throw std::runtime_error("Quantization failed (" + python + " exited with " + std::to_string(rc) + ")");
+    }
+
+    std::cout << "✓ Quantized model written to " << output << std::endl;
+    std::cout << "  Set model_precision=int8 in lxfu.conf to use it, and run 'lxfu model check' to verify accuracy." << std::endl;
+}
+
+// Embed the same face crops with FP32 and a reduced precision. Stored samples
+// are embeddings only, so the crops come from images (or one camera frame);
+// each pair is compared directly and scored against the enrolled profiles.
+void check_model(const std::vector<std::string>& args) {
+    ModelSettings model = ModelSettings::from_config(g_config);
+    ModelPrecision precision = model.precision == ModelPrecision::FP32 ? ModelPrecision::INT8 : model.precision;
+    std::vector<std::string> files;
+    std::string device = g_config.get("default_device", "/dev/video0");
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--precision") {
+            std::string value = require_value(args, i, "--precision");
+            auto parsed = parse_model_precision(value);
+            if (!parsed) {
+                throw std::runtime_error("Unknown precision: " + value);
+            }
+            precision = *parsed;
+        } else if (arg == "--file") {
+            files.push_back(require_value(args, i, "--file"));
+        } else if (arg == "--dir") {
+            std::string dir = require_value(args, i, "--dir");
+            for (const auto& entry : fs::directory_iterator(dir)) {
+                if (entry.is_regular_file() && is_image_file(entry.path())) {
+                    files.push_back(entry.path().string());
+                }
+            }
+        } else if (arg == "--device") {
+            device = require_value(args, i, "--device");
+        } else {
+            throw std::runtime_error("Unknown check option: " + arg);
+        }
+    }
+    if (precision == ModelPrecision::FP32) {
+        throw std::runtime_error("Nothing to compare: choose --precision fp16, bf16 or int8");
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<cv::Mat> faces;
+    face_detector().set_verbose(false);
+    if (files.empty()) {
+        std::cout << "Capturing a frame from " << device << "..." << std::endl;
+        files.push_back(device);
+    }
+    for (const auto& file : files) {
+        cv::Mat image = load_image_or_capture(file, false);
+        if (auto face = face_detector().crop_to_face(image)) {
+            faces.push_back(*face);
+        } else {
+            std::cout << "⚠ No face detected in " << file << ", skipped" << std::endl;
+        }
+    }
+    face_detector().set_verbose(true);
+    if (faces.empty()) {
+        throw std::runtime_error("No face crops to compare");
+    }
+
+    FaceEngine reference(model.path, /*verbose=*/true, ModelPrecision::FP32);
+    ModelSettings reduced_settings = model;
+    reduced_settings.precision = precision;
+    FaceEngine reduced(reduced_settings);
+    if (reduced.precision() == ModelPrecision::FP32) {
+        throw std::runtime_error(std::string(model_precision_name(precision)) + " is not available on this machine");
+    }
+
+    auto ref_embeddings = reference.extract_embeddings(faces);
+    auto red_embeddings = reduced.extract_embeddings(faces);
+
+    auto ref_matches = best_enrolled_matches(ref_embeddings);
+    auto red_matches = best_enrolled_matches(red_embeddings);
+
+    const float threshold = g_config.get_threshold();
+    double drift_sum = 0.0;
+    double drift_max = 0.0;
+    double score_delta_max = 0.0;
+    std::size_t flipped = 0;
+    std::cout << "\nComparing fp32 against " << model_precision_name(precision)
+              << " on " << faces.size() << " face(s):" << std::endl;
+    for (std::size_t i = 0; i < faces.size(); ++i) {
+        const auto& a = ref_embeddings[i];
+        const auto& b = red_embeddings[i];
+        if (a.size() != b.size()) {
+            throw std::runtime_error("Embedding dimension differs between precisions");
+        }
+        double drift = 1.0 - similarity::dot(a.data(), b.data(), a.size());
+        drift_sum += drift;
+        drift_max = std::max(drift_max, drift);
+        std::cout << "  #" << (i + 1) << ": cosine drift " << std::scientific << std::setprecision(2) << drift;
+
+        if (ref_matches && red_matches) {
+            const ProfileMatch& ref_best = (*ref_matches)[i];
+            const ProfileMatch& red_best = (*red_matches)[i];
+            double delta = std::abs(static_cast<double>(ref_best.avg_similarity) - red_best.avg_similarity);
+            score_delta_max = std::max(score_delta_max, delta);
+            bool ref_accept = ref_best.avg_similarity >= threshold;
+            bool red_accept = red_best.avg_similarity >= threshold;
+            if (ref_accept != red_accept || (ref_accept && ref_best.name != red_best.name)) {
+                ++flipped;
+            }
+            std::cout << std::fixed << std::setprecision(2)
+                      << ", best " << ref_best.name << " " << (ref_best.avg_similarity * 100.0f) << "% -> "
+                      << red_best.name << " " << (red_best.avg_similarity * 100.0f) << "%";
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout << "\nMean cosine drift: " << std::scientific << std::setprecision(2)
+              << drift_sum / static_cast<double>(faces.size()) << std::endl;
+    std::cout << "Max cosine drift:  " << drift_max << std::endl;
+    if (ref_matches && red_matches) {
+        std::cout << "Max score change against enrolled profiles: " << std::fixed << std::setprecision(2)
+                  << (score_delta_max * 100.0) << "%" << std::endl;
+        if (flipped == 0) {
+            std::cout << "\n✓ No match decision changed at threshold " << (threshold * 100.0f) << "%" << std::endl;
+        } else {
+            std::cout << "\n✗ " << flipped << " match decision(s) changed at threshold "
+                      << (threshold * 100.0f) << "%" << std::endl;
+        }
+    } else {
+        std::cout << "\n⚠ No profiles enrolled; only the raw embedding drift was measured." << std::endl;
+    }
+}
+
+void ann_command(const std::vector<std::string>& args) {
+    if (args.size() != 1) {
+        throw std::runtime_error("ann requires a subcommand: build, status or drop");
+    }
+    std::string lmdb_path = g_config.get_embeddings_path();
+    const std::string& sub = args.front();
+    if (sub == "build") {
+        LMDBStore store(lmdb_path);
+        auto start = std::chrono::steady_clock::now();
+        ProfileAnnIndex index = store.build_ann_index(AnnSettings::from_config(g_config));
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "✓ ANN index built: " << index.profile_count() << " profiles, " << index.sample_count()
+                  << " samples (" << std::fixed << std::setprecision(0) << ms << " ms)" << std::endl;
+        std::cout << "  " << store.ann_index_path() << std::endl;
+    } else if (sub == "status") {
+        if (!fs::exists(lmdb_path)) {
+            std::cout << "⚠ No profiles enrolled yet." << std::endl;
+            return;
+        }
+        LMDBStore store(lmdb_path, LMDBStore::Mode::ReadOnly);
+        if (!store.has_ann_index()) {
+            std::cout << "⚠ No ANN index (run 'lxfu ann build')" << std::endl;
+            return;
+        }
+        LMDBStore::Snapshot snapshot = store.snapshot();
+        auto index = store.load_ann_index(snapshot);
+        if (!index) {
+            std::cout << "⚠ ANN index is stale or unreadable; it is ignored until rebuilt" << std::endl;
+            return;
+        }
+        AnnSettings ann = AnnSettings::from_config(g_config);
+        std::cout << "✓ ANN index current" << (ann.enabled ? "" : " (ann_enabled is off)") << std::endl;
+        std::cout << "  Profiles: " << index->profile_count() << std::endl;
+        std::cout << "  Samples: " << index->sample_count() << " (dim " << index->dim() << ")" << std::endl;
+        std::cout << "  Tombstones: " << std::fixed << std::setprecision(1)
+                  << (index->deleted_fraction() * 100.0) << "%" << std::endl;
+    } else if (sub == "drop") {
+        LMDBStore store(lmdb_path);
+        store.drop_ann_index();
+        std::cout << "✓ ANN index removed" << std::endl;
+    } else {
+        throw std::runtime_error("Unknown ann subcommand: " + sub);
+    }
+}
+
+void model_command(const std::vector<std::string>& args) {
+    if (args.empty()) {
+        throw std::runtime_error("model requires a subcommand: quantize or check");
+    }
+    const std::vector<std::string> rest(args.begin() + 1, args.end());
+    if (args.front() == "quantize") {
+        quantize_model(rest);
+    } else if (args.front() == "check") {
+        check_model(rest);
+    } else {
+        throw std::runtime_error("Unknown model subcommand: " + args.front());
+    }
+}
+
+namespace {
+
+// Images decoded and cropped per round while the previous round is embedded.
+constexpr std::size_t kBatchChunkImages = 64;
+// Profiles written per LMDB transaction by enroll-batch and import.
+constexpr std::size_t kProfilesPerTxn = 256;
+
+struct BatchItem {
+    std::string name;
+    fs::path path;
+};
+
+// One chunk of enroll-batch images being decoded and cropped on the worker
+// pool. An image that cannot be read, has no face or fails to decode leaves
+// its crop empty; `errors` holds the reason when one was thrown.
+struct CropChunk {
+    std::size_t begin = 0;
+    std::vector<std::optional<cv::Mat>> crops;
+    std::vector<std::string> errors;
+    std::atomic<std::size_t> next{0};
+
+    std::mutex mutex;
+    std::condition_variable done;
+    std::size_t workers_left = 0;
+
+    void finish_worker() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--workers_left == 0) {
+            done.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return workers_left == 0; });
+    }
+};
+
+std::string trim_copy(const std::string& value) {
+    size_t first = value.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return "";
+    }
+    return value.substr(first, value.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+// "name,path" per line. Blank lines, '#' comments and a "name,path" header are
+// skipped; relative paths are resolved against the manifest's directory.
+std::vector<BatchItem> read_manifest(const fs::path& manifest) {
+    std::ifstream in(manifest);
+    if (!in) {
+        throw std::runtime_error("Cannot open manifest: " + manifest.string());
+    }
+    std::vector<BatchItem> items;
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        line = trim_copy(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t comma = line.find(',');
+        std::string name = trim_copy(line.substr(0, comma));
+        std::string path = comma == std::string::npos ? "" : trim_copy(line.substr(comma + 1));
+        if (name == "name" && path == "path") {
+            continue;
+        }
+        if (name.empty() || path.empty()) {
+            throw std::runtime_error(manifest.string() + ":" + std::to_string(line_no) + ": expected name,path");
+        }
+        fs::path image(path);
+        if (image.is_relative()) {
+            image = manifest.parent_path() / image;
+        }
+        items.push_back({name, image});
+    }
+    return items;
+}
+
+// One sub-directory per profile, named after it, holding that person's images.
+std::vector<BatchItem> scan_enroll_dir(const fs::path& root) {
+    if (!fs::is_directory(root)) {
+        throw std::runtime_error("Not a directory: " + root.string());
+    }
+    std::vector<BatchItem> items;
+    for (const auto& person : fs::directory_iterator(root)) {
+        if (!person.is_directory()) {
+            continue;
+        }
+        for (const auto& file : fs::directory_iterator(person.path())) {
+            if (file.is_regular_file() && is_image_file(file.path())) {
+                items.push_back({person.path().filename().string(), file.path()});
+            }
+        }
+    }
+    std::sort(items.begin(), items.end(), [](const BatchItem& a, const BatchItem& b) {
+        return a.name != b.name ? a.name < b.name : a.path < b.path;
+    });
+    return items;
+}
+
+struct BatchWriteTotals {
+    std::size_t profiles = 0;
+    std::size_t added = 0;
+    std::size_t duplicates = 0;
+    std::size_t evicted = 0;
+};
+
+// Collects profiles and writes them kProfilesPerTxn to a transaction.
+class ProfileBatchWriter {
+public:
+    explicit ProfileBatchWriter(LMDBStore& store) : store_(store), limits_(SampleLimits::from_config(g_config)) {
+        store_.set_sample_encoding(sample_encoding_from_config(g_config));
+    }
+
+    void add(std::string name, LMDBStore::EmbeddingList samples) {
+        pending_.emplace_back(std::move(name), std::move(samples));
+        if (pending_.size() >= kProfilesPerTxn) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (pending_.empty()) {
+            return;
+        }
+        for (const auto& result : store_.append_profiles(pending_, limits_)) {
+            ++totals_.profiles;
+            totals_.added += result.added;
+            totals_.duplicates += result.duplicates;
+            totals_.evicted += result.evicted;
+        }
+        pending_.clear();
+    }
+
+    const BatchWriteTotals& totals() const { return totals_; }
+
+private:
+    LMDBStore& store_;
+    SampleLimits limits_;
+    std::vector<std::pair<std::string, LMDBStore::EmbeddingList>> pending_;
+    BatchWriteTotals totals_;
+};
+
+void print_write_totals(const BatchWriteTotals& totals) {
+    std::cout << "  Profiles written: " << totals.profiles << std::endl;
+    std::cout << "  Samples added: " << totals.added << std::endl;
+    if (totals.duplicates > 0) {
+        std::cout << "  Near-duplicates skipped: " << totals.duplicates << std::endl;
+    }
+    if (totals.evicted > 0) {
+        std::cout << "  Samples pruned to stay within the profile cap: " << totals.evicted << std::endl;
+    }
+}
+
+} // namespace
+
+void enroll_batch(const std::vector<std::string>& args) {
+    std::optional<fs::path> manifest;
+    std::optional<fs::path> dir;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--manifest") {
+            manifest = require_value(args, i, "--manifest");
+        } else if (arg == "--dir") {
+            dir = require_value(args, i, "--dir");
+        } else if (arg == "--threads") {
+            threads = static_cast<std::size_t>(std::clamp(std::stoi(require_value(args, i, "--threads")), 1, 64));
+        } else {
+            throw std::runtime_error("Unknown enroll-batch option: " + arg);
+        }
+    }
+    if (manifest.has_value() == dir.has_value()) {
+        throw std::runtime_error("enroll-batch needs exactly one of --manifest FILE or --dir DIR");
+    }
+
+    std::vector<BatchItem> items = manifest ? read_manifest(*manifest) : scan_enroll_dir(*dir);
+    if (items.empty()) {
+        throw std::runtime_error("No images to enroll");
+    }
+    std::cout << "Enrolling " << items.size() << " image(s) with " << threads << " decode thread(s)" << std::endl;
+
+    FaceEngine engine(ModelSettings::from_config(g_config));
+    const std::vector<int> worker_cpus = complement_cpus(engine.inference_cpus());
+
+    // A CascadeClassifier must not be shared between threads: one detector per worker.
+    const FaceDetectorSettings detector_settings = FaceDetectorSettings::from_config(g_config);
+    std::vector<std::unique_ptr<FaceDetector>> detectors;
+    for (std::size_t t = 0; t < threads; ++t) {
+        detectors.push_back(std::make_unique<FaceDetector>(detector_settings, false));
+    }
+
+    // One task per detector and chunk; a chunk is cropped only after the
+    // previous one was collected, so detectors[w] is never used twice at once.
+    WorkStealingPool workers(detectors.size(), worker_cpus);
+    auto crop_chunk = [&](std::size_t begin) {
+        auto chunk = std::make_shared<CropChunk>();
+        const std::size_t end = std::min(items.size(), begin + kBatchChunkImages);
+        chunk->begin = begin;
+        chunk->crops.resize(end - begin);
+        chunk->errors.resize(end - begin);
+        chunk->next = begin;
+        chunk->workers_left = detectors.size();
+        for (std::size_t w = 0; w < detectors.size(); ++w) {
+            workers.submit([&, chunk, begin, end, w] {
+                for (std::size_t i = chunk->next++; i < end; i = chunk->next++) {
+                    // A corrupt file must not take the batch down with it.
+                    try {
+                        cv::Mat image = cv::imread(items[i].path.string(), cv::IMREAD_COLOR);
+                        if (!image.empty()) {
+                            chunk->crops[i - begin] = detectors[w]->crop_to_face(image);
+                        }
+                    } catch (const std::exception& ex) {
+                        chunk->crops[i - begin].reset();
+                        chunk->errors[i - begin] = ex.what();
+                    }
+                }
+                chunk->finish_worker();
+            });
+        }
+        return chunk;
+    };
+
+    // Decode and detect the next chunk while the current one is embedded.
+    std::map<std::string, LMDBStore::EmbeddingList> profiles;
+    // Path and, when decoding threw, the reason.
+    std::vector<std::pair<fs::path, std::string>> failed;
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<CropChunk> pending = crop_chunk(0);
+    for (std::size_t begin = 0; begin < items.size(); begin += kBatchChunkImages) {
+        pending->wait();
+        std::vector<std::optional<cv::Mat>> crops = std::move(pending->crops);
+        std::vector<std::string> errors = std::move(pending->errors);
+        if (begin + kBatchChunkImages < items.size()) {
+            pending = crop_chunk(begin + kBatchChunkImages);
+        }
+
+        std::vector<cv::Mat> faces;
+        std::vector<std::size_t> owners;
+        for (std::size_t i = 0; i < crops.size(); ++i) {
+            if (crops[i]) {
+                faces.push_back(std::move(*crops[i]));
+                owners.push_back(begin + i);
+            } else {
+                failed.emplace_back(items[begin + i].path, std::move(errors[i]));
+            }
+        }
+        auto embeddings = engine.extract_embeddings(faces, FaceEngine::kDefaultBatchSize);
+        for (std::size_t j = 0; j < embeddings.size(); ++j) {
+            if (embeddings[j].empty()) {
+                failed.emplace_back(items[owners[j]].path, std::string());
+            } else {
+                profiles[items[owners[j]].name].push_back(std::move(embeddings[j]));
+            }
+        }
+        std::cout << "\r  " << std::min(items.size(), begin + kBatchChunkImages) << "/" << items.size()
+                  << " images processed" << std::flush;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << " (" << std::fixed << std::setprecision(1) << seconds << " s)" << std::endl;
+
+    LMDBStore store(g_config.get_embeddings_path());
+    ProfileBatchWriter writer(store);
+    for (auto& [name, samples] : profiles) {
+        writer.add(name, std::move(samples));
+    }
+    writer.flush();
+    ensure_ann_index(store);
+
+    std::cout << "\n✓ Batch enrollment complete" << std::endl;
+    print_write_totals(writer.totals());
+    if (!failed.empty()) {
+        std::cout << "⚠ " << failed.size() << " image(s) skipped (unreadable or no face):" << std::endl;
+        for (std::size_t i = 0; i < std::min<std::size_t>(failed.size(), 10); ++i) {
+            std::cout << "    " << failed[i].first.string();
+            if (!failed[i].second.empty()) {
+                std::cout << " (" << failed[i].second << ")";
+            }
+            std::cout << std::endl;
+        }
+        if (failed.size() > 10) {
+            std::cout << "    ..." << std::endl;
+        }
+    }
+}
+
+void export_profiles(const std::vector<std::string>& args) {
+    std::string output;
+    std::optional<std::string> name;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--output") {
+            output = require_value(args, i, "--output");
+        } else if (args[i] == "--name") {
+            name = require_value(args, i, "--name");
+        } else {
+            throw std::runtime_error("Unknown export option: " + args[i]);
+        }
+    }
+    if (output.empty()) {
+        throw std::runtime_error("export requires --output FILE");
+    }
+
+    std::string lmdb_path = g_config.get_embeddings_path();
+    if (!fs::exists(lmdb_path)) {
+        throw std::runtime_error("No profiles enrolled");
+    }
+    LMDBStore store(lmdb_path, LMDBStore::Mode::ReadOnly);
+    LMDBStore::Snapshot snapshot = store.snapshot();
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot write " + output);
+    }
+    ProfileArchiveStats stats = write_profile_archive(out, snapshot, name);
+    out.close();
+    if (name && stats.profiles == 0) {
+        fs::remove(output);
+        throw std::runtime_error("No enrolled samples for name '" + *name + "'");
+    }
+    std::cout << "✓ Exported " << stats.profiles << " profile(s), " << stats.samples << " sample(s) to "
+              << output << std::endl;
+}
+
+void import_profiles(const std::vector<std::string>& args) {
+    std::string input;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--input") {
+            input = require_value(args, i, "--input");
+        } else {
+            throw std::runtime_error("Unknown import option: " + args[i]);
+        }
+    }
+    if (input.empty()) {
+        throw std::runtime_error("import requires --input FILE");
+    }
+    std::ifstream in(input, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + input);
+    }
+
+    LMDBStore store(g_config.get_embeddings_path());
+    ProfileBatchWriter writer(store);
+    ProfileArchiveStats stats = read_profile_archive(in, [&](std::string name, LMDBStore::EmbeddingList samples) {
+        writer.add(std::move(name), std::move(samples));
+    });
+    writer.flush();
+    ensure_ann_index(store);
+
+    std::cout << "✓ Imported " << stats.profiles << " profile(s), " << stats.samples << " sample(s) from "
+              << input << std::endl;
+    print_write_totals(writer.totals());
+}
+
+// Latency percentiles of recent authentications, as recorded by lxfud.
+void stats_command(const std::vector<std::string>& args) {
+    std::string socket_path = g_config.get("daemon_socket", kDefaultDaemonSocket);
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--socket") {
+            socket_path = require_value(args, i, "--socket");
+        } else {
+            throw std::runtime_error("Unknown stats option: " + args[i]);
+        }
+    }
+
+    std::string error;
+    auto snapshot = request_daemon_stats(socket_path, 5.0, error);
+    if (!snapshot) {
+        throw std::runtime_error("lxfud unavailable (" + error + "); timings are only collected by the daemon");
+    }
+
+    std::cout << "lxfud: " << snapshot->authentications << " authentication(s)";
+    if (!snapshot->outcomes.empty()) {
+        std::cout << " (";
+        bool first = true;
+        for (const auto& [outcome, count] : snapshot->outcomes) {
+            std::cout << (first ? "" : ", ") << outcome << " " << count;
+            first = false;
+        }
+        std::cout << ")";
+    }
+    std::cout << std::endl;
+    if (snapshot->stages.empty()) {
+        return;
+    }
+
+    std::cout << "\n" << std::left << std::setw(16) << "Stage (ms)" << std::right
+              << std::setw(9) << "Samples" << std::setw(10) << "p50" << std::setw(10) << "p90"
+              << std::setw(10) << "p99" << std::setw(10) << "Max" << std::setw(10) << "Mean" << std::endl;
+    std::cout << std::string(75, '-') << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& stage : snapshot->stages) {
+        double mean = stage.count > 0 ? stage.sum_ms / static_cast<double>(stage.count) : 0.0;
+        std::cout << std::left << std::setw(16) << stage_name(stage.stage) << std::right
+                  << std::setw(9) << stage.samples << std::setw(10) << stage.p50 << std::setw(10) << stage.p90
+                  << std::setw(10) << stage.p99 << std::setw(10) << stage.max << std::setw(10) << mean
+                  << std::endl;
+    }
+    std::cout << "\nPercentiles cover the last " << MetricsRegistry::kDefaultCapacity
+              << " authentications; Mean is since lxfud started." << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     try {
         g_config = load_config();
@@ -884,6 +1620,44 @@ int main(int argc, char* argv[]) {
         } else if (command == "clear") {
             clear_profiles(args);
 
+        } else if (command == "enroll-batch" || command == "export" || command == "import") {
+            try {
+                if (command == "enroll-batch") {
+                    enroll_batch(args);
+                } else if (command == "export") {
+                    export_profiles(args);
+                } else {
+                    import_profiles(args);
+                }
+            } catch (const std::exception& ex) {
+                std::cerr << "Error: " << ex.what() << std::endl;
+                return 1;
+            }
+
+        } else if (command == "stats") {
+            try {
+                stats_command(args);
+            } catch (const std::exception& ex) {
+                std::cerr << "Error: " << ex.what() << std::endl;
+                return 1;
+            }
+
+        } else if (command == "ann") {
+            try {
+                ann_command(args);
+            } catch (const std::exception& ex) {
+                std::cerr << "Error: " << ex.what() << std::endl;
+                return 1;
+            }
+
+        } else if (command == "model") {
+            try {
+                model_command(args);
+            } catch (const std::exception& ex) {
+                std::cerr << "Error: " << ex.what() << std::endl;
+                return 1;
+            }
+
         } else {
             std::cerr << "Error: Unknown command '" << command << "'\n";
             print_usage(argv[0]);
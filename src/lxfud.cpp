@@ -0,0 +1,591 @@
+#include "face_auth.hpp"
+#include "daemon_protocol.hpp"
+#include "config.hpp"
+#include "inference_scheduler.hpp"
+#include "metrics.hpp"
+#include "work_stealing_pool.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+volatile std::sig_atomic_t g_stop_requested = 0;
+
+void handle_stop_signal(int) {
+    g_stop_requested = 1;
+}
+
+void print_usage(const char* program_name) {
+    std::cout << "lxfud - LXFU face authentication daemon\n\n";
+    std::cout << "Usage:\n";
+    std::cout << "  " << program_name << " [--socket PATH] [--foreground]\n\n";
+    std::cout << "Options:\n";
+    std::cout << "  --socket PATH   Unix socket to listen on (defaults to daemon_socket or "
+              << kDefaultDaemonSocket << ")\n";
+    std::cout << "  --foreground    Also log to stderr\n";
+}
+
+AuthLogger make_daemon_logger() {
+    return AuthLogger([](int priority, const char* message) {
+        syslog(priority, "%s", message);
+    });
+}
+
+struct DaemonSettings {
+    // Requests served at once; further clients are answered "busy" and
+    // pam_lxfu falls back to in-process authentication (daemon=auto).
+    std::size_t max_sessions = 8;
+    // Detection workers shared by all sessions (0 = one per CPU outside
+    // cpu_affinity, or half the CPUs when inference is not pinned).
+    std::size_t detection_threads = 0;
+    // Longest capture and warm-up a client may ask for, so no request holds
+    // a camera and a session slot for longer.
+    double max_capture_seconds = 10.0;
+    double max_warmup_seconds = 5.0;
+
+    static DaemonSettings from_config(const Config& config) {
+        DaemonSettings s;
+        s.max_sessions = static_cast<std::size_t>(std::max(1, config.get_int("daemon_max_sessions", static_cast<int>(s.max_sessions))));
+        s.detection_threads = static_cast<std::size_t>(std::max(0, config.get_int("daemon_detection_threads", 0)));
+        s.max_capture_seconds = std::max(0.1, config.get_double("daemon_max_capture_seconds", s.max_capture_seconds));
+        s.max_warmup_seconds = std::max(0.0, config.get_double("daemon_max_warmup_seconds", s.max_warmup_seconds));
+        return s;
+    }
+
+    std::size_t detection_workers(const std::vector<int>& detection_cpus) const {
+        if (detection_threads > 0) {
+            return detection_threads;
+        }
+        if (!detection_cpus.empty()) {
+            return detection_cpus.size();
+        }
+        return std::max<std::size_t>(1, std::thread::hardware_concurrency() / 2);
+    }
+};
+
+// Two sessions cannot stream from the same camera; the later one waits.
+class DeviceLocks {
+public:
+    std::vector<std::unique_lock<std::mutex>> lock(std::vector<std::string> devices) {
+        // One global order, so sessions sharing several cameras cannot deadlock.
+        std::sort(devices.begin(), devices.end());
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (const auto& device : devices) {
+            locks.emplace_back(mutex_for(device));
+        }
+        return locks;
+    }
+
+private:
+    std::mutex& mutex_for(const std::string& device) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& mutex = mutexes_[device];
+        if (!mutex) {
+            mutex = std::make_unique<std::mutex>();
+        }
+        return *mutex;
+    }
+
+    std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<std::mutex>> mutexes_;
+};
+
+// Resident state: the model behind its batching scheduler, the shared
+// detection workers, the cascades and the LMDB envs in use. Safe to use from
+// several session threads.
+class DaemonState {
+public:
+    DaemonState(const Config& config, const DaemonSettings& settings)
+        : settings_(settings),
+          engine_(ModelSettings::from_config(config), /*verbose=*/false),
+          scheduler_(engine_, InferenceBatchSettings::from_config(config)),
+          detection_pool_(settings.detection_workers(complement_cpus(engine_.inference_cpus())),
+                          complement_cpus(engine_.inference_cpus())),
+          detectors_(FaceDetectorSettings::from_config(config)),
+          default_device_(parse_device_list(config.get("default_device", "/dev/video0"))),
+          embeddings_path_(config.get_embeddings_path()),
+          camera_(CameraSettings::from_config(config)) {
+        // Pay the first-forward JIT and allocator cost now, not on the first login.
+        engine_.warm_up(ModelSettings::from_config(config));
+    }
+
+    // The daemon runs as root and its socket is world-connectable, so what a
+    // client may ask for is limited here. Non-root clients always get the
+    // daemon's own database and cameras: a client-chosen path would be opened
+    // as root (LMDB creates and resizes lock.mdb even read-only, through any
+    // symlink), and a device string reaches cv::VideoCapture, which also
+    // opens files, URLs and GStreamer pipelines. Every client's capture and
+    // warm-up are clamped so no one holds a camera and a session for long.
+    void restrict_request(AuthRequest& req, uid_t peer_uid) const {
+        if (peer_uid != 0) {
+            req.embeddings_path = embeddings_path_;
+            req.device_paths = default_device_;
+            req.source_path.reset();
+        }
+        req.capture_duration_seconds = std::clamp(req.capture_duration_seconds, 0.0, settings_.max_capture_seconds);
+        req.warmup_delay_seconds = std::clamp(req.warmup_delay_seconds, 0.0, settings_.max_warmup_seconds);
+        req.frame_interval_seconds = std::clamp(req.frame_interval_seconds, 0.0, settings_.max_capture_seconds);
+    }
+
+    // `cancelled` is polled while capturing, see AuthOptions.
+    AuthResult authenticate(const AuthRequest& req, const AuthLogger& log, std::function<bool()> cancelled) {
+        std::vector<std::unique_lock<std::mutex>> devices;
+        PendingCameras cameras;
+        if (!req.source_path) {
+            devices = device_locks_.lock(req.device_paths);
+            cameras = start_auth_cameras(req, camera_);
+        }
+        const std::shared_ptr<const LMDBStore> store = store_for(req.embeddings_path);
+        AuthOptions options;
+        options.cameras = &cameras;
+        options.camera = camera_;
+        options.detection_pool = &detection_pool_;
+        options.cancelled = std::move(cancelled);
+        AuthResult result = authenticate_face(req, detectors_, scheduler_, *store, log, options);
+        metrics_.record(result.timings, result.cancelled ? "cancelled" : auth_status_name(result.status));
+        return result;
+    }
+
+    // Loads the detector of the first default camera, so a missing cascade
+    // shows up at startup.
+    bool detector_ready() {
+        return detectors_.for_device(default_device_.empty() ? std::string() : default_device_.front())
+            ->is_initialized();
+    }
+
+    std::size_t detection_workers() const { return detection_pool_.size(); }
+
+    // Safe to call from the metrics listener thread.
+    const MetricsRegistry& metrics() const { return metrics_; }
+
+private:
+    // Envs kept open at once. Only root clients can name other databases;
+    // beyond this, envs no session is using are closed first.
+    static constexpr std::size_t kMaxOpenStores = 16;
+
+    std::shared_ptr<const LMDBStore> store_for(const std::string& path) {
+        std::lock_guard<std::mutex> lock(stores_mutex_);
+        auto it = stores_.find(path);
+        if (it != stores_.end()) {
+            return it->second;
+        }
+        for (auto idle = stores_.begin(); stores_.size() >= kMaxOpenStores && idle != stores_.end();) {
+            idle = idle->second.use_count() == 1 && idle->first != embeddings_path_ ? stores_.erase(idle)
+                                                                                    : std::next(idle);
+        }
+        if (stores_.size() >= kMaxOpenStores) {
+            throw std::runtime_error("too many databases open");
+        }
+        return stores_.emplace(path, std::make_shared<const LMDBStore>(path, LMDBStore::Mode::ReadOnly))
+            .first->second;
+    }
+
+    DaemonSettings settings_;
+    FaceEngine engine_;
+    InferenceScheduler scheduler_;
+    WorkStealingPool detection_pool_;
+    DeviceDetectors detectors_;
+    std::vector<std::string> default_device_;
+    std::string embeddings_path_;
+    CameraSettings camera_;
+    DeviceLocks device_locks_;
+    std::mutex stores_mutex_;
+    std::map<std::string, std::shared_ptr<const LMDBStore>> stores_;
+    MetricsRegistry metrics_;
+};
+
+// pam_lxfu keeps its end open until the answer arrives, so a hang-up means
+// the conversation was aborted, the client timed out or the process died.
+bool client_hung_up(int fd) {
+    pollfd pfd{fd, POLLRDHUP, 0};
+    return ::poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0;
+}
+
+void serve_client(int client_fd, DaemonState& state, const AuthLogger& log) {
+    ucred peer{};
+    socklen_t peer_len = sizeof(peer);
+    if (::getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) != 0) {
+        log.log(LOG_WARNING, "could not read peer credentials: %s", std::strerror(errno));
+        return;
+    }
+
+    set_socket_timeout(client_fd, 10.0);
+    auto message = read_daemon_message(client_fd);
+    if (!message) {
+        return;
+    }
+
+    DaemonMessage response;
+    try {
+        auto op = message->find("op");
+        if (op != message->end() && op->second == "stats") {
+            // Aggregate timings only; no per-user data, so any peer may ask.
+            write_daemon_message(client_fd, encode_metrics_snapshot(state.metrics().snapshot()));
+            return;
+        }
+        if (op == message->end() || op->second != "auth") {
+            throw std::runtime_error("unsupported op");
+        }
+
+        AuthRequest req = decode_auth_request(*message);
+        state.restrict_request(req, peer.uid);
+
+        if (req.debug) {
+            log.log(LOG_DEBUG, "auth request for '%s' from pid %d uid %d",
+                    req.username.c_str(), static_cast<int>(peer.pid), static_cast<int>(peer.uid));
+        }
+        AuthResult result = state.authenticate(req, log, [client_fd] { return client_hung_up(client_fd); });
+        if (result.cancelled) {
+            return; // nobody is listening
+        }
+        response = encode_auth_result(result);
+    } catch (const std::exception& ex) {
+        log.log(LOG_ERR, "request failed: %s", ex.what());
+        response.clear();
+        response["error"] = ex.what();
+    }
+
+    write_daemon_message(client_fd, response);
+}
+
+// Runs each client connection on its own thread, up to max_sessions at once;
+// the destructor waits for the sessions still running.
+class SessionRunner {
+public:
+    SessionRunner(DaemonState& state, const AuthLogger& log, std::size_t max_sessions)
+        : state_(state), log_(log), max_sessions_(max_sessions) {}
+
+    ~SessionRunner() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return active_ == 0; });
+    }
+
+    SessionRunner(const SessionRunner&) = delete;
+    SessionRunner& operator=(const SessionRunner&) = delete;
+
+    // Takes ownership of `client_fd`.
+    void start(int client_fd) {
+        bool accepted = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (active_ < max_sessions_) {
+                ++active_;
+                accepted = true;
+            }
+        }
+        if (!accepted) {
+            reject(client_fd);
+            return;
+        }
+        // Leave SIGTERM/SIGINT to the main thread so its accept() is
+        // interrupted; the session starts with them blocked.
+        sigset_t signals;
+        sigset_t previous;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signals, &previous);
+        std::thread([this, client_fd] {
+            serve_client(client_fd, state_, log_);
+            ::close(client_fd);
+            std::lock_guard<std::mutex> lock(mutex_);
+            --active_;
+            idle_.notify_all();
+        }).detach();
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+private:
+    void reject(int client_fd) {
+        log_.log(LOG_WARNING, "%zu sessions already active; turning a client away", max_sessions_);
+        set_socket_timeout(client_fd, 1.0);
+        DaemonMessage busy;
+        busy["error"] = "busy";
+        write_daemon_message(client_fd, busy);
+        ::close(client_fd);
+    }
+
+    DaemonState& state_;
+    const AuthLogger& log_;
+    const std::size_t max_sessions_;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::size_t active_ = 0;
+};
+
+int open_listen_socket(const std::string& path) {
+    fs::path socket_path(path);
+    if (socket_path.has_parent_path()) {
+        fs::create_directories(socket_path.parent_path());
+    }
+    ::unlink(path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+    }
+
+    sockaddr_un addr = make_daemon_address(path);
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::runtime_error("bind " + path + ": " + std::strerror(err));
+    }
+    // Screen lockers authenticate as the session user, so the socket is world-connectable;
+    // DaemonState::restrict_request() limits what non-root clients can ask for.
+    ::chmod(path.c_str(), 0666);
+
+    if (::listen(fd, 16) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw std::runtime_error("listen " + path + ": " + std::strerror(err));
+    }
+    return fd;
+}
+
+// Minimal HTTP endpoint for Prometheus: GET /metrics on metrics_listen
+// ("HOST:PORT" or just "PORT" for loopback), served from its own thread so a
+// scrape never waits behind an authentication.
+class MetricsServer {
+public:
+    MetricsServer(const std::string& listen, const MetricsRegistry& metrics, const AuthLogger& log)
+        : metrics_(metrics), log_(log) {
+        std::string host = "127.0.0.1";
+        std::string port = listen;
+        if (auto colon = listen.rfind(':'); colon != std::string::npos) {
+            host = listen.substr(0, colon);
+            port = listen.substr(colon + 1);
+        }
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        int port_number = 0;
+        try {
+            port_number = std::stoi(port);
+        } catch (const std::exception&) {
+        }
+        if (port_number <= 0 || port_number > 65535 || ::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+            throw std::runtime_error("Invalid metrics_listen '" + listen + "' (expected IPv4:PORT)");
+        }
+        addr.sin_port = htons(static_cast<uint16_t>(port_number));
+
+        fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) {
+            throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+        }
+        int reuse = 1;
+        ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (::bind(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd_, 8) != 0) {
+            int err = errno;
+            ::close(fd_);
+            throw std::runtime_error("metrics_listen " + listen + ": " + std::strerror(err));
+        }
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~MetricsServer() {
+        stop_ = true;
+        thread_.join();
+        ::close(fd_);
+    }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+private:
+    void run() {
+        // Leave SIGTERM/SIGINT to the main thread so its accept() is interrupted.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        while (!stop_ && !g_stop_requested) {
+            pollfd pfd{fd_, POLLIN, 0};
+            if (::poll(&pfd, 1, 500) <= 0) {
+                continue;
+            }
+            int client = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                continue;
+            }
+            set_socket_timeout(client, 2.0);
+            serve(client);
+            ::close(client);
+        }
+    }
+
+    void serve(int client) {
+        std::string request;
+        char chunk[512];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            ssize_t received = ::recv(client, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                return;
+            }
+            request.append(chunk, static_cast<std::size_t>(received));
+        }
+
+        std::string status = "404 Not Found";
+        std::string body = "not found\n";
+        if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET /metrics?", 0) == 0) {
+            status = "200 OK";
+            body = format_prometheus(metrics_.snapshot());
+        }
+        std::string response = "HTTP/1.0 " + status +
+                               "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                               std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        const char* data = response.data();
+        std::size_t remaining = response.size();
+        while (remaining > 0) {
+            ssize_t written = ::send(client, data, remaining, MSG_NOSIGNAL);
+            if (written <= 0) {
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                log_.log(LOG_DEBUG, "metrics client went away: %s", std::strerror(errno));
+                return;
+            }
+            data += written;
+            remaining -= static_cast<std::size_t>(written);
+        }
+    }
+
+    const MetricsRegistry& metrics_;
+    const AuthLogger& log_;
+    int fd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+void install_signal_handlers() {
+    struct sigaction action {};
+    action.sa_handler = handle_stop_signal;
+    sigemptyset(&action.sa_mask);
+    // No SA_RESTART so accept() returns EINTR and the loop can exit.
+    action.sa_flags = 0;
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool foreground = false;
+    std::string socket_override;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--foreground") {
+            foreground = true;
+        } else if (arg == "--socket" && i + 1 < argc) {
+            socket_override = argv[++i];
+        } else if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            std::cerr << "Error: Unknown option '" << arg << "'\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    openlog("lxfud", LOG_PID | (foreground ? LOG_PERROR : 0), LOG_AUTHPRIV);
+    AuthLogger log = make_daemon_logger();
+
+    try {
+        Config config = load_config(false);
+        std::string socket_path = socket_override.empty()
+            ? config.get("daemon_socket", kDefaultDaemonSocket)
+            : socket_override;
+
+        install_signal_handlers();
+        // Threads started from here on (inference scheduler, detection pool,
+        // libtorch's workers) inherit a mask without SIGTERM/SIGINT; the main
+        // thread unblocks them just before accept(), so a stop signal always
+        // interrupts it.
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGTERM);
+        sigaddset(&stop_signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+        const auto load_start = std::chrono::steady_clock::now();
+        const DaemonSettings settings = DaemonSettings::from_config(config);
+        DaemonState state(config, settings);
+        log.log(LOG_INFO, "model loaded and warmed up in %.0f ms",
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count());
+        const InferenceBatchSettings batching = InferenceBatchSettings::from_config(config);
+        log.log(LOG_INFO, "up to %zu concurrent sessions, %zu detection worker(s), batches of %zu within %.1f ms",
+                settings.max_sessions, state.detection_workers(), batching.max_batch, batching.max_wait_ms);
+        if (!state.detector_ready()) {
+            log.log(LOG_WARNING, "face detector not available; using full frame");
+        }
+
+        std::unique_ptr<MetricsServer> metrics_server;
+        std::string metrics_listen = config.get("metrics_listen", "");
+        if (!metrics_listen.empty()) {
+            metrics_server = std::make_unique<MetricsServer>(metrics_listen, state.metrics(), log);
+            log.log(LOG_INFO, "serving Prometheus metrics on %s/metrics", metrics_listen.c_str());
+        }
+
+        int listen_fd = open_listen_socket(socket_path);
+        SessionRunner sessions(state, log, settings.max_sessions);
+        ModelSettings model = ModelSettings::from_config(config);
+        log.log(LOG_INFO, "listening on %s (model %s, %s)", socket_path.c_str(), model.file().c_str(),
+                model_precision_name(model.precision));
+        pthread_sigmask(SIG_UNBLOCK, &stop_signals, nullptr);
+
+        while (!g_stop_requested) {
+            int client_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                log.log(LOG_ERR, "accept failed: %s", std::strerror(errno));
+                continue;
+            }
+            sessions.start(client_fd);
+        }
+
+        ::close(listen_fd);
+        ::unlink(socket_path.c_str());
+        log.log(LOG_INFO, "shutting down");
+    } catch (const std::exception& ex) {
+        log.log(LOG_ERR, "fatal: %s", ex.what());
+        closelog();
+        return 1;
+    }
+
+    closelog();
+    return 0;
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Always-on latency instrumentation for authentication.
+//
+// A StageClock collects per-stage durations while one authentication runs
+// (from the capture producer, the detector workers and the embedding thread),
+// the result travels with the AuthResult as plain StageTimings, and lxfud
+// keeps the most recent ones in a preallocated ring for percentiles.
+
+enum class Stage : std::size_t {
+    CameraOpen,
+    CameraWarmup,
+    FrameRead,
+    Detect,
+    BatchWait,
+    Preprocess,
+    Forward,
+    Snapshot,
+    Score,
+    Total,
+};
+
+constexpr std::size_t kStageCount = static_cast<std::size_t>(Stage::Total) + 1;
+
+inline const char* stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::CameraOpen: return "camera_open";
+        case Stage::CameraWarmup: return "camera_warmup";
+        case Stage::FrameRead: return "frame_read";
+        case Stage::Detect: return "detect";
+        case Stage::BatchWait: return "batch_wait";
+        case Stage::Preprocess: return "preprocess";
+        case Stage::Forward: return "forward";
+        case Stage::Snapshot: return "snapshot";
+        case Stage::Score: return "score";
+        case Stage::Total: return "total";
+    }
+    return "unknown";
+}
+
+// Time spent in each stage during one authentication, summed over calls
+// (a stage such as frame_read runs once per frame).
+struct StageTimings {
+    std::array<double, kStageCount> ms{};
+    std::array<std::uint32_t, kStageCount> calls{};
+
+    double at(Stage stage) const { return ms[static_cast<std::size_t>(stage)]; }
+    std::uint32_t count(Stage stage) const { return calls[static_cast<std::size_t>(stage)]; }
+
+    // "total_ms=812.3 camera_open_ms=120.1 frame_read_ms=45.2 frame_read_n=15 ...",
+    // skipping stages that did not run.
+    std::string summary() const {
+        std::string out;
+        char field[64];
+        for (std::size_t i = 0; i < kStageCount; ++i) {
+            // Total first, then the stages in pipeline order.
+            const std::size_t index = (i + kStageCount - 1) % kStageCount;
+            if (calls[index] == 0) {
+                continue;
+            }
+            const char* name = stage_name(static_cast<Stage>(index));
+            std::snprintf(field, sizeof(field), "%s%s_ms=%.1f", out.empty() ? "" : " ", name, ms[index]);
+            out += field;
+            if (calls[index] > 1) {
+                std::snprintf(field, sizeof(field), " %s_n=%u", name, calls[index]);
+                out += field;
+            }
+        }
+        return out;
+    }
+};
+
+// Accumulates stage durations; safe to update from several threads.
+class StageClock {
+public:
+    void add(Stage stage, std::chrono::steady_clock::duration elapsed) {
+        const auto index = static_cast<std::size_t>(stage);
+        ns_[index].fetch_add(static_cast<std::uint64_t>(
+                                 std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+                             std::memory_order_relaxed);
+        calls_[index].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    StageTimings timings() const {
+        StageTimings timings;
+        for (std::size_t i = 0; i < kStageCount; ++i) {
+            timings.ms[i] = static_cast<double>(ns_[i].load(std::memory_order_relaxed)) / 1e6;
+            timings.calls[i] = calls_[i].load(std::memory_order_relaxed);
+        }
+        return timings;
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, kStageCount> ns_{};
+    std::array<std::atomic<std::uint32_t>, kStageCount> calls_{};
+};
+
+// Adds the lifetime of the scope to `clock`; does nothing when clock is null.
+class StageTimer {
+public:
+    StageTimer(StageClock* clock, Stage stage)
+        : clock_(clock), stage_(stage), start_(clock ? std::chrono::steady_clock::now()
+                                                     : std::chrono::steady_clock::time_point{}) {}
+
+    ~StageTimer() {
+        if (clock_) {
+            clock_->add(stage_, std::chrono::steady_clock::now() - start_);
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    StageClock* clock_;
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+struct StageSummary {
+    Stage stage = Stage::Total;
+    // Percentiles over the recent window, in milliseconds.
+    std::size_t samples = 0;
+    double p50 = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+    // Since the daemon started.
+    double sum_ms = 0.0;
+    std::uint64_t count = 0;
+};
+
+struct MetricsSnapshot {
+    std::uint64_t authentications = 0;
+    std::vector<StageSummary> stages;
+    std::map<std::string, std::uint64_t> outcomes;
+};
+
+// Stage timings of the last `capacity` authentications plus lifetime totals.
+class MetricsRegistry {
+public:
+    static constexpr std::size_t kDefaultCapacity = 1024;
+
+    explicit MetricsRegistry(std::size_t capacity = kDefaultCapacity)
+        : ring_(std::max<std::size_t>(1, capacity)) {}
+
+    void record(const StageTimings& timings, const std::string& outcome) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Record& slot = ring_[next_];
+        for (std::size_t i = 0; i < kStageCount; ++i) {
+            slot.ms[i] = timings.calls[i] > 0 ? static_cast<float>(timings.ms[i]) : kNotRun;
+            if (timings.calls[i] > 0) {
+                sum_ms_[i] += timings.ms[i];
+                ++count_[i];
+            }
+        }
+        next_ = (next_ + 1) % ring_.size();
+        size_ = std::min(size_ + 1, ring_.size());
+        ++authentications_;
+        ++outcomes_[outcome];
+    }
+
+    // Stages that ran at least once, in pipeline order.
+    MetricsSnapshot snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        MetricsSnapshot snapshot;
+        snapshot.authentications = authentications_;
+        snapshot.outcomes = outcomes_;
+        std::vector<float> values;
+        values.reserve(size_);
+        for (std::size_t i = 0; i < kStageCount; ++i) {
+            if (count_[i] == 0) {
+                continue;
+            }
+            values.clear();
+            for (std::size_t r = 0; r < size_; ++r) {
+                if (ring_[r].ms[i] != kNotRun) {
+                    values.push_back(ring_[r].ms[i]);
+                }
+            }
+            StageSummary summary;
+            summary.stage = static_cast<Stage>(i);
+            summary.samples = values.size();
+            summary.sum_ms = sum_ms_[i];
+            summary.count = count_[i];
+            if (!values.empty()) {
+                std::sort(values.begin(), values.end());
+                summary.p50 = percentile(values, 0.50);
+                summary.p90 = percentile(values, 0.90);
+                summary.p99 = percentile(values, 0.99);
+                summary.max = values.back();
+            }
+            snapshot.stages.push_back(summary);
+        }
+        return snapshot;
+    }
+
+private:
+    static constexpr float kNotRun = -1.0f;
+
+    struct Record {
+        std::array<float, kStageCount> ms{};
+    };
+
+    // Nearest-rank percentile of sorted values.
+    static double percentile(const std::vector<float>& sorted, double q) {
+        std::size_t rank = static_cast<std::size_t>(q * static_cast<double>(sorted.size()) + 0.999999);
+        return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<Record> ring_;
+    std::size_t next_ = 0;
+    std::size_t size_ = 0;
+    std::uint64_t authentications_ = 0;
+    std::array<double, kStageCount> sum_ms_{};
+    std::array<std::uint64_t, kStageCount> count_{};
+    std::map<std::string, std::uint64_t> outcomes_;
+};
+
+// Prometheus text exposition (format 0.0.4) of a snapshot.
+inline std::string format_prometheus(const MetricsSnapshot& snapshot) {
+    std::string out;
+    char line[160];
+    out += "# HELP lxfu_auth_stage_seconds Time per authentication spent in each stage "
+           "(quantiles over recent authentications).\n";
+    out += "# TYPE lxfu_auth_stage_seconds summary\n";
+    for (const auto& stage : snapshot.stages) {
+        const char* name = stage_name(stage.stage);
+        const std::pair<const char*, double> quantiles[] = {{"0.5", stage.p50}, {"0.9", stage.p90}, {"0.99", stage.p99}};
+        for (const auto& [quantile, ms] : quantiles) {
+            std::snprintf(line, sizeof(line), "lxfu_auth_stage_seconds{stage=\"%s\",quantile=\"%s\"} %.6f\n",
+                          name, quantile, ms / 1000.0);
+            out += line;
+        }
+        std::snprintf(line, sizeof(line), "lxfu_auth_stage_seconds_sum{stage=\"%s\"} %.6f\n", name,
+                      stage.sum_ms / 1000.0);
+        out += line;
+        std::snprintf(line, sizeof(line), "lxfu_auth_stage_seconds_count{stage=\"%s\"} %llu\n", name,
+                      static_cast<unsigned long long>(stage.count));
+        out += line;
+    }
+    out += "# HELP lxfu_auth_requests_total Authentications handled, by outcome.\n";
+    out += "# TYPE lxfu_auth_requests_total counter\n";
+    for (const auto& [outcome, count] : snapshot.outcomes) {
+        std::snprintf(line, sizeof(line), "lxfu_auth_requests_total{outcome=\"%s\"} %llu\n", outcome.c_str(),
+                      static_cast<unsigned long long>(count));
+        out += line;
+    }
+    return out;
+}
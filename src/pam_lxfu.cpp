@@ -1,20 +1,20 @@
-#include "face_engine.hpp"
-#include "face_detector.hpp"
+#include "face_auth.hpp"
+#include "daemon_protocol.hpp"
 #include "config.hpp"
-#include "lmdb_store.hpp"
 
 #include <security/pam_appl.h>
 #include <security/pam_ext.h>
 #include <security/pam_modules.h>
 
-#include <opencv2/imgcodecs.hpp>
-#include <opencv2/videoio.hpp>
-
+#include <pthread.h>
+#include <signal.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cctype>
 #include <exception>
+#include <map>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -24,10 +24,17 @@
 #include <numeric>
 #include <tuple>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 namespace {
 
+// Extra time granted to lxfud beyond the capture window before giving up on it.
+constexpr double kDaemonResponseSlackSeconds = 30.0;
+
+enum class DaemonMode { Auto, Always, Never };
+
 struct ModuleOptions {
     std::optional<std::string> source_path;
     std::optional<std::string> device_path;
@@ -40,6 +47,10 @@ struct ModuleOptions {
     double warmup_delay_seconds = 0.0;
     double capture_duration_seconds = 2.0;
     double frame_interval_seconds = 0.1;
+    int detector_threads = 1;
+    EarlyExitPolicy early_exit;
+    DaemonMode daemon_mode = DaemonMode::Auto;
+    std::optional<std::string> socket_path;
 };
 
 ModuleOptions parse_options(pam_handle_t* pamh, int argc, const char** argv) {
@@ -129,6 +140,55 @@ ModuleOptions parse_options(pam_handle_t* pamh, int argc, const char** argv) {
             } catch (const std::exception&) {
                 pam_syslog(pamh, LOG_WARNING, "pam_lxfu: invalid frame_interval '%s'", value.c_str());
             }
+        } else if (key == "detector_threads") {
+            try {
+                int threads = std::stoi(value);
+                if (threads < 1) {
+                    pam_syslog(pamh, LOG_WARNING, "pam_lxfu: detector_threads must be >=1, received %d", threads);
+                } else {
+                    opts.detector_threads = threads;
+                }
+            } catch (const std::exception&) {
+                pam_syslog(pamh, LOG_WARNING, "pam_lxfu: invalid detector_threads '%s'", value.c_str());
+            }
+        } else if (key == "early_accept" || key == "early_reject") {
+            try {
+                int frames = std::stoi(value);
+                if (frames < 0) {
+                    pam_syslog(pamh, LOG_WARNING, "pam_lxfu: %s must be >=0, received %d", key.c_str(), frames);
+                } else if (key == "early_accept") {
+                    opts.early_exit.accept_frames = static_cast<std::size_t>(frames);
+                } else {
+                    opts.early_exit.reject_frames = static_cast<std::size_t>(frames);
+                }
+            } catch (const std::exception&) {
+                pam_syslog(pamh, LOG_WARNING, "pam_lxfu: invalid %s '%s'", key.c_str(), value.c_str());
+            }
+        } else if (key == "reject_margin") {
+            try {
+                double margin = std::stod(value);
+                if (margin < 0.0) {
+                    pam_syslog(pamh, LOG_WARNING, "pam_lxfu: reject_margin must be >=0, received %f", margin);
+                } else {
+                    opts.early_exit.reject_margin = margin;
+                }
+            } catch (const std::exception&) {
+                pam_syslog(pamh, LOG_WARNING, "pam_lxfu: invalid reject_margin '%s'", value.c_str());
+            }
+        } else if (key == "daemon") {
+            std::string lowered = value;
+            std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); });
+            if (lowered == "auto") {
+                opts.daemon_mode = DaemonMode::Auto;
+            } else if (lowered == "1" || lowered == "true" || lowered == "yes" || lowered == "always") {
+                opts.daemon_mode = DaemonMode::Always;
+            } else if (lowered == "0" || lowered == "false" || lowered == "no" || lowered == "never") {
+                opts.daemon_mode = DaemonMode::Never;
+            } else {
+                pam_syslog(pamh, LOG_WARNING, "pam_lxfu: invalid daemon mode '%s'", value.c_str());
+            }
+        } else if (key == "socket") {
+            opts.socket_path = value;
         } else {
             pam_syslog(pamh, LOG_WARNING, "pam_lxfu: unknown option '%s'", key.c_str());
         }
@@ -142,346 +202,297 @@ ModuleOptions parse_options(pam_handle_t* pamh, int argc, const char** argv) {
     return opts;
 }
 
-bool parse_device_index(const std::string& path, int& index) {
-    if (path.rfind("/dev/video", 0) != 0) {
-        return false;
-    }
-    try {
-        index = std::stoi(path.substr(10));
-        return true;
-    } catch (const std::exception&) {
-        return false;
-    }
+AuthRequest make_auth_request(const std::string& username, const ModuleOptions& opts, const Config& config) {
+    AuthRequest req;
+    req.username = username;
+    req.target_name = opts.target_name;
+    req.source_path = opts.source_path;
+    req.device_paths = parse_device_list(opts.device_path.value_or(config.get("default_device", "/dev/video0")));
+    req.embeddings_path = config.get_embeddings_path();
+    req.threshold = opts.threshold;
+    req.debug = opts.debug;
+    req.allow_all = opts.allow_all;
+    req.warmup_delay_seconds = opts.warmup_delay_seconds;
+    req.capture_duration_seconds = opts.capture_duration_seconds;
+    req.frame_interval_seconds = opts.frame_interval_seconds;
+    req.detector_threads = static_cast<std::size_t>(opts.detector_threads);
+    req.early_exit = opts.early_exit;
+    // Debug logging reports max similarity, which needs every sample.
+    req.profile_means = config.get_bool("profile_means", true) && !opts.debug;
+    req.ann = AnnSettings::from_config(config);
+    return req;
 }
 
-bool open_video_capture(cv::VideoCapture& cap, const std::string& source, pam_handle_t* pamh, bool debug) {
-    cap.release();
+AuthLogger make_pam_logger(pam_handle_t* pamh) {
+    return AuthLogger([pamh](int priority, const char* message) {
+        pam_syslog(pamh, priority, "pam_lxfu: %s", message);
+    });
+}
 
-    if (cap.open(source, cv::CAP_V4L2)) {
-        if (debug) {
-            pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: opened device '%s' via CAP_V4L2", source.c_str());
-        }
-        return true;
-    }
-    if (cap.open(source)) {
-        if (debug) {
-            pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: opened device '%s' via default backend", source.c_str());
-        }
-        return true;
+int to_pam_status(AuthStatus status) {
+    switch (status) {
+        case AuthStatus::Success: return PAM_SUCCESS;
+        case AuthStatus::NoMatch: return PAM_AUTH_ERR;
+        case AuthStatus::Unavailable: return PAM_AUTHINFO_UNAVAIL;
     }
+    return PAM_AUTHINFO_UNAVAIL;
+}
 
-    int index = -1;
-    if (parse_device_index(source, index) && cap.open(index)) {
-        if (debug) {
-            pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: opened device '%s' via numeric index %d", source.c_str(), index);
-        }
-        return true;
+// The model and the detectors stay resident between authentications, since
+// loading them costs more than a login. Concurrent logins in one host share
+// them: DeviceDetectors leases a detector per login, and FaceEngine runs one
+// extract_embeddings() call at a time. Screen lockers and display managers
+// keep the module loaded for days, though, so after model_idle_release_seconds
+// without an authentication a background thread frees them and returns the
+// memory to the system (0 keeps them for the life of the process).
+struct ResidentModel {
+    FaceEngine engine;
+    DeviceDetectors detectors;
+    std::string model_path;
+    ModelPrecision precision;
+
+    ResidentModel(const ModelSettings& model, const FaceDetectorSettings& detection)
+        : engine(model, /*verbose=*/false), detectors(detection), model_path(model.file()),
+          precision(model.precision) {}
+
+    bool matches(const ModelSettings& model) const {
+        return model_path == model.file() && precision == model.precision;
     }
+};
 
-    pam_syslog(pamh, LOG_ERR, "pam_lxfu: failed to open capture device '%s'", source.c_str());
-    return false;
-}
+class ResidentModelCache {
+public:
+    // Keeps the resident model alive, and the idle timer stopped, while held.
+    class Lease {
+    public:
+        Lease(ResidentModelCache& cache, std::shared_ptr<ResidentModel> model)
+            : cache_(cache), model_(std::move(model)) {}
+        ~Lease() {
+            model_.reset();
+            cache_.release();
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
 
-void apply_camera_defaults(cv::VideoCapture& cap) {
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, 640);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, 480);
-    cap.set(cv::CAP_PROP_FPS, 30);
-}
+        ResidentModel* operator->() const { return model_.get(); }
 
-void warm_up_camera(cv::VideoCapture& cap, double warmup_delay_seconds, pam_handle_t* pamh, bool debug) {
-    cv::Mat dummy;
-    const int default_warmup_frames = 12;
+    private:
+        ResidentModelCache& cache_;
+        std::shared_ptr<ResidentModel> model_;
+    };
 
-    if (warmup_delay_seconds <= 0.0) {
-        for (int i = 0; i < default_warmup_frames; ++i) {
-            if (!cap.read(dummy) || dummy.empty()) {
-                break;
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(30));
-        }
-        return;
+    static ResidentModelCache& instance() {
+        static ResidentModelCache cache;
+        return cache;
     }
 
-    auto start = std::chrono::steady_clock::now();
-    const auto warmup_duration = std::chrono::duration<double>(warmup_delay_seconds);
-    int frames_read = 0;
-    while (std::chrono::steady_clock::now() - start < warmup_duration) {
-        if (!cap.read(dummy) || dummy.empty()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(30));
-            continue;
+    ~ResidentModelCache() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        if (reaper_ && reaper_->joinable()) {
+            reaper_->join();
         }
-        ++frames_read;
-        std::this_thread::sleep_for(std::chrono::milliseconds(30));
-    }
-    if (debug) {
-        pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: warmup captured %d frames over %.2fs", frames_read, warmup_delay_seconds);
-    }
-}
-
-std::vector<cv::Mat> capture_faces_from_device(const std::string& device,
-                                               const ModuleOptions& opts,
-                                               pam_handle_t* pamh,
-                                               FaceDetector& detector) {
-    cv::VideoCapture cap;
-    if (!open_video_capture(cap, device, pamh, opts.debug)) {
-        throw std::runtime_error("capture device open failure");
     }
 
-    apply_camera_defaults(cap);
-    warm_up_camera(cap, opts.warmup_delay_seconds, pamh, opts.debug);
-
-    const double capture_duration = std::max(0.0, opts.capture_duration_seconds);
-    const double frame_interval = std::max(0.0, opts.frame_interval_seconds);
-    const auto start_time = std::chrono::steady_clock::now();
-    const int max_faces = 60;
-
-    std::vector<cv::Mat> face_images;
-    std::vector<cv::Mat> fallback_frames;
-
-    int total_frames = 0;
-    int frames_with_faces = 0;
-    int consecutive_failures = 0;
-    const int max_consecutive_failures = 20;
-
-    while (true) {
-        if (capture_duration > 0.0) {
-            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
-            if (elapsed >= capture_duration) {
-                break;
+    Lease acquire(const Config& config) {
+        const ModelSettings model = ModelSettings::from_config(config);
+        const double idle_seconds = std::max(0.0, config.get_double("model_idle_release_seconds", 300.0));
+
+        std::shared_ptr<ResidentModel> resident;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(idle_seconds));
+            ++active_;
+            if (resident_ && resident_->matches(model)) {
+                resident = resident_;
             }
-        } else if (total_frames > 0) {
-            break;
         }
-
-        cv::Mat frame;
-        if (!cap.read(frame) || frame.empty()) {
-            ++consecutive_failures;
-            if (opts.debug && (consecutive_failures == 1 || consecutive_failures % 5 == 0)) {
-                pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: failed to capture frame (%d)", consecutive_failures);
-            }
-            if (consecutive_failures >= max_consecutive_failures) {
-                break;
+        if (!resident) {
+            // Loaded outside the lock so fork() and the reaper never wait on it.
+            try {
+                resident = std::make_shared<ResidentModel>(model, FaceDetectorSettings::from_config(config));
+            } catch (...) {
+                release();
+                throw;
             }
-            if (frame_interval > 0.0) {
-                std::this_thread::sleep_for(std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::duration<double>(frame_interval)));
+            std::shared_ptr<ResidentModel> replaced; // freed after the lock is dropped
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (resident_ && resident_->matches(model)) {
+                    resident = resident_; // a concurrent login loaded it first
+                } else {
+                    replaced = std::move(resident_);
+                    resident_ = resident;
+                }
             }
-            continue;
         }
-
-        consecutive_failures = 0;
-        ++total_frames;
-
-        auto face = detector.crop_to_face(frame);
-        if (face) {
-            face_images.push_back(*face);
-            ++frames_with_faces;
-        } else if (face_images.empty()) {
-            fallback_frames.push_back(frame);
-        }
-
-        if (face_images.size() >= static_cast<std::size_t>(max_faces)) {
-            break;
-        }
-
-        if (frame_interval > 0.0) {
-            std::this_thread::sleep_for(std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::duration<double>(frame_interval)));
+        if (idle_seconds > 0.0) {
+            start_reaper();
         }
+        return Lease(*this, std::move(resident));
     }
 
-    cap.release();
-
-    if (face_images.empty() && !fallback_frames.empty()) {
-        if (auto face = detector.crop_to_face(fallback_frames.back())) {
-            face_images.push_back(*face);
-        }
+private:
+    ResidentModelCache() {
+        // The reaper thread does not survive fork(); the child starts its
+        // own on its next authentication.
+        ::pthread_atfork([] { instance().mutex_.lock(); },
+                         [] { instance().mutex_.unlock(); },
+                         [] {
+                             ResidentModelCache& cache = instance();
+                             cache.reaper_.release(); // joining it would abort
+                             cache.reaper_running_ = false;
+                             cache.mutex_.unlock();
+                         });
     }
 
-    if (opts.debug) {
-        pam_syslog(pamh, LOG_DEBUG,
-                   "pam_lxfu: captured %d frames, %d with detected faces",
-                   total_frames, frames_with_faces);
-    }
-
-    return face_images;
-}
-
-std::vector<cv::Mat> load_faces(const ModuleOptions& opts,
-                                pam_handle_t* pamh,
-                                const Config& config,
-                                FaceDetector& detector) {
-    if (opts.source_path) {
-        cv::Mat image = cv::imread(*opts.source_path);
-        if (image.empty()) {
-            pam_syslog(pamh, LOG_ERR, "pam_lxfu: failed to load image '%s'", opts.source_path->c_str());
-            throw std::runtime_error("image load failure");
-        }
-        auto face = detector.crop_to_face(image);
-        if (!face) {
-            pam_syslog(pamh, LOG_WARNING, "pam_lxfu: no face detected in source image '%s'", opts.source_path->c_str());
-            return {};
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --active_;
+            last_used_ = std::chrono::steady_clock::now();
         }
-        return { *face };
-    }
-
-    std::string device = opts.device_path.value_or(config.get("default_device", "/dev/video0"));
-    if (opts.debug) {
-        pam_syslog(pamh, LOG_DEBUG,
-                   "pam_lxfu: capturing from device '%s' (duration %.2fs, frame_interval %.2fs, warmup %.2fs)",
-                   device.c_str(),
-                   std::max(0.0, opts.capture_duration_seconds),
-                   std::max(0.0, opts.frame_interval_seconds),
-                   std::max(0.0, opts.warmup_delay_seconds));
-    }
-    return capture_faces_from_device(device, opts, pamh, detector);
-}
-
-FaceDetector& shared_face_detector() {
-    static FaceDetector detector(/*verbose=*/false);
-    return detector;
-}
-
-FaceEngine& shared_face_engine(const std::string& model_path) {
-    static std::unique_ptr<FaceEngine> engine;
-    static std::string cached_model_path;
-
-    if (!engine || cached_model_path != model_path) {
-        engine = std::make_unique<FaceEngine>(model_path, /*verbose=*/false);
-        cached_model_path = model_path;
-    }
-    return *engine;
-}
-
-int match_user_with_face(pam_handle_t* pamh, const std::string& username, const ModuleOptions& opts) {
-    Config config = load_config(false);
-
-    FaceDetector& detector = shared_face_detector();
-    if (!detector.is_initialized()) {
-        pam_syslog(pamh, LOG_WARNING, "pam_lxfu: face detector not available; using full frame");
+        wake_.notify_all();
     }
 
-    std::vector<cv::Mat> face_images;
-    try {
-        face_images = load_faces(opts, pamh, config, detector);
-    } catch (const std::exception& ex) {
-        pam_syslog(pamh, LOG_ERR, "pam_lxfu: capture error: %s", ex.what());
-        return PAM_AUTHINFO_UNAVAIL;
-    }
-
-    if (face_images.empty()) {
-        pam_syslog(pamh, LOG_INFO, "pam_lxfu: no valid face frames captured");
-        return PAM_AUTH_ERR;
-    }
-
-    FaceEngine& engine = shared_face_engine(config.get("model_path"));
-
-    std::vector<std::vector<float>> query_embeddings;
-    query_embeddings.reserve(face_images.size());
-    for (const auto& face : face_images) {
-        std::vector<float> embedding = engine.extract_embedding(face);
-        if (!embedding.empty()) {
-            query_embeddings.push_back(std::move(embedding));
+    void start_reaper() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (reaper_running_ || stop_) {
+            return;
         }
+        // Signals stay with the host's own threads.
+        sigset_t all;
+        sigset_t previous;
+        sigfillset(&all);
+        ::pthread_sigmask(SIG_BLOCK, &all, &previous);
+        reaper_ = std::make_unique<std::thread>([this] { reap(); });
+        ::pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        reaper_running_ = true;
     }
 
-    if (query_embeddings.empty()) {
-        pam_syslog(pamh, LOG_ERR, "pam_lxfu: embedding extraction failed for captured frames");
-        return PAM_AUTHINFO_UNAVAIL;
-    }
-
-    LMDBStore store(config.get_embeddings_path(), LMDBStore::Mode::ReadOnly);
-    auto entries = store.get_all_embeddings();
-    if (entries.empty()) {
-        pam_syslog(pamh, LOG_WARNING, "pam_lxfu: no enrolled profiles available");
-        return PAM_AUTHINFO_UNAVAIL;
-    }
-
-    auto compute_best = [&](const std::vector<std::pair<std::string, LMDBStore::EmbeddingList>>& profiles,
-                            const std::optional<std::string>& target)
-        -> std::tuple<std::string, float, float> {
-        float best_avg = -1.0f;
-        float best_max = -1.0f;
-        std::string best_name;
-
-        for (const auto& [name, embeddings] : profiles) {
-            if (target && name != *target) {
+    void reap() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            if (!resident_ || active_ > 0 || idle_ == std::chrono::steady_clock::duration::zero()) {
+                wake_.wait(lock);
                 continue;
             }
-            if (embeddings.empty()) {
-                continue;
-            }
-
-            bool dimension_mismatch = std::any_of(
-                embeddings.begin(), embeddings.end(),
-                [&](const auto& emb) {
-                    return emb.size() != query_embeddings.front().size();
-                });
-            if (dimension_mismatch) {
+            const auto deadline = last_used_ + idle_;
+            if (std::chrono::steady_clock::now() < deadline) {
+                wake_.wait_until(lock, deadline);
                 continue;
             }
+            std::shared_ptr<ResidentModel> expired = std::move(resident_);
+            lock.unlock();
+            expired.reset();
+            release_cached_memory();
+            lock.lock();
+        }
+    }
 
-            double sum_similarity = 0.0;
-            float max_similarity = -1.0f;
-            std::size_t count = 0;
-
-            for (const auto& stored : embeddings) {
-                for (const auto& query_emb : query_embeddings) {
-                    float sim = std::inner_product(query_emb.begin(), query_emb.end(),
-                                                   stored.begin(), 0.0f);
-                    sim = (sim + 1.0f) * 0.5f;
-                    sum_similarity += static_cast<double>(sim);
-                    max_similarity = std::max(max_similarity, sim);
-                    ++count;
-                }
-            }
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::shared_ptr<ResidentModel> resident_;
+    std::size_t active_ = 0;
+    std::chrono::steady_clock::time_point last_used_ = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration idle_{};
+    bool stop_ = false;
+    bool reaper_running_ = false;
+    std::unique_ptr<std::thread> reaper_;
+};
 
-            if (count == 0) {
-                continue;
-            }
+// Read-only environments stay open for the life of the host process (screen
+// lockers authenticate many times), so retries and later calls only open a
+// read transaction. Snapshots and the ANN index cache key on LMDB's txn id,
+// so writes by `lxfu enroll` are still seen immediately.
+class SharedStores {
+public:
+    static SharedStores& instance() {
+        static SharedStores stores;
+        return stores;
+    }
 
-            float avg_similarity = static_cast<float>(sum_similarity / static_cast<double>(count));
-            if (avg_similarity > best_avg) {
-                best_avg = avg_similarity;
-                best_max = max_similarity;
-                best_name = name;
+    // Opened under the lock: LMDB forbids opening one environment twice in
+    // a process, so concurrent logins must share the first one.
+    const LMDBStore& open(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (owner_ != ::getpid()) {
+            // An env must not be used, or closed, in a child after fork().
+            // The parent's are kept, unused, in inherited_: a process holds
+            // at most the envs its ancestors had open, however often the
+            // host forks.
+            for (auto& entry : stores_) {
+                inherited_.push_back(entry.second.release());
             }
+            stores_.clear();
+            owner_ = ::getpid();
         }
+        auto it = stores_.find(path);
+        if (it == stores_.end()) {
+            it = stores_.emplace(path, std::make_unique<LMDBStore>(path, LMDBStore::Mode::ReadOnly)).first;
+        }
+        return *it->second;
+    }
 
-        return {best_name, best_avg, best_max};
-    };
+private:
+    SharedStores() {
+        // Keep the lock consistent across fork(): a child must not inherit it
+        // held by a thread that does not exist there.
+        ::pthread_atfork([] { instance().mutex_.lock(); },
+                         [] { instance().mutex_.unlock(); },
+                         [] { instance().mutex_.unlock(); });
+    }
 
-    if (!opts.allow_all) {
-        std::string desired = opts.target_name.value_or(username);
-        auto [matched_name, avg_similarity, max_similarity] = compute_best(entries, desired);
-        if (avg_similarity < 0.0f) {
-            pam_syslog(pamh, LOG_INFO, "pam_lxfu: no match for requested name '%s'", desired.c_str());
-            return PAM_AUTH_ERR;
+    std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<LMDBStore>> stores_;
+    std::vector<LMDBStore*> inherited_;
+    pid_t owner_ = ::getpid();
+};
+
+int match_user_with_face(pam_handle_t* pamh, const std::string& username, const ModuleOptions& opts,
+                         const Config& config) {
+    AuthRequest req = make_auth_request(username, opts, config);
+    AuthLogger log = make_pam_logger(pamh);
+
+    if (opts.daemon_mode != DaemonMode::Never) {
+        std::string socket_path = opts.socket_path.value_or(config.get("daemon_socket", kDefaultDaemonSocket));
+        double timeout = std::max(0.0, opts.capture_duration_seconds) +
+                         std::max(0.0, opts.warmup_delay_seconds) +
+                         kDaemonResponseSlackSeconds;
+        std::string error;
+        if (auto result = request_daemon_auth(socket_path, req, timeout, error)) {
+            if (opts.debug) {
+                pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: lxfud answered '%s' (avg %.2f, %zu frame(s))",
+                           auth_status_name(result->status), result->avg_similarity, result->frames);
+            }
+            return to_pam_status(result->status);
         }
-        if (avg_similarity < static_cast<float>(opts.threshold)) {
-            pam_syslog(pamh, LOG_INFO, "pam_lxfu: similarity %.2f below threshold %.2f for '%s'",
-                       avg_similarity, opts.threshold, desired.c_str());
-            return PAM_AUTH_ERR;
+        if (opts.daemon_mode == DaemonMode::Always) {
+            pam_syslog(pamh, LOG_ERR, "pam_lxfu: lxfud unavailable: %s", error.c_str());
+            return PAM_AUTHINFO_UNAVAIL;
         }
         if (opts.debug) {
-            pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: user '%s' matched avg %.2f (max %.2f) using %zu frame(s)",
-                       desired.c_str(), avg_similarity, max_similarity, query_embeddings.size());
+            pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: lxfud unavailable (%s); authenticating in-process",
+                       error.c_str());
         }
-        return PAM_SUCCESS;
-    }
-
-    auto [best_name, best_avg, best_max] = compute_best(entries, std::nullopt);
-    if (best_name.empty() || best_avg < static_cast<float>(opts.threshold)) {
-        pam_syslog(pamh, LOG_INFO, "pam_lxfu: no profile exceeded threshold %.2f", opts.threshold);
-        return PAM_AUTH_ERR;
     }
 
-    if (opts.debug) {
-        pam_syslog(pamh, LOG_DEBUG, "pam_lxfu: matched profile '%s' avg %.2f (max %.2f) using %zu frame(s)",
-                   best_name.c_str(), best_avg, best_max, query_embeddings.size());
+    // Open and warm up the camera while the model and the database load.
+    AuthOptions options;
+    options.camera = CameraSettings::from_config(config);
+    PendingCameras cameras;
+    if (!req.source_path) {
+        cameras = start_auth_cameras(req, options.camera);
     }
-
-    return PAM_SUCCESS;
+    const LMDBStore& store = SharedStores::instance().open(req.embeddings_path);
+    ResidentModelCache::Lease model = ResidentModelCache::instance().acquire(config);
+    EngineEmbedder embedder(model->engine);
+    options.cameras = &cameras;
+    return to_pam_status(authenticate_face(req, model->detectors, embedder, store, log, options).status);
 }
 
 } // namespace
@@ -499,9 +510,13 @@ PAM_EXTERN int pam_sm_authenticate(pam_handle_t* pamh, int, int argc, const char
     }
 
     int attempts = std::max(1, opts.retries);
+    std::optional<Config> config;
     for (int attempt = 1; attempt <= attempts; ++attempt) {
         try {
-            int result = match_user_with_face(pamh, user, opts);
+            if (!config) {
+                config = load_config(false);
+            }
+            int result = match_user_with_face(pamh, user, opts, *config);
             if (result == PAM_SUCCESS) {
                 return PAM_SUCCESS;
             }
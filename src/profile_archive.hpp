@@ -0,0 +1,182 @@
+#pragma once
+
+#include "lmdb_store.hpp"
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Flat binary dump of enrolled profiles (`lxfu export` / `lxfu import`), so
+// machines can be seeded without re-running the model. Samples are always
+// written as float32; the importing store re-encodes them per storage_format.
+//
+//   "LXFUPROF"  uint32 version  uint32 profile_count
+//   per profile: uint32 name_len, name, uint32 sample_count, uint32 dim,
+//                sample_count * dim float32
+//
+// Integers and floats are in host byte order.
+
+struct ProfileArchiveStats {
+    std::size_t profiles = 0;
+    std::size_t samples = 0;
+};
+
+namespace profile_archive {
+
+constexpr char kMagic[8] = {'L', 'X', 'F', 'U', 'P', 'R', 'O', 'F'};
+constexpr std::uint32_t kVersion = 1;
+// Sanity limits so a corrupt file fails cleanly instead of allocating wildly.
+// A profile may hold at most kMaxProfileFloats (256 MiB) of samples, and never
+// more than the bytes left in a seekable stream.
+constexpr std::uint32_t kMaxNameBytes = 4096;
+constexpr std::uint32_t kMaxDim = 65536;
+constexpr std::uint32_t kMaxSamples = 1u << 20;
+constexpr std::uint64_t kMaxProfileFloats = std::uint64_t{1} << 26;
+
+inline void write_u32(std::ostream& out, std::uint32_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline std::uint32_t read_u32(std::istream& in) {
+    std::uint32_t value = 0;
+    in.read(reinterpret_cast<char*>(&value), sizeof(value));
+    if (!in) {
+        throw std::runtime_error("Truncated profile archive");
+    }
+    return value;
+}
+
+// Bytes left after the read position, or nullopt for a pipe.
+inline std::optional<std::uint64_t> remaining_bytes(std::istream& in) {
+    const std::streampos here = in.tellg();
+    if (here < 0) {
+        in.clear();
+        return std::nullopt;
+    }
+    in.seekg(0, std::ios::end);
+    const std::streampos end = in.tellg();
+    in.seekg(here);
+    if (!in || end < here) {
+        in.clear();
+        in.seekg(here);
+        return std::nullopt;
+    }
+    return static_cast<std::uint64_t>(end - here);
+}
+
+} // namespace profile_archive
+
+// Write every profile (or just `only`) from the snapshot. `out` must be seekable:
+// the profile count is patched in at the end.
+inline ProfileArchiveStats write_profile_archive(std::ostream& out, const LMDBStore::Snapshot& snapshot,
+                                                 const std::optional<std::string>& only = std::nullopt) {
+    using namespace profile_archive;
+    ProfileArchiveStats stats;
+    out.write(kMagic, sizeof(kMagic));
+    write_u32(out, kVersion);
+    const auto count_pos = out.tellp();
+    write_u32(out, 0);
+
+    std::string current;
+    LMDBStore::EmbeddingList samples;
+    auto flush = [&]() {
+        if (samples.empty()) {
+            return;
+        }
+        write_u32(out, static_cast<std::uint32_t>(current.size()));
+        out.write(current.data(), static_cast<std::streamsize>(current.size()));
+        write_u32(out, static_cast<std::uint32_t>(samples.size()));
+        write_u32(out, static_cast<std::uint32_t>(samples.front().size()));
+        for (const auto& sample : samples) {
+            out.write(reinterpret_cast<const char*>(sample.data()),
+                      static_cast<std::streamsize>(sample.size() * sizeof(float)));
+        }
+        ++stats.profiles;
+        stats.samples += samples.size();
+        samples.clear();
+    };
+
+    auto visit = [&](std::string_view name, const LMDBStore::EmbeddingView& view) {
+        if (name != current || samples.empty()) {
+            flush();
+            current.assign(name.data(), name.size());
+        }
+        if (!samples.empty() && samples.front().size() != view.dim) {
+            throw std::runtime_error("Inconsistent embedding dimension within profile '" + current + "'");
+        }
+        for (std::size_t i = 0; i < view.count; ++i) {
+            samples.emplace_back(view.dim);
+            view.decode_row(i, samples.back().data());
+        }
+    };
+    if (only) {
+        snapshot.for_each(*only, [&](const LMDBStore::EmbeddingView& view) { visit(*only, view); });
+    } else {
+        snapshot.for_each(visit);
+    }
+    flush();
+
+    const auto end_pos = out.tellp();
+    out.seekp(count_pos);
+    write_u32(out, static_cast<std::uint32_t>(stats.profiles));
+    out.seekp(end_pos);
+    if (!out) {
+        throw std::runtime_error("Failed to write profile archive");
+    }
+    return stats;
+}
+
+// fn(std::string name, LMDBStore::EmbeddingList samples) for each profile, in file order.
+template <typename Fn>
+ProfileArchiveStats read_profile_archive(std::istream& in, Fn&& fn) {
+    using namespace profile_archive;
+    char magic[sizeof(kMagic)];
+    in.read(magic, sizeof(magic));
+    if (!in || !std::equal(magic, magic + sizeof(magic), kMagic)) {
+        throw std::runtime_error("Not an lxfu profile archive");
+    }
+    const std::uint32_t version = read_u32(in);
+    if (version != kVersion) {
+        throw std::runtime_error("Unsupported profile archive version " + std::to_string(version));
+    }
+
+    ProfileArchiveStats stats;
+    const std::uint32_t profiles = read_u32(in);
+    for (std::uint32_t p = 0; p < profiles; ++p) {
+        const std::uint32_t name_len = read_u32(in);
+        if (name_len > kMaxNameBytes) {
+            throw std::runtime_error("Corrupt profile archive (name length)");
+        }
+        std::string name(name_len, '\0');
+        in.read(name.data(), static_cast<std::streamsize>(name.size()));
+        const std::uint32_t count = read_u32(in);
+        const std::uint32_t dim = read_u32(in);
+        const std::uint64_t floats = std::uint64_t{count} * dim;
+        if (count > kMaxSamples || dim == 0 || dim > kMaxDim || floats > kMaxProfileFloats) {
+            throw std::runtime_error("Corrupt profile archive (profile '" + name + "')");
+        }
+        const auto remaining = remaining_bytes(in);
+        if (!in || (remaining && floats * sizeof(float) > *remaining)) {
+            throw std::runtime_error("Truncated profile archive");
+        }
+        // Grown sample by sample, so a short pipe never costs more than it delivered.
+        LMDBStore::EmbeddingList samples;
+        samples.reserve(remaining ? count : 0);
+        for (std::uint32_t i = 0; i < count; ++i) {
+            LMDBStore::Embedding sample(dim);
+            in.read(reinterpret_cast<char*>(sample.data()), static_cast<std::streamsize>(dim * sizeof(float)));
+            if (!in) {
+                throw std::runtime_error("Truncated profile archive");
+            }
+            samples.push_back(std::move(sample));
+        }
+        ++stats.profiles;
+        stats.samples += count;
+        fn(std::move(name), std::move(samples));
+    }
+    return stats;
+}
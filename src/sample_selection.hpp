@@ -0,0 +1,122 @@
+#pragma once
+
+#include "config.hpp"
+#include "similarity.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Keeps enrolled profiles small and diverse: near-duplicate frames are
+// dropped on enroll and each profile is capped at a fixed number of samples.
+
+struct SampleLimits {
+    // Skip an incoming sample whose cosine similarity (1.0 = identical) to an
+    // existing or already accepted sample exceeds this; >= 1 disables.
+    double dedup_threshold = 0.97;
+    // Samples kept per profile (0 = unlimited). Over the cap, farthest-point
+    // selection keeps the most mutually distinct samples.
+    std::size_t max_samples = 200;
+
+    static SampleLimits none() { return {1.0, 0}; }
+
+    bool active() const { return dedup_threshold < 1.0 || max_samples > 0; }
+
+    static SampleLimits from_config(const Config& config) {
+        SampleLimits s;
+        s.dedup_threshold = config.get_double("enroll_dedup_threshold", s.dedup_threshold);
+        s.max_samples = static_cast<std::size_t>(
+            std::max(0, config.get_int("max_samples_per_profile", static_cast<int>(s.max_samples))));
+        return s;
+    }
+};
+
+// Indices of `incoming` to keep, in order: each must be no more similar than
+// `threshold` to any sample in `existing` or any incoming sample kept before it.
+inline std::vector<std::size_t> deduplicate_samples(const std::vector<std::vector<float>>& existing,
+                                                    const std::vector<std::vector<float>>& incoming,
+                                                    double threshold) {
+    std::vector<std::size_t> kept;
+    if (threshold >= 1.0) {
+        kept.resize(incoming.size());
+        for (std::size_t i = 0; i < kept.size(); ++i) {
+            kept[i] = i;
+        }
+        return kept;
+    }
+    const auto limit = static_cast<float>(threshold);
+    auto duplicate_of = [&](const std::vector<float>& sample, const std::vector<float>& other) {
+        return other.size() == sample.size() && similarity::dot(sample.data(), other.data(), sample.size()) > limit;
+    };
+    for (std::size_t i = 0; i < incoming.size(); ++i) {
+        const auto& sample = incoming[i];
+        bool duplicate = std::any_of(existing.begin(), existing.end(),
+                                     [&](const auto& other) { return duplicate_of(sample, other); }) ||
+                         std::any_of(kept.begin(), kept.end(),
+                                     [&](std::size_t k) { return duplicate_of(sample, incoming[k]); });
+        if (!duplicate) {
+            kept.push_back(i);
+        }
+    }
+    return kept;
+}
+
+// Greedy farthest-point selection of `count` samples, returned as sorted
+// indices. Starts from the sample most similar to the mean (the most typical
+// one), then repeatedly adds the sample least similar to everything chosen.
+inline std::vector<std::size_t> farthest_point_selection(const std::vector<std::vector<float>>& samples,
+                                                         std::size_t count) {
+    std::vector<std::size_t> chosen;
+    if (samples.empty() || count == 0) {
+        return chosen;
+    }
+    const std::size_t dim = samples.front().size();
+    if (count >= samples.size()) {
+        chosen.resize(samples.size());
+        for (std::size_t i = 0; i < chosen.size(); ++i) {
+            chosen[i] = i;
+        }
+        return chosen;
+    }
+
+    std::vector<float> mean(dim, 0.0f);
+    for (const auto& sample : samples) {
+        for (std::size_t d = 0; d < dim; ++d) {
+            mean[d] += sample[d];
+        }
+    }
+    std::size_t first = 0;
+    float best = -std::numeric_limits<float>::infinity();
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        float sim = similarity::dot(samples[i].data(), mean.data(), dim);
+        if (sim > best) {
+            best = sim;
+            first = i;
+        }
+    }
+
+    // nearest[i]: highest similarity of sample i to any chosen sample.
+    std::vector<float> nearest(samples.size(), -std::numeric_limits<float>::infinity());
+    std::vector<bool> taken(samples.size(), false);
+    std::size_t next = first;
+    while (chosen.size() < count) {
+        chosen.push_back(next);
+        taken[next] = true;
+        std::size_t farthest = next;
+        float farthest_sim = std::numeric_limits<float>::infinity();
+        for (std::size_t i = 0; i < samples.size(); ++i) {
+            if (taken[i]) {
+                continue;
+            }
+            nearest[i] = std::max(nearest[i], similarity::dot(samples[i].data(), samples[next].data(), dim));
+            if (nearest[i] < farthest_sim) {
+                farthest_sim = nearest[i];
+                farthest = i;
+            }
+        }
+        next = farthest;
+    }
+    std::sort(chosen.begin(), chosen.end());
+    return chosen;
+}
@@ -0,0 +1,566 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LXFU_SIMILARITY_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define LXFU_SIMILARITY_NEON 1
+#endif
+
+// Dot-product kernels for L2-normalized embeddings (dot == cosine similarity).
+//
+// The best implementation for the running CPU is picked once at first use:
+// AVX-512F, AVX2+FMA, NEON (aarch64 baseline) or portable scalar code.
+// Setting LXFU_SIMD=scalar|avx2|avx512 forces a specific backend, which is
+// handy for benchmarking and for ruling out a kernel when debugging.
+//
+// All kernels use unaligned loads, so rows may point straight into mapped
+// LMDB pages as well as into padded QueryBlock rows.
+//
+// Compactly stored samples (IEEE half, or int8 with a per-sample scale) are
+// scored against a float query by dot_f16/dot_i8 without expanding the row.
+namespace similarity {
+
+inline float half_to_float(std::uint16_t h) {
+    const std::uint32_t sign = static_cast<std::uint32_t>(h & 0x8000u) << 16;
+    std::uint32_t exp = (h >> 10) & 0x1fu;
+    std::uint32_t mant = h & 0x3ffu;
+    std::uint32_t bits;
+    if (exp == 0x1fu) {
+        bits = sign | 0x7f800000u | (mant << 13);
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112u) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half: normalise into a float exponent.
+        exp = 113u;
+        while ((mant & 0x400u) == 0) {
+            mant <<= 1;
+            --exp;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ffu) << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Round to nearest even, as F16C's vcvtps2ph does by default.
+inline std::uint16_t float_to_half(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+    const std::uint32_t float_exp = (bits >> 23) & 0xffu;
+    std::uint32_t mant = bits & 0x7fffffu;
+    if (float_exp == 0xffu) {
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (mant != 0 ? 0x200u : 0u));
+    }
+    const int exp = static_cast<int>(float_exp) - 127 + 15;
+    if (exp >= 0x1f) {
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+    if (exp <= 0) {
+        if (exp < -10) {
+            return sign;
+        }
+        mant |= 0x800000u;
+        const auto shift = static_cast<std::uint32_t>(14 - exp);
+        std::uint32_t half = mant >> shift;
+        const std::uint32_t rest = mant & ((1u << shift) - 1u);
+        const std::uint32_t halfway = 1u << (shift - 1u);
+        if (rest > halfway || (rest == halfway && (half & 1u))) {
+            ++half;
+        }
+        return static_cast<std::uint16_t>(sign | half);
+    }
+    std::uint32_t half = (static_cast<std::uint32_t>(exp) << 10) | (mant >> 13);
+    const std::uint32_t rest = mant & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) {
+        ++half; // may carry into the exponent, which is still correct
+    }
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+using DotFn = float (*)(const float* a, const float* b, std::size_t dim);
+// out[r] = dot(query, rows + r * row_stride)
+using DotManyFn = void (*)(const float* query, const float* rows, std::size_t row_count,
+                           std::size_t row_stride, std::size_t dim, float* out);
+// out[q * out_stride + r] = dot(queries + q * query_stride, rows + r * row_stride)
+using DotTileFn = void (*)(const float* queries, std::size_t query_count, std::size_t query_stride,
+                           const float* rows, std::size_t row_count, std::size_t row_stride,
+                           std::size_t dim, float* out, std::size_t out_stride);
+
+// dot(query, row) for rows stored as IEEE half or as unscaled int8.
+using DotF16Fn = float (*)(const float* query, const std::uint16_t* row, std::size_t dim);
+using DotI8Fn = float (*)(const float* query, const std::int8_t* row, std::size_t dim);
+
+struct Kernels {
+    const char* name;
+    DotFn dot;
+    DotManyFn dot_many;
+    DotTileFn dot_tile;
+    DotF16Fn dot_f16;
+    DotI8Fn dot_i8;
+};
+
+namespace detail {
+
+inline float dot_scalar(const float* a, const float* b, std::size_t dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    std::size_t i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < dim; ++i) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+inline float dot_f16_scalar(const float* query, const std::uint16_t* row, std::size_t dim) {
+    float sum = 0.0f;
+    for (std::size_t i = 0; i < dim; ++i) {
+        sum += query[i] * half_to_float(row[i]);
+    }
+    return sum;
+}
+
+inline float dot_i8_scalar(const float* query, const std::int8_t* row, std::size_t dim) {
+    float s0 = 0.0f, s1 = 0.0f;
+    std::size_t i = 0;
+    for (; i + 2 <= dim; i += 2) {
+        s0 += query[i] * static_cast<float>(row[i]);
+        s1 += query[i + 1] * static_cast<float>(row[i + 1]);
+    }
+    for (; i < dim; ++i) {
+        s0 += query[i] * static_cast<float>(row[i]);
+    }
+    return s0 + s1;
+}
+
+template <DotFn Dot>
+inline void dot_many_generic(const float* query, const float* rows, std::size_t row_count,
+                             std::size_t row_stride, std::size_t dim, float* out) {
+    for (std::size_t r = 0; r < row_count; ++r) {
+        out[r] = Dot(query, rows + r * row_stride, dim);
+    }
+}
+
+template <DotFn Dot>
+inline void dot_tile_generic(const float* queries, std::size_t query_count, std::size_t query_stride,
+                             const float* rows, std::size_t row_count, std::size_t row_stride,
+                             std::size_t dim, float* out, std::size_t out_stride) {
+    for (std::size_t q = 0; q < query_count; ++q) {
+        dot_many_generic<Dot>(queries + q * query_stride, rows, row_count, row_stride, dim, out + q * out_stride);
+    }
+}
+
+#if defined(LXFU_SIMILARITY_X86)
+
+__attribute__((target("avx2,fma"))) inline float hsum_avx(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2,fma"))) inline float dot_avx2(const float* a, const float* b, std::size_t dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsum_avx(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Four queries share every row load, so a row is read once per block of queries.
+__attribute__((target("avx2,fma"))) inline void dot_tile_avx2(
+    const float* queries, std::size_t query_count, std::size_t query_stride,
+    const float* rows, std::size_t row_count, std::size_t row_stride,
+    std::size_t dim, float* out, std::size_t out_stride) {
+    const std::size_t vec_dim = dim & ~static_cast<std::size_t>(7);
+    for (std::size_t r = 0; r < row_count; ++r) {
+        const float* row = rows + r * row_stride;
+        std::size_t q = 0;
+        for (; q + 4 <= query_count; q += 4) {
+            const float* q0 = queries + q * query_stride;
+            const float* q1 = q0 + query_stride;
+            const float* q2 = q1 + query_stride;
+            const float* q3 = q2 + query_stride;
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            __m256 acc2 = _mm256_setzero_ps();
+            __m256 acc3 = _mm256_setzero_ps();
+            for (std::size_t i = 0; i < vec_dim; i += 8) {
+                __m256 v = _mm256_loadu_ps(row + i);
+                acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q0 + i), v, acc0);
+                acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q1 + i), v, acc1);
+                acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(q2 + i), v, acc2);
+                acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(q3 + i), v, acc3);
+            }
+            float s0 = hsum_avx(acc0), s1 = hsum_avx(acc1), s2 = hsum_avx(acc2), s3 = hsum_avx(acc3);
+            for (std::size_t i = vec_dim; i < dim; ++i) {
+                s0 += q0[i] * row[i];
+                s1 += q1[i] * row[i];
+                s2 += q2[i] * row[i];
+                s3 += q3[i] * row[i];
+            }
+            out[q * out_stride + r] = s0;
+            out[(q + 1) * out_stride + r] = s1;
+            out[(q + 2) * out_stride + r] = s2;
+            out[(q + 3) * out_stride + r] = s3;
+        }
+        for (; q < query_count; ++q) {
+            out[q * out_stride + r] = dot_avx2(queries + q * query_stride, row, dim);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma,f16c"))) inline float dot_f16_avx2(const float* query, const std::uint16_t* row,
+                                                                   std::size_t dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 r0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+        __m256 r1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i + 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), r0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), r1, acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 r = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), r, acc0);
+    }
+    float sum = hsum_avx(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += query[i] * half_to_float(row[i]);
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma"))) inline float dot_i8_avx2(const float* query, const std::int8_t* row,
+                                                             std::size_t dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        __m256 r0 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes));
+        __m256 r1 = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(bytes, 8)));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), r0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), r1, acc1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(bytes)), acc0);
+    }
+    float sum = hsum_avx(_mm256_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += query[i] * static_cast<float>(row[i]);
+    }
+    return sum;
+}
+
+// GCC 12's AVX-512 reduction intrinsics seed their masked builtins with
+// self-initialized "undefined" vectors, which -Wuninitialized flags.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f"))) inline float dot_avx512(const float* a, const float* b, std::size_t dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < dim) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (dim - i)) - 1u);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f"))) inline void dot_tile_avx512(
+    const float* queries, std::size_t query_count, std::size_t query_stride,
+    const float* rows, std::size_t row_count, std::size_t row_stride,
+    std::size_t dim, float* out, std::size_t out_stride) {
+    const std::size_t vec_dim = dim & ~static_cast<std::size_t>(15);
+    const __mmask16 tail_mask = static_cast<__mmask16>((1u << (dim - vec_dim)) - 1u);
+    for (std::size_t r = 0; r < row_count; ++r) {
+        const float* row = rows + r * row_stride;
+        std::size_t q = 0;
+        for (; q + 4 <= query_count; q += 4) {
+            const float* q0 = queries + q * query_stride;
+            const float* q1 = q0 + query_stride;
+            const float* q2 = q1 + query_stride;
+            const float* q3 = q2 + query_stride;
+            __m512 acc0 = _mm512_setzero_ps();
+            __m512 acc1 = _mm512_setzero_ps();
+            __m512 acc2 = _mm512_setzero_ps();
+            __m512 acc3 = _mm512_setzero_ps();
+            for (std::size_t i = 0; i < vec_dim; i += 16) {
+                __m512 v = _mm512_loadu_ps(row + i);
+                acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q0 + i), v, acc0);
+                acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q1 + i), v, acc1);
+                acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(q2 + i), v, acc2);
+                acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(q3 + i), v, acc3);
+            }
+            if (tail_mask) {
+                __m512 v = _mm512_maskz_loadu_ps(tail_mask, row + vec_dim);
+                acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail_mask, q0 + vec_dim), v, acc0);
+                acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail_mask, q1 + vec_dim), v, acc1);
+                acc2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail_mask, q2 + vec_dim), v, acc2);
+                acc3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail_mask, q3 + vec_dim), v, acc3);
+            }
+            out[q * out_stride + r] = _mm512_reduce_add_ps(acc0);
+            out[(q + 1) * out_stride + r] = _mm512_reduce_add_ps(acc1);
+            out[(q + 2) * out_stride + r] = _mm512_reduce_add_ps(acc2);
+            out[(q + 3) * out_stride + r] = _mm512_reduce_add_ps(acc3);
+        }
+        for (; q < query_count; ++q) {
+            out[q * out_stride + r] = dot_avx512(queries + q * query_stride, row, dim);
+        }
+    }
+}
+
+__attribute__((target("avx512f"))) inline float dot_f16_avx512(const float* query, const std::uint16_t* row,
+                                                               std::size_t dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 r0 = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)));
+        __m512 r1 = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i + 16)));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), r0, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i + 16), r1, acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 r = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), r, acc0);
+    }
+    float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += query[i] * half_to_float(row[i]);
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f"))) inline float dot_i8_avx512(const float* query, const std::int8_t* row,
+                                                              std::size_t dim) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 r0 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i))));
+        __m512 r1 = _mm512_cvtepi32_ps(
+            _mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i + 16))));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), r0, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i + 16), r1, acc1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 r = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i))));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), r, acc0);
+    }
+    float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += query[i] * static_cast<float>(row[i]);
+    }
+    return sum;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#elif defined(LXFU_SIMILARITY_NEON)
+
+inline float dot_neon(const float* a, const float* b, std::size_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline void dot_tile_neon(const float* queries, std::size_t query_count, std::size_t query_stride,
+                          const float* rows, std::size_t row_count, std::size_t row_stride,
+                          std::size_t dim, float* out, std::size_t out_stride) {
+    const std::size_t vec_dim = dim & ~static_cast<std::size_t>(3);
+    for (std::size_t r = 0; r < row_count; ++r) {
+        const float* row = rows + r * row_stride;
+        std::size_t q = 0;
+        for (; q + 4 <= query_count; q += 4) {
+            const float* q0 = queries + q * query_stride;
+            const float* q1 = q0 + query_stride;
+            const float* q2 = q1 + query_stride;
+            const float* q3 = q2 + query_stride;
+            float32x4_t acc0 = vdupq_n_f32(0.0f);
+            float32x4_t acc1 = vdupq_n_f32(0.0f);
+            float32x4_t acc2 = vdupq_n_f32(0.0f);
+            float32x4_t acc3 = vdupq_n_f32(0.0f);
+            for (std::size_t i = 0; i < vec_dim; i += 4) {
+                float32x4_t v = vld1q_f32(row + i);
+                acc0 = vfmaq_f32(acc0, vld1q_f32(q0 + i), v);
+                acc1 = vfmaq_f32(acc1, vld1q_f32(q1 + i), v);
+                acc2 = vfmaq_f32(acc2, vld1q_f32(q2 + i), v);
+                acc3 = vfmaq_f32(acc3, vld1q_f32(q3 + i), v);
+            }
+            float s0 = vaddvq_f32(acc0), s1 = vaddvq_f32(acc1), s2 = vaddvq_f32(acc2), s3 = vaddvq_f32(acc3);
+            for (std::size_t i = vec_dim; i < dim; ++i) {
+                s0 += q0[i] * row[i];
+                s1 += q1[i] * row[i];
+                s2 += q2[i] * row[i];
+                s3 += q3[i] * row[i];
+            }
+            out[q * out_stride + r] = s0;
+            out[(q + 1) * out_stride + r] = s1;
+            out[(q + 2) * out_stride + r] = s2;
+            out[(q + 3) * out_stride + r] = s3;
+        }
+        for (; q < query_count; ++q) {
+            out[q * out_stride + r] = dot_neon(queries + q * query_stride, row, dim);
+        }
+    }
+}
+
+inline float dot_f16_neon(const float* query, const std::uint16_t* row, std::size_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + i))));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + i + 4))));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += query[i] * half_to_float(row[i]);
+    }
+    return sum;
+}
+
+inline float dot_i8_neon(const float* query, const std::int8_t* row, std::size_t dim) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        int16x8_t wide = vmovl_s8(vld1_s8(row + i));
+        acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), vcvtq_f32_s32(vmovl_s16(vget_low_s16(wide))));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), vcvtq_f32_s32(vmovl_s16(vget_high_s16(wide))));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < dim; ++i) {
+        sum += query[i] * static_cast<float>(row[i]);
+    }
+    return sum;
+}
+
+#endif
+
+inline Kernels scalar_kernels() {
+    return {"scalar", dot_scalar, dot_many_generic<dot_scalar>, dot_tile_generic<dot_scalar>,
+            dot_f16_scalar, dot_i8_scalar};
+}
+
+inline Kernels select_kernels() {
+    const char* forced = std::getenv("LXFU_SIMD");
+    const std::string requested = forced ? forced : "";
+    if (requested == "scalar") {
+        return scalar_kernels();
+    }
+
+#if defined(LXFU_SIMILARITY_X86)
+    __builtin_cpu_init();
+    const bool has_avx512 = __builtin_cpu_supports("avx512f");
+    const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    const bool has_f16c = __builtin_cpu_supports("f16c");
+    if (has_avx512 && (requested.empty() || requested == "avx512")) {
+        return {"avx512", dot_avx512, dot_many_generic<dot_avx512>, dot_tile_avx512, dot_f16_avx512, dot_i8_avx512};
+    }
+    if (has_avx2 && (requested.empty() || requested == "avx2" || requested == "avx512")) {
+        return {"avx2", dot_avx2, dot_many_generic<dot_avx2>, dot_tile_avx2,
+                has_f16c ? dot_f16_avx2 : dot_f16_scalar, dot_i8_avx2};
+    }
+#elif defined(LXFU_SIMILARITY_NEON)
+    return {"neon", dot_neon, dot_many_generic<dot_neon>, dot_tile_neon, dot_f16_neon, dot_i8_neon};
+#endif
+    return scalar_kernels();
+}
+
+} // namespace detail
+
+inline const Kernels& kernels() {
+    static const Kernels selected = detail::select_kernels();
+    return selected;
+}
+
+inline const char* backend_name() {
+    return kernels().name;
+}
+
+inline float dot(const float* a, const float* b, std::size_t dim) {
+    return kernels().dot(a, b, dim);
+}
+
+inline void dot_many(const float* query, const float* rows, std::size_t row_count,
+                     std::size_t row_stride, std::size_t dim, float* out) {
+    kernels().dot_many(query, rows, row_count, row_stride, dim, out);
+}
+
+inline void dot_tile(const float* queries, std::size_t query_count, std::size_t query_stride,
+                     const float* rows, std::size_t row_count, std::size_t row_stride,
+                     std::size_t dim, float* out, std::size_t out_stride) {
+    kernels().dot_tile(queries, query_count, query_stride, rows, row_count, row_stride, dim, out, out_stride);
+}
+
+inline float dot_f16(const float* query, const std::uint16_t* row, std::size_t dim) {
+    return kernels().dot_f16(query, row, dim);
+}
+
+// Unscaled: multiply by the row's scale to get the similarity.
+inline float dot_i8(const float* query, const std::int8_t* row, std::size_t dim) {
+    return kernels().dot_i8(query, row, dim);
+}
+
+} // namespace similarity
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "embedding_index.hpp"
+#include "lmdb_store.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// When to stop capturing before the capture window is over.
+struct EarlyExitPolicy {
+    // Accept once this many consecutive frames each score >= threshold against
+    // the same profile (0 disables).
+    std::size_t accept_frames = 3;
+    // After this many frames, give up when even the best running average is
+    // more than `reject_margin` below the threshold (0 disables).
+    std::size_t reject_frames = 8;
+    double reject_margin = 0.10;
+};
+
+// Running avg/max and accept streaks per profile over a sequence of scored
+// frames; the decision half of StreamingMatcher. A profile that is missing
+// from a frame's matches (not proposed by the ANN index) counts as a miss for
+// that frame: its accept streak restarts, so "consecutive" always means
+// consecutive frames in which it was scored at or above the threshold.
+class MatchTally {
+public:
+    enum class Decision { Continue, Accept, Reject };
+
+    struct Best {
+        std::string name;
+        float avg_similarity = -1.0f;
+        float max_similarity = -1.0f;
+    };
+
+    MatchTally(double threshold, EarlyExitPolicy policy) : threshold_(threshold), policy_(policy) {}
+
+    Decision record(const std::vector<ProfileMatch>& matches) {
+        ++frames_;
+        const auto threshold = static_cast<float>(threshold_);
+        for (const auto& match : matches) {
+            ProfileState& state = profiles_[match.name];
+            state.last_frame = frames_;
+            state.frame_avg_sum += match.avg_similarity;
+            ++state.frames;
+            state.max_similarity = std::max(state.max_similarity, match.max_similarity);
+            if (match.avg_similarity >= threshold) {
+                ++state.consecutive_hits;
+                state.streak_sum += match.avg_similarity;
+            } else {
+                state.consecutive_hits = 0;
+                state.streak_sum = 0.0;
+            }
+
+            if (policy_.accept_frames > 0 && state.consecutive_hits >= policy_.accept_frames) {
+                float streak_avg = static_cast<float>(state.streak_sum / static_cast<double>(state.consecutive_hits));
+                if (!accepted_ || streak_avg > accepted_->avg_similarity) {
+                    accepted_ = Best{match.name, streak_avg, state.max_similarity};
+                }
+            }
+        }
+        for (auto& [name, state] : profiles_) {
+            if (state.last_frame != frames_) {
+                state.consecutive_hits = 0;
+                state.streak_sum = 0.0;
+            }
+        }
+        if (accepted_) {
+            return Decision::Accept;
+        }
+
+        if (policy_.reject_frames > 0 && frames_ >= policy_.reject_frames &&
+            best().avg_similarity < threshold - static_cast<float>(policy_.reject_margin)) {
+            return Decision::Reject;
+        }
+        return Decision::Continue;
+    }
+
+    std::size_t frames() const { return frames_; }
+
+    // The accepted profile (averaged over its accepting streak), otherwise the
+    // profile with the highest running average. Empty name when nothing matched.
+    Best best() const {
+        if (accepted_) {
+            return *accepted_;
+        }
+        Best best;
+        for (const auto& [name, state] : profiles_) {
+            float avg = state.average();
+            if (avg > best.avg_similarity) {
+                best = {name, avg, state.max_similarity};
+            }
+        }
+        return best;
+    }
+
+private:
+    struct ProfileState {
+        double frame_avg_sum = 0.0;
+        std::size_t frames = 0;
+        float max_similarity = -1.0f;
+        std::size_t consecutive_hits = 0;
+        double streak_sum = 0.0;
+        std::size_t last_frame = 0;
+
+        float average() const {
+            return frames == 0 ? -1.0f : static_cast<float>(frame_avg_sum / static_cast<double>(frames));
+        }
+    };
+
+    double threshold_;
+    EarlyExitPolicy policy_;
+    std::size_t frames_ = 0;
+    std::map<std::string, ProfileState> profiles_;
+    std::optional<Best> accepted_;
+};
+
+// Scores query frames as they arrive and keeps a running avg/max per profile.
+// The running average over all frames equals the batch average computed over
+// every query x sample pair, so a capture that runs to the end is judged
+// exactly as before.
+//
+// With profile means enabled, frames score one dot product per profile
+// against its cached mean; averages are unchanged but max_similarity stays -1.
+//
+// With an ANN index (identify mode only) each frame is scored exactly against
+// just the profiles the index proposes, so a profile's running average covers
+// only the frames in which it was a candidate, and a frame in which it was not
+// breaks its accept streak.
+class StreamingMatcher {
+public:
+    using Decision = MatchTally::Decision;
+    using Best = MatchTally::Best;
+
+    StreamingMatcher(const LMDBStore::Snapshot& snapshot,
+                     std::optional<std::string> target,
+                     double threshold,
+                     EarlyExitPolicy policy)
+        : snapshot_(snapshot),
+          target_(std::move(target)),
+          tally_(threshold, policy) {}
+
+    // Score each embedding as one frame. Returns the first decisive outcome.
+    Decision add(const std::vector<std::vector<float>>& frames) {
+        for (const auto& frame : frames) {
+            Decision decision = add_frame(frame);
+            if (decision != Decision::Continue) {
+                return decision;
+            }
+        }
+        return Decision::Continue;
+    }
+
+    void use_profile_means(bool enabled) { profile_means_ = enabled; }
+
+    // The index must outlive the matcher and match its snapshot.
+    void use_ann_index(const ProfileAnnIndex& index, const AnnSettings& settings) {
+        ann_index_ = &index;
+        ann_settings_ = settings;
+    }
+
+    std::size_t frames() const { return tally_.frames(); }
+
+    Best best() const { return tally_.best(); }
+
+private:
+    Decision add_frame(const std::vector<float>& frame) {
+        QueryBlock query({frame});
+        std::vector<ProfileMatch> matches;
+        if (ann_index_ && !target_) {
+            matches = score_profiles(snapshot_, query,
+                                     ann_index_->search(frame.data(), frame.size(),
+                                                        ann_settings_.candidates, ann_settings_.ef_search));
+        } else if (profile_means_) {
+            matches = score_profile_means(snapshot_, query, target_);
+        } else {
+            matches = score_profiles(snapshot_, query, target_);
+        }
+        return tally_.record(matches);
+    }
+
+    const LMDBStore::Snapshot& snapshot_;
+    std::optional<std::string> target_;
+    MatchTally tally_;
+    bool profile_means_ = false;
+    const ProfileAnnIndex* ann_index_ = nullptr;
+    AnnSettings ann_settings_;
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include "camera_frame.hpp"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Direct V4L2 capture (capture_backend=v4l2).
+//
+// Frames are dequeued from mmap'd driver buffers without a copy and handed out
+// as NativeFrames that keep the buffer until they are released, at which point
+// it is queued back to the driver. YUYV and GREY frames give the detector their
+// luma plane and convert only the face region to BGR; MJPEG frames are decoded
+// straight to grayscale and decoded in colour only when a face is cropped.
+//
+// A frame is copied out instead of leased when fewer than kMinQueuedBuffers
+// would be left with the driver, so slow consumers drop frames rather than
+// stalling the camera.
+
+namespace v4l2_detail {
+
+inline int xioctl(int fd, unsigned long request, void* arg) {
+    int rc;
+    do {
+        rc = ::ioctl(fd, request, arg);
+    } while (rc == -1 && errno == EINTR);
+    return rc;
+}
+
+inline std::string errno_message(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+// The open device and its buffer mappings. Shared by the capture and every
+// leased frame, so a frame can outlive the capture that produced it.
+struct Device {
+    struct Buffer {
+        void* start = MAP_FAILED;
+        std::size_t length = 0;
+    };
+
+    int fd = -1;
+    std::vector<Buffer> buffers;
+    std::atomic<int> queued{0};
+    std::atomic<bool> streaming{false};
+    std::uint32_t pixel_format = 0;
+    int width = 0;
+    int height = 0;
+    std::size_t bytes_per_line = 0;
+
+    ~Device() {
+        stop();
+        for (auto& buffer : buffers) {
+            if (buffer.start != MAP_FAILED) {
+                ::munmap(buffer.start, buffer.length);
+            }
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    bool queue(std::uint32_t index) {
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = index;
+        if (xioctl(fd, VIDIOC_QBUF, &buf) == -1) {
+            return false;
+        }
+        queued.fetch_add(1);
+        return true;
+    }
+
+    // Return a leased buffer; a no-op once streaming has stopped.
+    void release(std::uint32_t index) {
+        if (streaming.load()) {
+            queue(index);
+        }
+    }
+
+    void stop() {
+        if (streaming.exchange(false)) {
+            int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            xioctl(fd, VIDIOC_STREAMOFF, &type);
+            queued.store(0);
+        }
+    }
+};
+
+// YUYV (CV_8UC2, Y in channel 0) or GREY pixels, either viewing a leased
+// driver buffer or owning a copy.
+class RawFrame : public NativeFrame {
+public:
+    RawFrame(cv::Mat pixels, bool yuyv, std::shared_ptr<Device> device, std::uint32_t index)
+        : pixels_(std::move(pixels)), yuyv_(yuyv), device_(std::move(device)), index_(index) {
+        if (yuyv_) {
+            cv::extractChannel(pixels_, gray_, 0);
+        } else {
+            gray_ = pixels_;
+        }
+    }
+
+    ~RawFrame() override {
+        if (device_) {
+            device_->release(index_);
+        }
+    }
+
+    RawFrame(const RawFrame&) = delete;
+    RawFrame& operator=(const RawFrame&) = delete;
+
+    cv::Size size() const override { return cv::Size(pixels_.cols, pixels_.rows); }
+    const cv::Mat& gray() const override { return gray_; }
+
+    cv::Mat color(const cv::Rect& roi) const override {
+        cv::Rect clipped = roi & cv::Rect(0, 0, pixels_.cols, pixels_.rows);
+        cv::Mat out;
+        if (clipped.empty()) {
+            return out;
+        }
+        if (!yuyv_) {
+            cv::cvtColor(pixels_(clipped), out, cv::COLOR_GRAY2BGR);
+            return out;
+        }
+        // U and V are shared by pixel pairs, so convert from an even column.
+        cv::Rect aligned = clipped;
+        aligned.x &= ~1;
+        aligned.width = std::min(pixels_.cols - aligned.x, (clipped.x + clipped.width - aligned.x + 1) & ~1);
+        cv::Mat converted;
+        cv::cvtColor(pixels_(aligned), converted, cv::COLOR_YUV2BGR_YUYV);
+        if (aligned == clipped) {
+            return converted;
+        }
+        return converted(cv::Rect(clipped.x - aligned.x, 0, clipped.width, clipped.height)).clone();
+    }
+
+private:
+    cv::Mat pixels_;
+    cv::Mat gray_;
+    bool yuyv_;
+    std::shared_ptr<Device> device_;
+    std::uint32_t index_;
+};
+
+// One MJPEG frame; the compressed data is copied out (it is small).
+class JpegFrame : public NativeFrame {
+public:
+    explicit JpegFrame(std::vector<unsigned char> data) : data_(std::move(data)) {
+        gray_ = cv::imdecode(data_, cv::IMREAD_GRAYSCALE);
+    }
+
+    cv::Size size() const override { return cv::Size(gray_.cols, gray_.rows); }
+    const cv::Mat& gray() const override { return gray_; }
+
+    cv::Mat color(const cv::Rect& roi) const override {
+        cv::Mat full = cv::imdecode(data_, cv::IMREAD_COLOR);
+        cv::Rect clipped = roi & cv::Rect(0, 0, full.cols, full.rows);
+        if (clipped.empty()) {
+            return cv::Mat();
+        }
+        return clipped.width == full.cols && clipped.height == full.rows ? full : full(clipped).clone();
+    }
+
+private:
+    std::vector<unsigned char> data_;
+    cv::Mat gray_;
+};
+
+} // namespace v4l2_detail
+
+class V4l2Capture {
+public:
+    struct Options {
+        int width = 640;
+        int height = 480;
+        int fps = 30;
+        unsigned buffers = 6;
+    };
+
+    static constexpr int kMinQueuedBuffers = 2;
+
+    // Opens and starts streaming; throws std::runtime_error when the device
+    // cannot be opened or offers none of YUYV, GREY and MJPEG.
+    V4l2Capture(const std::string& path, const Options& options) : device_(std::make_shared<v4l2_detail::Device>()) {
+        using v4l2_detail::errno_message;
+        using v4l2_detail::xioctl;
+        auto& dev = *device_;
+
+        dev.fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (dev.fd == -1) {
+            throw std::runtime_error(errno_message("cannot open " + path));
+        }
+
+        v4l2_capability caps{};
+        if (xioctl(dev.fd, VIDIOC_QUERYCAP, &caps) == -1) {
+            throw std::runtime_error(errno_message(path + " is not a V4L2 device"));
+        }
+        const std::uint32_t device_caps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps
+                                                                                      : caps.capabilities;
+        if (!(device_caps & V4L2_CAP_VIDEO_CAPTURE) || !(device_caps & V4L2_CAP_STREAMING)) {
+            throw std::runtime_error(path + " does not support streaming capture");
+        }
+
+        if (!set_format(options, V4L2_PIX_FMT_YUYV) && !set_format(options, V4L2_PIX_FMT_GREY) &&
+            !set_format(options, V4L2_PIX_FMT_MJPEG)) {
+            throw std::runtime_error(path + " offers none of YUYV, GREY or MJPEG");
+        }
+
+        v4l2_streamparm parm{};
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parm.parm.capture.timeperframe.numerator = 1;
+        parm.parm.capture.timeperframe.denominator = static_cast<std::uint32_t>(std::max(1, options.fps));
+        xioctl(dev.fd, VIDIOC_S_PARM, &parm); // best effort
+
+        v4l2_requestbuffers req{};
+        req.count = std::max(static_cast<unsigned>(kMinQueuedBuffers + 1), options.buffers);
+        req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(dev.fd, VIDIOC_REQBUFS, &req) == -1 || req.count < 2) {
+            throw std::runtime_error(errno_message(path + ": cannot allocate mmap buffers"));
+        }
+        dev.buffers.resize(req.count);
+        for (std::uint32_t i = 0; i < req.count; ++i) {
+            v4l2_buffer buf{};
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = i;
+            if (xioctl(dev.fd, VIDIOC_QUERYBUF, &buf) == -1) {
+                throw std::runtime_error(errno_message(path + ": VIDIOC_QUERYBUF"));
+            }
+            dev.buffers[i].length = buf.length;
+            dev.buffers[i].start = ::mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, dev.fd, buf.m.offset);
+            if (dev.buffers[i].start == MAP_FAILED) {
+                throw std::runtime_error(errno_message(path + ": mmap"));
+            }
+        }
+        for (std::uint32_t i = 0; i < req.count; ++i) {
+            if (!dev.queue(i)) {
+                throw std::runtime_error(errno_message(path + ": VIDIOC_QBUF"));
+            }
+        }
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(dev.fd, VIDIOC_STREAMON, &type) == -1) {
+            throw std::runtime_error(errno_message(path + ": VIDIOC_STREAMON"));
+        }
+        dev.streaming.store(true);
+    }
+
+    // Stops streaming; frames still held keep their pixels.
+    ~V4l2Capture() { device_->stop(); }
+
+    V4l2Capture(const V4l2Capture&) = delete;
+    V4l2Capture& operator=(const V4l2Capture&) = delete;
+
+    cv::Size size() const { return cv::Size(device_->width, device_->height); }
+
+    const char* format_name() const {
+        switch (device_->pixel_format) {
+            case V4L2_PIX_FMT_YUYV: return "YUYV";
+            case V4L2_PIX_FMT_GREY: return "GREY";
+            case V4L2_PIX_FMT_MJPEG: return "MJPEG";
+        }
+        return "unknown";
+    }
+
+    // Waits up to `timeout_ms` for the next frame. Returns false on a timeout
+    // or a corrupt frame.
+    bool read(CameraFrame& frame, int timeout_ms = 1000) {
+        using v4l2_detail::xioctl;
+        auto& dev = *device_;
+        frame.image.release();
+        frame.native.reset();
+
+        pollfd pfd{dev.fd, POLLIN, 0};
+        int ready;
+        do {
+            ready = ::poll(&pfd, 1, timeout_ms);
+        } while (ready == -1 && errno == EINTR);
+        if (ready <= 0) {
+            return false;
+        }
+
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(dev.fd, VIDIOC_DQBUF, &buf) == -1) {
+            return false;
+        }
+        dev.queued.fetch_sub(1);
+        if ((buf.flags & V4L2_BUF_FLAG_ERROR) || buf.bytesused == 0) {
+            dev.queue(buf.index);
+            return false;
+        }
+
+        auto* data = static_cast<unsigned char*>(dev.buffers[buf.index].start);
+        if (dev.pixel_format == V4L2_PIX_FMT_MJPEG) {
+            std::vector<unsigned char> jpeg(data, data + buf.bytesused);
+            dev.queue(buf.index);
+            auto decoded = std::make_shared<v4l2_detail::JpegFrame>(std::move(jpeg));
+            if (decoded->gray().empty()) {
+                return false;
+            }
+            frame.native = std::move(decoded);
+            return true;
+        }
+
+        const bool yuyv = dev.pixel_format == V4L2_PIX_FMT_YUYV;
+        if (buf.bytesused < dev.bytes_per_line * static_cast<std::size_t>(dev.height)) {
+            dev.queue(buf.index);
+            return false;
+        }
+        cv::Mat pixels(dev.height, dev.width, yuyv ? CV_8UC2 : CV_8UC1, data, dev.bytes_per_line);
+        if (dev.queued.load() >= kMinQueuedBuffers) {
+            frame.native = std::make_shared<v4l2_detail::RawFrame>(pixels, yuyv, device_, buf.index);
+        } else {
+            cv::Mat copy = pixels.clone();
+            dev.queue(buf.index);
+            frame.native = std::make_shared<v4l2_detail::RawFrame>(std::move(copy), yuyv, nullptr, 0);
+        }
+        return true;
+    }
+
+private:
+    bool set_format(const Options& options, std::uint32_t pixel_format) {
+        auto& dev = *device_;
+        v4l2_format fmt{};
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = static_cast<std::uint32_t>(options.width);
+        fmt.fmt.pix.height = static_cast<std::uint32_t>(options.height);
+        fmt.fmt.pix.pixelformat = pixel_format;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        if (v4l2_detail::xioctl(dev.fd, VIDIOC_S_FMT, &fmt) == -1 || fmt.fmt.pix.pixelformat != pixel_format) {
+            return false;
+        }
+        dev.pixel_format = pixel_format;
+        dev.width = static_cast<int>(fmt.fmt.pix.width);
+        dev.height = static_cast<int>(fmt.fmt.pix.height);
+        const std::size_t min_line = static_cast<std::size_t>(dev.width) * (pixel_format == V4L2_PIX_FMT_YUYV ? 2 : 1);
+        dev.bytes_per_line = std::max<std::size_t>(fmt.fmt.pix.bytesperline, min_line);
+        return true;
+    }
+
+    std::shared_ptr<v4l2_detail::Device> device_;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "cpu_affinity.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for lxfud, each with its own task deque.
+// submit() spreads tasks over the deques round-robin (or onto the submitting
+// worker's own deque); a worker runs its newest task first and, once its deque
+// is empty, steals the oldest task of another worker. Concurrent sessions
+// therefore share the threads instead of each starting its own, and one busy
+// camera never leaves the other workers idle.
+//
+// Tasks must not throw; a task that does is dropped.
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    // `cpu_affinity` pins every worker (empty = not pinned).
+    explicit WorkStealingPool(std::size_t threads, std::vector<int> cpu_affinity = {}) {
+        const std::size_t count = std::max<std::size_t>(1, threads);
+        for (std::size_t i = 0; i < count; ++i) {
+            workers_.push_back(std::make_unique<Worker>());
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            threads_.emplace_back([this, i, cpu_affinity] {
+                pin_current_thread(cpu_affinity);
+                run(i);
+            });
+        }
+    }
+
+    // Runs every task still queued, then joins the workers.
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    std::size_t size() const { return workers_.size(); }
+
+    void submit(Task task) {
+        const std::size_t index = current_pool_ == this ? current_worker_
+                                                        : next_.fetch_add(1, std::memory_order_relaxed) % size();
+        {
+            std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+            workers_[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            ++pending_;
+        }
+        wake_.notify_one();
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool take(std::size_t self, Task& task) {
+        {
+            Worker& own = *workers_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (std::size_t offset = 1; offset < workers_.size(); ++offset) {
+            Worker& victim = *workers_[(self + offset) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::size_t self) {
+        current_pool_ = this;
+        current_worker_ = self;
+        Task task;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                wake_.wait(lock, [this] { return stop_ || pending_ > 0; });
+                if (pending_ == 0) {
+                    return; // stopping and drained
+                }
+                // Claim a task before looking for it, so the count never
+                // promises a task that another worker already took.
+                --pending_;
+            }
+            while (!take(self, task)) {
+                // The submitter bumps pending_ after queueing, so the task is
+                // already in some deque.
+                std::this_thread::yield();
+            }
+            try {
+                task();
+            } catch (...) {
+            }
+            task = nullptr;
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> next_{0};
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::size_t pending_ = 0;
+    bool stop_ = false;
+
+    static inline thread_local const WorkStealingPool* current_pool_ = nullptr;
+    static inline thread_local std::size_t current_worker_ = 0;
+};
@@ -0,0 +1,378 @@
+// Unit tests for header-only logic that needs no model, camera or database.
+// Run with ctest, or directly: ./build/bin/lxfu_tests
+
+#include "profile_archive.hpp"
+#include "streaming_match.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Befriended by LMDBStore so the value codecs can be tested without LMDB.
+struct LMDBStoreCodecAccess {
+    using View = LMDBStore::EmbeddingView;
+
+    static std::vector<std::uint8_t> serialize(const LMDBStore::EmbeddingList& samples, SampleEncoding encoding) {
+        return LMDBStore::serialize_embeddings(samples, encoding);
+    }
+    static View parse(const MDB_val& value) { return LMDBStore::parse_embeddings(value); }
+    static View align(View view, std::vector<float>& scratch) { return LMDBStore::align_view(view, scratch); }
+    static std::vector<std::uint8_t> serialize_mean(const std::vector<double>& sum, std::size_t count) {
+        return LMDBStore::serialize_mean(sum, count);
+    }
+    static View parse_mean(const MDB_val& value) { return LMDBStore::parse_mean(value); }
+    static View align_mean(View view, std::vector<float>& scratch) { return LMDBStore::align_mean(view, scratch); }
+};
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                                 \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            std::fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (0)
+
+using Decision = MatchTally::Decision;
+
+ProfileMatch hit(const std::string& name, float avg) { return {name, avg, avg, 1}; }
+
+EarlyExitPolicy accept_after(std::size_t frames) {
+    EarlyExitPolicy policy;
+    policy.accept_frames = frames;
+    policy.reject_frames = 0;
+    return policy;
+}
+
+void test_consecutive_hits_accept() {
+    MatchTally tally(0.9, accept_after(3));
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Accept);
+    EXPECT(tally.best().name == "alice");
+}
+
+void test_score_below_threshold_breaks_streak() {
+    MatchTally tally(0.9, accept_after(3));
+    tally.record({hit("alice", 0.95f)});
+    tally.record({hit("alice", 0.95f)});
+    EXPECT(tally.record({hit("alice", 0.5f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+}
+
+// ANN mode: a frame in which the profile was not a candidate is a miss.
+void test_absent_frame_breaks_streak() {
+    MatchTally tally(0.9, accept_after(3));
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("bob", 0.4f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+    EXPECT(tally.record({}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Continue);
+    EXPECT(tally.record({hit("alice", 0.95f)}) == Decision::Accept);
+    EXPECT(tally.best().name == "alice");
+    EXPECT(tally.frames() == 8);
+}
+
+void test_running_average_covers_scored_frames_only() {
+    MatchTally tally(0.9, accept_after(0));
+    tally.record({hit("alice", 0.8f)});
+    tally.record({hit("bob", 0.1f)});
+    tally.record({hit("alice", 0.6f)});
+    const MatchTally::Best best = tally.best();
+    EXPECT(best.name == "alice");
+    EXPECT(best.avg_similarity > 0.69f && best.avg_similarity < 0.71f);
+}
+
+std::string serialized_graph(std::size_t nodes, std::size_t dim) {
+    HnswIndex index(dim, 4, 16);
+    std::vector<float> vector(dim);
+    for (std::size_t i = 0; i < nodes; ++i) {
+        std::fill(vector.begin(), vector.end(), 0.0f);
+        vector[i % dim] = 1.0f;
+        index.add(vector.data(), static_cast<std::uint32_t>(i));
+    }
+    std::ostringstream out;
+    index.write(out);
+    return out.str();
+}
+
+bool graph_read_throws(const std::string& bytes) {
+    std::istringstream in(bytes);
+    try {
+        HnswIndex::read(in);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void test_hnsw_round_trip() {
+    std::istringstream in(serialized_graph(40, 8));
+    HnswIndex index = HnswIndex::read(in);
+    EXPECT(index.size() == 40);
+    std::vector<float> query(8, 0.0f);
+    query[3] = 1.0f;
+    const auto found = index.search(query.data(), 1, 16);
+    EXPECT(!found.empty() && found.front().first > 0.99f);
+}
+
+void test_hnsw_rejects_truncated_file() {
+    const std::string bytes = serialized_graph(40, 8);
+    EXPECT(graph_read_throws(bytes.substr(0, bytes.size() - 4)));
+    EXPECT(graph_read_throws(bytes.substr(0, bytes.size() / 2)));
+}
+
+// Header: dim, m, ef_construction, count (u64 each), entry (u32), max_level (i32).
+void test_hnsw_rejects_crafted_header() {
+    const std::string bytes = serialized_graph(40, 8);
+    std::string huge_count = bytes;
+    const std::uint64_t count = 1ull << 31;
+    std::memcpy(&huge_count[24], &count, sizeof(count));
+    EXPECT(graph_read_throws(huge_count));
+
+    std::string deep = bytes;
+    const std::int32_t max_level = 1000;
+    std::memcpy(&deep[36], &max_level, sizeof(max_level));
+    EXPECT(graph_read_throws(deep));
+
+
+    // First node: label (u32), deleted flag (u8), then its level count.
+    std::string levels = bytes;
+    const std::uint32_t many = 0xffffffffu;
+    std::memcpy(&levels[45], &many, sizeof(many));
+    EXPECT(graph_read_throws(levels));
+}
+
+// One-profile archive header; `samples` floats follow only if given.
+std::string archive(std::uint32_t count, std::uint32_t dim, const std::vector<float>& samples) {
+    std::ostringstream out;
+    auto u32 = [&](std::uint32_t v) { out.write(reinterpret_cast<const char*>(&v), sizeof(v)); };
+    out.write(profile_archive::kMagic, sizeof(profile_archive::kMagic));
+    u32(profile_archive::kVersion);
+    u32(1);
+    u32(5);
+    out.write("alice", 5);
+    u32(count);
+    u32(dim);
+    out.write(reinterpret_cast<const char*>(samples.data()),
+              static_cast<std::streamsize>(samples.size() * sizeof(float)));
+    return out.str();
+}
+
+bool archive_read_throws(const std::string& bytes) {
+    std::istringstream in(bytes);
+    try {
+        read_profile_archive(in, [](std::string, LMDBStore::EmbeddingList) {});
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void test_archive_round_trip() {
+    std::istringstream in(archive(2, 3, {1, 0, 0, 0, 1, 0}));
+    std::size_t seen = 0;
+    const ProfileArchiveStats stats = read_profile_archive(in, [&](std::string name, LMDBStore::EmbeddingList samples) {
+        EXPECT(name == "alice");
+        EXPECT(samples.size() == 2 && samples[1][1] == 1.0f);
+        ++seen;
+    });
+    EXPECT(seen == 1 && stats.samples == 2);
+}
+
+void test_archive_rejects_oversized_profile() {
+    // Each limit alone allows it; together 2^36 floats.
+    EXPECT(archive_read_throws(archive(1u << 20, 65536, {})));
+    // Within the limits, but far more than the file holds.
+    EXPECT(archive_read_throws(archive(1000, 512, {1, 2, 3})));
+}
+
+using Codec = LMDBStoreCodecAccess;
+
+// Deterministic, roughly unit-scale samples with mixed signs and one zero.
+LMDBStore::EmbeddingList codec_samples(std::size_t count, std::size_t dim) {
+    LMDBStore::EmbeddingList samples(count, LMDBStore::Embedding(dim));
+    for (std::size_t i = 0; i < count; ++i) {
+        for (std::size_t d = 0; d < dim; ++d) {
+            samples[i][d] = std::sin(static_cast<float>(i * dim + d) * 1.3f + 0.4f) * (1.0f + static_cast<float>(i));
+        }
+    }
+    samples[0][0] = 0.0f;
+    return samples;
+}
+
+// Copies `bytes` to `offset` bytes past an aligned address, the way LMDB can
+// place small values inside a leaf page.
+struct PlacedValue {
+    std::vector<std::uint8_t> storage;
+    MDB_val value{};
+
+    PlacedValue(const std::vector<std::uint8_t>& bytes, std::size_t offset)
+        : storage(bytes.size() + offset + alignof(std::max_align_t)) {
+        auto base = reinterpret_cast<std::uintptr_t>(storage.data());
+        const std::size_t pad = (alignof(std::max_align_t) - base % alignof(std::max_align_t)) % alignof(std::max_align_t);
+        std::uint8_t* at = storage.data() + pad + offset;
+        std::memcpy(at, bytes.data(), bytes.size());
+        value.mv_size = bytes.size();
+        value.mv_data = at;
+    }
+};
+
+LMDBStore::EmbeddingList decode_value(const MDB_val& value) {
+    std::vector<float> scratch;
+    const Codec::View view = Codec::align(Codec::parse(value), scratch);
+    LMDBStore::EmbeddingList rows(view.count, LMDBStore::Embedding(view.dim));
+    for (std::size_t i = 0; i < view.count; ++i) {
+        view.decode_row(i, rows[i].data());
+    }
+    return rows;
+}
+
+// Largest |decoded - expected| over every element, relative to `tolerance`
+// of that element; <= 1 means every element is within bounds.
+template <typename Tolerance>
+float worst_error(const LMDBStore::EmbeddingList& expected, const LMDBStore::EmbeddingList& decoded,
+                  Tolerance tolerance) {
+    if (decoded.size() != expected.size()) {
+        return INFINITY;
+    }
+    float worst = 0.0f;
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        if (decoded[i].size() != expected[i].size()) {
+            return INFINITY;
+        }
+        for (std::size_t d = 0; d < expected[i].size(); ++d) {
+            worst = std::max(worst, std::fabs(decoded[i][d] - expected[i][d]) / tolerance(i, expected[i][d]));
+        }
+    }
+    return worst;
+}
+
+// Decodes `bytes` both aligned and through align_view's copy, which must agree.
+void expect_round_trip(const std::vector<std::uint8_t>& bytes, const LMDBStore::EmbeddingList& expected,
+                       const std::function<float(std::size_t, float)>& tolerance) {
+    for (std::size_t offset : {0, 1, 2, 3}) {
+        PlacedValue placed(bytes, offset);
+        const LMDBStore::EmbeddingList decoded = decode_value(placed.value);
+        EXPECT(worst_error(expected, decoded, tolerance) <= 1.0f);
+    }
+}
+
+void test_legacy_value_round_trip() {
+    const LMDBStore::EmbeddingList samples = codec_samples(1, 5);
+    const std::int32_t dim = 5;
+    std::vector<std::uint8_t> bytes(sizeof(dim) + dim * sizeof(float));
+    std::memcpy(bytes.data(), &dim, sizeof(dim));
+    std::memcpy(bytes.data() + sizeof(dim), samples[0].data(), dim * sizeof(float));
+    expect_round_trip(bytes, samples, [](std::size_t, float) { return 1e-30f; });
+}
+
+void test_v2_value_round_trip() {
+    const LMDBStore::EmbeddingList samples = codec_samples(3, 7);
+    const std::vector<std::uint8_t> bytes = Codec::serialize(samples, SampleEncoding::F32);
+    std::int32_t count = 0;
+    std::memcpy(&count, bytes.data(), sizeof(count));
+    EXPECT(count == 3); // float32 stays v2 for older readers
+    expect_round_trip(bytes, samples, [](std::size_t, float) { return 1e-30f; });
+}
+
+void test_f16_value_round_trip() {
+    const LMDBStore::EmbeddingList samples = codec_samples(3, 7);
+    const std::vector<std::uint8_t> bytes = Codec::serialize(samples, SampleEncoding::F16);
+    EXPECT(Codec::parse(PlacedValue(bytes, 0).value).encoding == SampleEncoding::F16);
+    // Half precision keeps 11 significant bits.
+    expect_round_trip(bytes, samples, [](std::size_t, float v) { return std::fabs(v) * 0x1p-11f + 1e-7f; });
+}
+
+void test_int8_value_round_trip() {
+    const LMDBStore::EmbeddingList samples = codec_samples(3, 7);
+    const std::vector<std::uint8_t> bytes = Codec::serialize(samples, SampleEncoding::I8);
+    EXPECT(Codec::parse(PlacedValue(bytes, 0).value).encoding == SampleEncoding::I8);
+    // Rounding to the nearest code is off by at most half a step, peak/254.
+    std::vector<float> half_step;
+    for (const auto& sample : samples) {
+        float peak = 0.0f;
+        for (float v : sample) {
+            peak = std::max(peak, std::fabs(v));
+        }
+        half_step.push_back(peak / 254.0f * 1.0001f);
+    }
+    expect_round_trip(bytes, samples, [&](std::size_t i, float) { return half_step[i]; });
+}
+
+void test_stored_mean_matches_samples() {
+    for (SampleEncoding encoding : {SampleEncoding::F32, SampleEncoding::F16, SampleEncoding::I8}) {
+        // Sum the decoded samples as append_in_txn does, then store the mean.
+        const LMDBStore::EmbeddingList decoded =
+            decode_value(PlacedValue(Codec::serialize(codec_samples(4, 6), encoding), 0).value);
+        std::vector<double> sum(6, 0.0);
+        for (const auto& sample : decoded) {
+            for (std::size_t d = 0; d < sum.size(); ++d) {
+                sum[d] += sample[d];
+            }
+        }
+        const std::vector<std::uint8_t> bytes = Codec::serialize_mean(sum, decoded.size());
+        for (std::size_t offset : {0, 1}) {
+            PlacedValue placed(bytes, offset);
+            std::vector<float> scratch;
+            const Codec::View mean = Codec::align_mean(Codec::parse_mean(placed.value), scratch);
+            EXPECT(mean.count == 4 && mean.dim == 6);
+            for (std::size_t d = 0; d < mean.dim; ++d) {
+                float value = 0.0f;
+                std::memcpy(&value, mean.data + d, sizeof(value));
+                EXPECT(std::fabs(value - static_cast<float>(sum[d] / 4.0)) <= 1e-6f);
+            }
+        }
+    }
+}
+
+void test_truncated_values_rejected() {
+    for (SampleEncoding encoding : {SampleEncoding::F32, SampleEncoding::F16, SampleEncoding::I8}) {
+        std::vector<std::uint8_t> bytes = Codec::serialize(codec_samples(2, 4), encoding);
+        bytes.pop_back();
+        bool threw = false;
+        try {
+            Codec::parse(PlacedValue(bytes, 0).value);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        EXPECT(threw);
+    }
+}
+
+} // namespace
+
+int main() {
+    test_consecutive_hits_accept();
+    test_score_below_threshold_breaks_streak();
+    test_absent_frame_breaks_streak();
+    test_running_average_covers_scored_frames_only();
+    test_hnsw_round_trip();
+    test_hnsw_rejects_truncated_file();
+    test_hnsw_rejects_crafted_header();
+    test_archive_round_trip();
+    test_archive_rejects_oversized_profile();
+    test_legacy_value_round_trip();
+    test_v2_value_round_trip();
+    test_f16_value_round_trip();
+    test_int8_value_round_trip();
+    test_stored_mean_matches_samples();
+    test_truncated_values_rejected();
+    if (failures > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
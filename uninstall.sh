@@ -22,6 +22,8 @@ done
 echo "Uninstalling LXFU from ${PREFIX}..."
 
 rm -f "${PREFIX}/bin/lxfu"
+rm -f "${PREFIX}/bin/lxfud"
+rm -f "${PREFIX}/lib/systemd/system/lxfud.service"
 rm -f "${PREFIX}/lib/security/pam_lxfu.so"
 rm -f "${PREFIX}/share/lxfu/dino.pt"
 